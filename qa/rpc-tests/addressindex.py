@@ -0,0 +1,89 @@
+#!/usr/bin/env python2
+# Copyright (c) 2014 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the address index and the getaddress* RPCs.
+# node0 runs with -addressindex and only ever receives and spends from
+# one address; node1 mines and has the index disabled.
+#
+
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import JSONRPCException
+from util import *
+
+class AddressIndexTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir, [["-addressindex"], []])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        self.nodes[1].setgenerate(True, 101)
+        self.sync_all()
+
+        address = self.nodes[0].getnewaddress()
+        assert_equal(self.nodes[0].getaddressbalance([address]), { "balance" : 0, "received" : 0 })
+        assert_equal(self.nodes[0].getaddresstxids([address]), [])
+
+        # A payment shows up in the mempool view first
+        txid = self.nodes[1].sendtoaddress(address, 10)
+        self.sync_all()
+        mempool = self.nodes[0].getaddressmempool([address])
+        assert_equal(len(mempool), 1)
+        assert_equal(mempool[0]["txid"], txid)
+        assert_equal(mempool[0]["address"], address)
+        assert_equal(mempool[0]["satoshis"], 10 * 100000000)
+
+        # ... and in the confirmed index once mined
+        self.nodes[1].setgenerate(True, 1)
+        self.sync_all()
+        assert_equal(self.nodes[0].getaddressmempool([address]), [])
+        assert_equal(self.nodes[0].getaddresstxids([address]), [txid])
+        assert_equal(self.nodes[0].getaddresstxids([address], 102, 102), [txid])
+        assert_equal(self.nodes[0].getaddresstxids([address], 1, 101), [])
+        assert_equal(self.nodes[0].getaddressbalance([address]), { "balance" : 10 * 100000000, "received" : 10 * 100000000 })
+        utxos = self.nodes[0].getaddressutxos([address])
+        assert_equal(len(utxos), 1)
+        assert_equal(utxos[0]["txid"], txid)
+        assert_equal(utxos[0]["height"], 102)
+        assert_equal(utxos[0]["satoshis"], 10 * 100000000)
+
+        # Spending the only coin of node0 empties the address
+        spendid = self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 5)
+        self.sync_all()
+        mempool = self.nodes[0].getaddressmempool([address])
+        assert_equal(len(mempool), 1)
+        assert_equal(mempool[0]["txid"], spendid)
+        assert_equal(mempool[0]["satoshis"], -10 * 100000000)
+        assert_equal(mempool[0]["prevtxid"], txid)
+
+        self.nodes[1].setgenerate(True, 1)
+        self.sync_all()
+        assert_equal(self.nodes[0].getaddresstxids([address]), [txid, spendid])
+        assert_equal(self.nodes[0].getaddressbalance([address]), { "balance" : 0, "received" : 10 * 100000000 })
+        assert_equal(self.nodes[0].getaddressutxos([address]), [])
+
+        # Disconnecting the spending block restores the output
+        self.nodes[0].invalidateblock(self.nodes[0].getbestblockhash())
+        assert_equal(self.nodes[0].getaddresstxids([address]), [txid])
+        assert_equal(self.nodes[0].getaddressbalance([address]), { "balance" : 10 * 100000000, "received" : 10 * 100000000 })
+        assert_equal(len(self.nodes[0].getaddressutxos([address])), 1)
+        assert_equal(self.nodes[0].getaddressmempool([address])[0]["txid"], spendid)
+
+        # The calls fail cleanly without -addressindex
+        try:
+            self.nodes[1].getaddressbalance([address])
+            raise AssertionError("getaddressbalance succeeded without -addressindex")
+        except JSONRPCException as e:
+            assert("-addressindex" in e.error["message"])
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
@@ -0,0 +1,74 @@
+#!/usr/bin/env python2
+# Copyright (c) 2014 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test loading the block index from the snapshot written at shutdown.
+# The node keeps a fork with an invalidated block, so the reloaded index
+# has to restore chain work, validity flags and every chain tip.
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+import os
+
+class BlockIndexSnapshotTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = [ start_node(0, self.options.tmpdir) ]
+        self.is_network_split = False
+
+    def snapshot_loads(self):
+        log = open(os.path.join(self.options.tmpdir, "node0", "regtest", "debug.log")).read()
+        return log.count("Loaded block index snapshot")
+
+    def restart(self, extra_args=None):
+        stop_node(self.nodes[0], 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir, extra_args)
+
+    def state(self):
+        node = self.nodes[0]
+        return (node.getbestblockhash(), node.getblockcount(), sorted(node.getchaintips()),
+                node.getblockchaininfo()["chainwork"])
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.setgenerate(True, 10)
+        node.invalidateblock(node.getblockhash(8))
+        node.setgenerate(True, 3)
+        before = self.state()
+        assert_equal(before[1], 10)
+        assert_equal(len(before[2]), 2)
+
+        # Restarting loads the index from the snapshot
+        self.restart()
+        assert_equal(self.snapshot_loads(), 1)
+        assert_equal(self.state(), before)
+
+        # The chain keeps working on top of the loaded index
+        self.nodes[0].setgenerate(True, 1)
+        before = self.state()
+
+        # With the snapshot disabled the index comes from the database
+        self.restart(["-blockindexsnapshot=0"])
+        assert_equal(self.snapshot_loads(), 1)
+        assert_equal(self.state(), before)
+
+        # The old snapshot is never picked up again once the database moved on
+        self.nodes[0].setgenerate(True, 1)
+        before = self.state()
+        self.restart()
+        assert_equal(self.snapshot_loads(), 1)
+        assert_equal(self.state(), before)
+
+        self.restart()
+        assert_equal(self.snapshot_loads(), 2)
+        assert_equal(self.state(), before)
+
+if __name__ == '__main__':
+    BlockIndexSnapshotTest().main()
@@ -0,0 +1,84 @@
+#!/usr/bin/env python2
+# Copyright (c) 2014 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test mempool persistence across restarts.
+# node1 keeps its mempool (and prioritisation) in mempool.dat at
+# shutdown and reloads it in the background on startup; node0 runs
+# with -persistmempool=0 and comes back with an empty mempool until
+# it is handed node1's dump.
+# The transactions are signed by node0 but only ever submitted to
+# node1, so no wallet re-accepts them behind the mempool's back.
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+from decimal import Decimal
+import os
+import shutil
+import time
+
+class MempoolPersistTest(BitcoinTestFramework):
+
+    def setup_network(self):
+        # Unconnected, so the mempools only change through restarts
+        self.nodes = start_nodes(2, self.options.tmpdir)
+        self.is_network_split = True
+
+    def wait_loaded(self, node):
+        for i in range(100):
+            if node.getmempoolinfo()["loaded"]:
+                return
+            time.sleep(0.1)
+        raise AssertionError("mempool was not loaded")
+
+    def create_tx(self, utxo, to_address):
+        inputs = [{ "txid" : utxo["txid"], "vout" : utxo["vout"]}]
+        outputs = { to_address : utxo["amount"] - Decimal("0.001") }
+        rawtx = self.nodes[0].createrawtransaction(inputs, outputs)
+        signresult = self.nodes[0].signrawtransaction(rawtx)
+        assert_equal(signresult["complete"], True)
+        return signresult["hex"]
+
+    def run_test(self):
+        address = self.nodes[0].getnewaddress()
+        utxos = self.nodes[0].listunspent()[:5]
+        txids = [ self.nodes[1].sendrawtransaction(self.create_tx(utxo, address)) for utxo in utxos ]
+        self.nodes[1].prioritisetransaction(txids[0], 0, 1000)
+        before = self.nodes[1].getrawmempool(True)
+        assert_equal(len(before), 5)
+
+        stop_nodes(self.nodes)
+        wait_bitcoinds()
+        self.nodes = [ start_node(0, self.options.tmpdir, ["-persistmempool=0"]),
+                       start_node(1, self.options.tmpdir) ]
+
+        # node1 reloads every transaction with its entry time and fee delta
+        self.wait_loaded(self.nodes[1])
+        after = self.nodes[1].getrawmempool(True)
+        assert_equal(set(after.keys()), set(txids))
+        for txid in txids:
+            assert_equal(after[txid]["time"], before[txid]["time"])
+            assert_equal(after[txid]["ancestorfees"], before[txid]["ancestorfees"])
+
+        # node0 does not persist its mempool
+        self.wait_loaded(self.nodes[0])
+        assert_equal(len(self.nodes[0].getrawmempool()), 0)
+
+        # savemempool writes a dump that another node can load
+        node0_dump = os.path.join(self.options.tmpdir, "node0", "regtest", "mempool.dat")
+        node1_dump = os.path.join(self.options.tmpdir, "node1", "regtest", "mempool.dat")
+        os.remove(node1_dump)
+        self.nodes[1].savemempool()
+        assert(os.path.isfile(node1_dump))
+
+        stop_node(self.nodes[0], 0)
+        shutil.copyfile(node1_dump, node0_dump)
+        self.nodes[0] = start_node(0, self.options.tmpdir)
+        self.wait_loaded(self.nodes[0])
+        assert_equal(set(self.nodes[0].getrawmempool()), set(txids))
+
+if __name__ == '__main__':
+    MempoolPersistTest().main()
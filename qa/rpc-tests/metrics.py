@@ -0,0 +1,78 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the Prometheus metrics served on /metrics with -metrics.
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+
+try:
+    import http.client as httplib
+except ImportError:
+    import httplib
+try:
+    import urllib.parse as urlparse
+except ImportError:
+    import urlparse
+
+def get_metrics(node):
+    url = urlparse.urlparse(node.url)
+    conn = httplib.HTTPConnection(url.hostname, url.port)
+    conn.request('GET', '/metrics')
+    return conn.getresponse()
+
+def parse_metrics(text):
+    samples = {}
+    for line in text.splitlines():
+        if line and not line.startswith('#'):
+            name, value = line.rsplit(' ', 1)
+            samples[name] = float(value)
+    return samples
+
+class MetricsTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir, [["-metrics"], []])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        # Disabled by default
+        assert_equal(get_metrics(self.nodes[1]).status, 404)
+
+        self.nodes[1].setgenerate(True, 5)
+        sync_blocks(self.nodes)
+
+        response = get_metrics(self.nodes[0])
+        assert_equal(response.status, 200)
+        assert(response.getheader('content-type').startswith('text/plain'))
+        samples = parse_metrics(response.read())
+
+        assert_equal(samples["briliantcoin_chain_height"], 5)
+        assert_equal(samples["briliantcoin_blocks_connected_total"], 5)
+        assert_equal(samples["briliantcoin_block_transactions_total"], 5)
+        assert_equal(samples["briliantcoin_block_connect_seconds_count"], 5)
+        assert_equal(samples['briliantcoin_block_connect_seconds_bucket{le="+Inf"}'], 5)
+        assert_equal(samples["briliantcoin_net_peers"], 2)
+        assert(samples["briliantcoin_net_received_bytes_total"] > 0)
+        assert(samples["briliantcoin_net_received_messages_total"] > 0)
+        assert(samples["briliantcoin_coins_cache_misses_total"] > 0)
+
+        # Counters keep going up between scrapes
+        self.nodes[1].setgenerate(True, 1)
+        sync_blocks(self.nodes)
+        samples = parse_metrics(get_metrics(self.nodes[0]).read())
+        assert_equal(samples["briliantcoin_chain_height"], 6)
+        assert_equal(samples["briliantcoin_blocks_connected_total"], 6)
+
+if __name__ == '__main__':
+    MetricsTest().main()
@@ -0,0 +1,54 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the per message type statistics of getnetmsgstats and getpeerinfo.
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+
+class NetMsgStatsTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        self.nodes[0].setgenerate(True, 5)
+        sync_blocks(self.nodes)
+
+        sent = self.nodes[0].getnetmsgstats()
+        recv = self.nodes[1].getnetmsgstats()
+
+        # The handshakes went both ways
+        for stats in (sent, recv):
+            assert(stats["version"]["msgsrecv"] >= 1)
+            assert_equal(stats["version"]["msgssent"], stats["version"]["msgsrecv"])
+            assert_equal(stats["verack"]["msgsprocessed"], stats["verack"]["msgsrecv"])
+
+        # Node 1 fetched the five blocks node 0 announced
+        assert_equal(recv["block"]["msgsrecv"], 5)
+        assert_equal(recv["block"]["msgsprocessed"], 5)
+        assert_equal(sent["block"]["msgssent"], 5)
+        assert_equal(sent["block"]["bytessent"], recv["block"]["bytesrecv"])
+        assert(recv["block"]["processtime"] > 0)
+        assert(recv["block"]["processtimemax"] <= recv["block"]["processtime"])
+        assert(recv["block"]["queuetime"] >= 0)
+
+        # Each peer's stats only cover traffic with that peer
+        peers = self.nodes[1].getpeerinfo()
+        assert_equal(sum(peer["msgstats"]["block"]["msgsrecv"] for peer in peers if "block" in peer["msgstats"]), 5)
+        for peer in peers:
+            assert_equal(sum(stats["bytesrecv"] for stats in peer["msgstats"].values()), peer["bytesrecv"])
+
+if __name__ == '__main__':
+    NetMsgStatsTest().main()
@@ -29,6 +29,19 @@ def http_get_call(host, port, path, response_object = 0):
         
     return conn.getresponse().read()
 
+def http_post_call(host, port, path, requestdata = '', response_object = 0):
+    conn = httplib.HTTPConnection(host, port)
+    conn.request('POST', path, requestdata)
+
+    if response_object:
+        return conn.getresponse()
+
+    return conn.getresponse().read()
+
+
+def reverse_hex(hexstr):
+    return ''.join(reversed([hexstr[i:i+2] for i in range(0, len(hexstr), 2)]))
+
 
 class RESTTest (BitcoinTestFramework):
     FORMAT_SEPARATOR = "."
@@ -59,29 +72,81 @@ class RESTTest (BitcoinTestFramework):
         assert_greater_than(int(response.getheader('content-length')), 10)
         
         # check block tx details
-        # let's make 3 tx and mine them on node 1
+        # let's make 4 tx and mine them on node 1
         txs = []
         txs.append(self.nodes[0].sendtoaddress(self.nodes[2].getnewaddress(), 11))
         txs.append(self.nodes[0].sendtoaddress(self.nodes[2].getnewaddress(), 11))
         txs.append(self.nodes[0].sendtoaddress(self.nodes[2].getnewaddress(), 11))
+        txs.append(self.nodes[0].sendtoaddress(self.nodes[2].getnewaddress(), 0.12345678))
         self.sync_all()
         
         # now mine the transactions
         newblockhash = self.nodes[1].setgenerate(True, 1)
         self.sync_all()
         
-        #check if the 3 tx show up in the new block
+        #check if the 4 tx show up in the new block
         json_string = http_get_call(url.hostname, url.port, '/rest/block/'+newblockhash[0]+self.FORMAT_SEPARATOR+'json')
         json_obj = json.loads(json_string)
         for tx in json_obj['tx']:
             if not 'coinbase' in tx['vin'][0]: #exclude coinbase
                 assert_equal(tx['txid'] in txs, True)
         
+        #the streamed block writes amounts like the non-streamed tx reply, with 8 decimals
+        assert('"value":0.12345678' in json_string)
+        for tx in txs:
+            tx_string = http_get_call(url.hostname, url.port, '/rest/tx/'+tx+self.FORMAT_SEPARATOR+'json')
+            vout_string = tx_string[tx_string.index('"vout":'):tx_string.index(',"blockhash"')]
+            assert(vout_string in json_string)
+
         #check the same but without tx details
         json_string = http_get_call(url.hostname, url.port, '/rest/block/notxdetails/'+newblockhash[0]+self.FORMAT_SEPARATOR+'json')
         json_obj = json.loads(json_string)
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
+
+        # check headers: the new block is the tip, so at most one header follows its parent
+        json_string = http_get_call(url.hostname, url.port, '/rest/headers/5/'+bb_hash+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj), 2)
+        assert_equal(json_obj[0]['hash'], bb_hash)
+        assert_equal(json_obj[1]['hash'], newblockhash[0])
+        response = http_get_call(url.hostname, url.port, '/rest/headers/5/'+bb_hash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_equal(int(response.getheader('content-length')), 2*80)
+        response = http_get_call(url.hostname, url.port, '/rest/headers/2001/'+bb_hash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 400)
+
+        # check chaininfo
+        json_string = http_get_call(url.hostname, url.port, '/rest/chaininfo'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj['bestblockhash'], newblockhash[0])
+
+        # check getutxos: the first output of one of the mined transactions is unspent or change
+        tx_json = self.nodes[0].getrawtransaction(txs[0], 1)
+        n = 0
+        for vout in tx_json['vout']:
+            if vout['value'] == 11:
+                n = vout['n']
+        json_string = http_get_call(url.hostname, url.port, '/rest/getutxos/'+txs[0]+'-'+str(n)+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj['chaintipHash'], newblockhash[0])
+        assert_equal(json_obj['bitmap'], "1")
+        assert_equal(len(json_obj['utxos']), 1)
+        assert_equal(json_obj['utxos'][0]['value'], 11)
+
+        # an unknown outpoint is reported as a miss, binary input is accepted as post data
+        json_string = http_get_call(url.hostname, url.port, '/rest/getutxos/checkmempool/'+txs[0]+'-'+str(n)+'/'+'0'*64+'-0'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj['bitmap'], "10")
+        bin_request = '01' + '01' + reverse_hex(txs[0]) + ('%08x' % n)[6:8] + ('%08x' % n)[4:6] + ('%08x' % n)[2:4] + ('%08x' % n)[0:2]
+        hex_string = http_post_call(url.hostname, url.port, '/rest/getutxos'+self.FORMAT_SEPARATOR+'hex', bin_request)
+        assert_equal(hex_string[(4+32)*2:(4+32+2)*2], '0101') # bitmap with one byte, first bit set
+
+        # URI and post data inputs can't be mixed, too many outpoints are refused
+        response = http_post_call(url.hostname, url.port, '/rest/getutxos/'+txs[0]+'-0'+self.FORMAT_SEPARATOR+'hex', bin_request, True)
+        assert_equal(response.status, 400)
+        response = http_get_call(url.hostname, url.port, '/rest/getutxos/checkmempool'+('/'+txs[0]+'-0')*101+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
                 
         
 
@@ -0,0 +1,232 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2014 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+/** Kinds of destination the address index is keyed by */
+enum AddressIndexType {
+    ADDRESS_INDEX_PUBKEYHASH = 1, //! pay-to-pubkey and pay-to-pubkey-hash outputs, by key id
+    ADDRESS_INDEX_SCRIPTHASH = 2, //! pay-to-script-hash outputs, by script id
+};
+
+/**
+ * An address index entry: output index of a transaction at (blockHeight,
+ * txindex) paying to the address, or input index spending from it when
+ * fSpending is set. The value stored with it is the amount, negated for
+ * spends.
+ *
+ * Heights and block positions are serialized big-endian, so the entries of
+ * an address are stored in chain order and a height range is a single
+ * LevelDB range scan.
+ */
+struct CAddressIndexKey
+{
+    unsigned char type;
+    uint160 hashBytes;
+    int blockHeight;
+    unsigned int txindex;
+    uint256 txhash;
+    unsigned int index;
+    bool fSpending;
+
+    CAddressIndexKey()
+    {
+        SetNull();
+    }
+
+    CAddressIndexKey(unsigned char addressType, const uint160& addressHash, int height, unsigned int blockindex,
+                     const uint256& txid, unsigned int indexValue, bool isSpending) :
+        type(addressType), hashBytes(addressHash), blockHeight(height), txindex(blockindex),
+        txhash(txid), index(indexValue), fSpending(isSpending) {}
+
+    void SetNull()
+    {
+        type = 0;
+        hashBytes = 0;
+        blockHeight = 0;
+        txindex = 0;
+        txhash = 0;
+        index = 0;
+        fSpending = false;
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 66;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, type, nType, nVersion);
+        hashBytes.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+        txhash.Serialize(s, nType, nVersion);
+        ::Serialize(s, index, nType, nVersion);
+        ::Serialize(s, fSpending, nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        ::Unserialize(s, type, nType, nVersion);
+        hashBytes.Unserialize(s, nType, nVersion);
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+        txhash.Unserialize(s, nType, nVersion);
+        ::Unserialize(s, index, nType, nVersion);
+        ::Unserialize(s, fSpending, nType, nVersion);
+    }
+};
+
+/** Leading part of a CAddressIndexKey, to seek to an address from a given height */
+struct CAddressIndexIteratorKey
+{
+    unsigned char type;
+    uint160 hashBytes;
+    int blockHeight;
+
+    CAddressIndexIteratorKey(unsigned char addressType, const uint160& addressHash, int height) :
+        type(addressType), hashBytes(addressHash), blockHeight(height) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 25;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, type, nType, nVersion);
+        hashBytes.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, blockHeight);
+    }
+};
+
+/** An unspent output paying to an address */
+struct CAddressUnspentKey
+{
+    unsigned char type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int index;
+
+    CAddressUnspentKey() : type(0), hashBytes(0), txhash(0), index(0) {}
+
+    CAddressUnspentKey(unsigned char addressType, const uint160& addressHash, const uint256& txid, unsigned int indexValue) :
+        type(addressType), hashBytes(addressHash), txhash(txid), index(indexValue) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(type);
+        READWRITE(hashBytes);
+        READWRITE(txhash);
+        READWRITE(index);
+    }
+};
+
+/** Prefix of the CAddressUnspentKeys of one address */
+struct CAddressUnspentIteratorKey
+{
+    unsigned char type;
+    uint160 hashBytes;
+
+    CAddressUnspentIteratorKey(unsigned char addressType, const uint160& addressHash) :
+        type(addressType), hashBytes(addressHash) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(type);
+        READWRITE(hashBytes);
+    }
+};
+
+/** Value of an unspent output; a null value erases the entry */
+struct CAddressUnspentValue
+{
+    CAmount satoshis;
+    CScript script;
+    int blockHeight;
+
+    CAddressUnspentValue()
+    {
+        SetNull();
+    }
+
+    CAddressUnspentValue(CAmount amount, const CScript& scriptPubKey, int height) :
+        satoshis(amount), script(scriptPubKey), blockHeight(height) {}
+
+    void SetNull()
+    {
+        satoshis = -1;
+        script.clear();
+        blockHeight = 0;
+    }
+
+    bool IsNull() const
+    {
+        return satoshis == -1;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(satoshis);
+        READWRITE(script);
+        READWRITE(blockHeight);
+    }
+};
+
+/** An output created (or spent, with fSpending) by a mempool transaction */
+struct CMempoolAddressDeltaKey
+{
+    unsigned char type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int index;
+    bool fSpending;
+
+    CMempoolAddressDeltaKey(unsigned char addressType, const uint160& addressHash, const uint256& txid = 0,
+                            unsigned int indexValue = 0, bool isSpending = false) :
+        type(addressType), hashBytes(addressHash), txhash(txid), index(indexValue), fSpending(isSpending) {}
+
+    friend bool operator<(const CMempoolAddressDeltaKey& a, const CMempoolAddressDeltaKey& b)
+    {
+        if (a.type != b.type)
+            return a.type < b.type;
+        if (a.hashBytes != b.hashBytes)
+            return a.hashBytes < b.hashBytes;
+        if (a.txhash != b.txhash)
+            return a.txhash < b.txhash;
+        if (a.index != b.index)
+            return a.index < b.index;
+        return a.fSpending < b.fSpending;
+    }
+};
+
+struct CMempoolAddressDelta
+{
+    int64_t time;
+    CAmount amount;
+    uint256 prevhash; //! For spends, the output being spent
+    unsigned int prevout;
+
+    CMempoolAddressDelta(int64_t t, CAmount a, const uint256& hash = 0, unsigned int out = 0) :
+        time(t), amount(a), prevhash(hash), prevout(out) {}
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -64,3 +64,55 @@ bool MemoryPageLocker::Unlock(const void* addr, size_t len)
 LockedPageManager::LockedPageManager() : LockedPageManagerBase<MemoryPageLocker>(GetSystemPageSize())
 {
 }
+
+CStreamBufferPool* CStreamBufferPool::_instance = NULL;
+boost::once_flag CStreamBufferPool::init_flag = BOOST_ONCE_INIT;
+
+/** Return the size class of an allocation, or -1 if it is too large to be pooled */
+static inline int GetSizeClass(size_t nSize)
+{
+    unsigned int nBits = CStreamBufferPool::MIN_CLASS_BITS;
+    while (nBits <= CStreamBufferPool::MAX_CLASS_BITS && ((size_t)1 << nBits) < nSize)
+        nBits++;
+    if (nBits > CStreamBufferPool::MAX_CLASS_BITS)
+        return -1;
+    return nBits - CStreamBufferPool::MIN_CLASS_BITS;
+}
+
+void* CStreamBufferPool::Allocate(size_t nSize)
+{
+    int nClass = GetSizeClass(nSize);
+    if (nClass < 0)
+        return ::operator new(nSize);
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (!vFree[nClass].empty()) {
+            void* p = vFree[nClass].back();
+            vFree[nClass].pop_back();
+            nPooledBytes -= (size_t)1 << (nClass + MIN_CLASS_BITS);
+            return p;
+        }
+    }
+    return ::operator new((size_t)1 << (nClass + MIN_CLASS_BITS));
+}
+
+void CStreamBufferPool::Deallocate(void* p, size_t nSize)
+{
+    int nClass = GetSizeClass(nSize);
+    if (nClass >= 0) {
+        size_t nClassSize = (size_t)1 << (nClass + MIN_CLASS_BITS);
+        boost::mutex::scoped_lock lock(mutex);
+        if (nPooledBytes + nClassSize <= MAX_POOLED_BYTES) {
+            vFree[nClass].push_back(p);
+            nPooledBytes += nClassSize;
+            return;
+        }
+    }
+    ::operator delete(p);
+}
+
+size_t CStreamBufferPool::GetPooledBytes()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return nPooledBytes;
+}
@@ -259,10 +259,101 @@ struct zero_after_free_allocator : public std::allocator<T> {
     }
 };
 
+/**
+ * Process-wide pool of buffers for serialized public data, such as network
+ * messages and relayed transactions.
+ *
+ * Requests are rounded up to a power-of-two size class, and freed buffers are
+ * kept on a free list per class (up to MAX_POOLED_BYTES in total) to serve
+ * later requests of the same class, so the per-message buffers of the network
+ * code stop going through the system allocator. Buffers are not wiped when
+ * they are freed; never use the pool for key material.
+ */
+class CStreamBufferPool
+{
+public:
+    //! Smallest and largest size class (as a power of two); larger requests are not pooled
+    static const unsigned int MIN_CLASS_BITS = 6;
+    static const unsigned int MAX_CLASS_BITS = 21;
+    //! Maximum number of bytes kept in free buffers
+    static const size_t MAX_POOLED_BYTES = 16 * 1024 * 1024;
+
+    static CStreamBufferPool& Instance()
+    {
+        boost::call_once(CStreamBufferPool::CreateInstance, CStreamBufferPool::init_flag);
+        return *CStreamBufferPool::_instance;
+    }
+
+    void* Allocate(size_t nSize);
+    void Deallocate(void* p, size_t nSize);
+
+    //! Get the number of bytes held in free buffers, for diagnostics
+    size_t GetPooledBytes();
+
+private:
+    boost::mutex mutex;
+    std::vector<void*> vFree[MAX_CLASS_BITS - MIN_CLASS_BITS + 1];
+    size_t nPooledBytes;
+
+    CStreamBufferPool() : nPooledBytes(0) {}
+
+    static void CreateInstance()
+    {
+        // Never destroyed: buffers owned by static objects may be freed
+        // after any local static instance would be gone.
+        CStreamBufferPool::_instance = new CStreamBufferPool();
+    }
+
+    static CStreamBufferPool* _instance;
+    static boost::once_flag init_flag;
+};
+
+//
+// Allocator that takes its memory from the stream buffer pool, without
+// clearing it before deletion. Only for public data.
+//
+template <typename T>
+struct pooled_allocator : public std::allocator<T> {
+    // MSVC8 default copy constructor is broken
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+    pooled_allocator() throw() {}
+    pooled_allocator(const pooled_allocator& a) throw() : base(a) {}
+    template <typename U>
+    pooled_allocator(const pooled_allocator<U>& a) throw() : base(a)
+    {
+    }
+    ~pooled_allocator() throw() {}
+    template <typename _Other>
+    struct rebind {
+        typedef pooled_allocator<_Other> other;
+    };
+
+    T* allocate(std::size_t n, const void* hint = 0)
+    {
+        return static_cast<T*>(CStreamBufferPool::Instance().Allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (p != NULL)
+            CStreamBufferPool::Instance().Deallocate(p, sizeof(T) * n);
+    }
+};
+
 // This is exactly like std::string, but with a custom allocator.
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
 // Byte-vector that clears its contents before deletion.
 typedef std::vector<char, zero_after_free_allocator<char> > CSerializeData;
 
+// Byte-vector for public data, drawn from the stream buffer pool.
+typedef std::vector<char, pooled_allocator<char> > CNetSerializeData;
+
 #endif // BITCOIN_ALLOCATORS_H
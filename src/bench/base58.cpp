@@ -0,0 +1,47 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "base58.h"
+
+#include <vector>
+
+static void Base58Encode(benchmark::State& state)
+{
+    std::vector<unsigned char> buff(32, 0x42);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            EncodeBase58(buff);
+            buff[i % 32]++;
+        }
+    }
+}
+
+static void Base58CheckEncode(benchmark::State& state)
+{
+    std::vector<unsigned char> buff(21, 0x42);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            EncodeBase58Check(buff);
+            buff[i % 21]++;
+        }
+    }
+}
+
+static void Base58Decode(benchmark::State& state)
+{
+    const char* addr = "17VZNX1SN5NtKa8UQFxwQbFeFc3iqRYhem";
+    std::vector<unsigned char> vch;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            vch.clear();
+            DecodeBase58(addr, vch);
+        }
+    }
+}
+
+BENCHMARK(Base58Encode);
+BENCHMARK(Base58CheckEncode);
+BENCHMARK(Base58Decode);
@@ -0,0 +1,99 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "utiltime.h"
+
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+using namespace benchmark;
+
+BenchRunner::BenchmarkMap& BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarks_map;
+    return benchmarks_map;
+}
+
+static double gettimedouble(void)
+{
+    return GetTimeMicros() * 0.000001;
+}
+
+BenchRunner::BenchRunner(std::string name, BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+void BenchRunner::RunAll(double elapsedTimeForOne, const std::string& filter)
+{
+    std::cout << "#Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average" << "\n";
+
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it) {
+        if (it->first.find(filter) == std::string::npos)
+            continue;
+        State state(it->first, elapsedTimeForOne);
+        BenchFunction& func = it->second;
+        func(state);
+    }
+}
+
+State::State(std::string _name, double _maxElapsed) : name(_name), maxElapsed(_maxElapsed), count(0)
+{
+    minTime = std::numeric_limits<double>::max();
+    maxTime = std::numeric_limits<double>::min();
+    timeMultiplier = 1.0;
+    countMask = 0;
+}
+
+bool State::KeepRunning()
+{
+    // Reading the clock costs about as much as a very fast benchmark body, so
+    // only look at it once every countMask+1 iterations.
+    if (count & countMask) {
+        ++count;
+        return true;
+    }
+    double now;
+    if (count == 0) {
+        lastTime = beginTime = now = gettimedouble();
+    } else {
+        now = gettimedouble();
+        double elapsed = now - lastTime;
+        double elapsedOne = elapsed * timeMultiplier;
+        if (elapsedOne < minTime) minTime = elapsedOne;
+        if (elapsedOne > maxTime) maxTime = elapsedOne;
+        if (elapsed * 128 < maxElapsed) {
+            // Much too fast to time per batch: grow the batch 8x and restart
+            // timing, so the measurement does not include this code.
+            countMask = ((countMask << 3) | 7) & ((1ULL << 60) - 1);
+            timeMultiplier = 1.0 / (countMask + 1);
+            count = 0;
+            minTime = std::numeric_limits<double>::max();
+            maxTime = std::numeric_limits<double>::min();
+            return true;
+        }
+        if (elapsed * 16 < maxElapsed) {
+            uint64_t newCountMask = ((countMask << 1) | 1) & ((1ULL << 60) - 1);
+            if ((count & newCountMask) == 0) {
+                countMask = newCountMask;
+                timeMultiplier = 1.0 / (countMask + 1);
+            }
+        }
+    }
+    lastTime = now;
+    ++count;
+
+    if (now - beginTime < maxElapsed) return true; // Keep going
+
+    --count;
+
+    // Output results
+    double average = (now - beginTime) / count;
+    std::cout << std::fixed << std::setprecision(15) << name << "," << count << "," << minTime << "," << maxTime << "," << average << "\n";
+
+    return false;
+}
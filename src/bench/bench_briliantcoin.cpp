@@ -0,0 +1,30 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/sha256.h"
+#include "util.h"
+
+#include <iostream>
+
+int
+main(int argc, char** argv)
+{
+    SetupEnvironment();
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-help")) {
+        std::cout << "Usage: bench_briliantcoin [options]\n\n"
+                  << "  -filter=<name>  Only run benchmarks whose name contains <name>\n"
+                  << "  -time=<n>       Run each benchmark for about <n> seconds (default: 1)\n";
+        return 0;
+    }
+
+    SHA256AutoDetect();
+    SelectParams(CBaseChainParams::MAIN);
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+
+    benchmark::BenchRunner::RunAll(atof(GetArg("-time", "1").c_str()), GetArg("-filter", ""));
+}
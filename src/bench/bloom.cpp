@@ -0,0 +1,68 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "bloom.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/script.h"
+
+#include <cassert>
+#include <vector>
+
+/* Number of transactions matched against the filter per iteration */
+static const unsigned int NUM_TXS = 1000;
+
+static CScript RandomP2PKHScript()
+{
+    std::vector<unsigned char> vchHash(20);
+    GetRandBytes(&vchHash[0], vchHash.size());
+    return CScript() << OP_DUP << OP_HASH160 << vchHash << OP_EQUALVERIFY << OP_CHECKSIG;
+}
+
+/**
+ * Match a block's worth of two-output pay-to-pubkey-hash transactions
+ * against the filter of an SPV wallet watching 100 addresses, a few of
+ * which the transactions pay.
+ */
+static void BloomFilter_IsRelevantAndUpdate(benchmark::State& state)
+{
+    CBloomFilter filterWallet(1000, 0.0001, 0, BLOOM_UPDATE_ALL);
+    for (int i = 0; i < 100; i++) {
+        std::vector<unsigned char> vchHash(20);
+        GetRandBytes(&vchHash[0], vchHash.size());
+        filterWallet.insert(vchHash);
+    }
+
+    std::vector<CTransaction> vtx;
+    for (unsigned int i = 0; i < NUM_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vin[0].prevout.n = 0;
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+        tx.vout.resize(2);
+        for (unsigned int j = 0; j < 2; j++) {
+            tx.vout[j].nValue = 1000;
+            tx.vout[j].scriptPubKey = RandomP2PKHScript();
+        }
+        if (i % 100 == 0) {
+            std::vector<unsigned char> vchHash(tx.vout[0].scriptPubKey.begin() + 3, tx.vout[0].scriptPubKey.begin() + 23);
+            filterWallet.insert(vchHash);
+        }
+        vtx.push_back(tx);
+    }
+
+    while (state.KeepRunning()) {
+        CBloomFilter filter(filterWallet);
+        unsigned int nMatches = 0;
+        for (unsigned int i = 0; i < vtx.size(); i++)
+            if (filter.IsRelevantAndUpdate(vtx[i]))
+                nMatches++;
+        assert(nMatches >= NUM_TXS / 100);
+    }
+}
+
+BENCHMARK(BloomFilter_IsRelevantAndUpdate);
@@ -0,0 +1,81 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "coins.h"
+#include "random.h"
+
+#include <cassert>
+#include <vector>
+
+/* Number of transactions with unspent outputs in the base view */
+static const unsigned int NUM_COINS_TXS = 10000;
+/* Number of coins accessed or spent per iteration */
+static const unsigned int NUM_ACCESSES = 1000;
+
+namespace {
+
+/** A cache holding NUM_COINS_TXS transactions with two unspent outputs each */
+class CBenchCoins
+{
+public:
+    CCoinsView viewDummy;
+    CCoinsViewCache coins;
+    std::vector<uint256> vTxid;
+
+    CBenchCoins() : coins(&viewDummy)
+    {
+        seed_insecure_rand(true);
+        for (unsigned int i = 0; i < NUM_COINS_TXS; i++) {
+            uint256 txid = GetRandHash();
+            CCoinsModifier modifier = coins.ModifyCoins(txid);
+            modifier->nVersion = 1;
+            modifier->nHeight = i;
+            modifier->vout.resize(2);
+            for (unsigned int j = 0; j < 2; j++) {
+                modifier->vout[j].nValue = 1 + insecure_rand() % 1000000;
+                modifier->vout[j].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+            }
+            vTxid.push_back(txid);
+        }
+    }
+};
+
+CBenchCoins& GetBenchCoins()
+{
+    static CBenchCoins data;
+    return data;
+}
+
+} // anon namespace
+
+/** Look up coins through an empty child cache, as block validation does */
+static void CCoinsCaching_Access(benchmark::State& state)
+{
+    CBenchCoins& data = GetBenchCoins();
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&data.coins);
+        for (unsigned int i = 0; i < NUM_ACCESSES; i++) {
+            const CCoins* coins = view.AccessCoins(data.vTxid[insecure_rand() % data.vTxid.size()]);
+            assert(coins != NULL);
+        }
+    }
+}
+
+/** Spend coins in a child cache and flush the changes into its parent */
+static void CCoinsCaching_Flush(benchmark::State& state)
+{
+    CBenchCoins& data = GetBenchCoins();
+    while (state.KeepRunning()) {
+        CCoinsViewCache viewParent(&data.coins);
+        CCoinsViewCache view(&viewParent);
+        for (unsigned int i = 0; i < NUM_ACCESSES; i++)
+            view.ModifyCoins(data.vTxid[insecure_rand() % data.vTxid.size()])->Spend(0);
+        view.Flush();
+    }
+}
+
+BENCHMARK(CCoinsCaching_Access);
+BENCHMARK(CCoinsCaching_Flush);
@@ -0,0 +1,198 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chain.h"
+#include "checkpoints.h"
+#include "coins.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <cassert>
+
+/* Number of transactions, besides the coinbase, in the synthetic block */
+static const unsigned int NUM_BLOCK_TXS = 200;
+
+namespace {
+
+/**
+ * A block spending NUM_BLOCK_TXS signed pay-to-pubkey-hash outputs of a
+ * single funding transaction, along with a view holding the spent coins.
+ */
+class CBenchBlock
+{
+public:
+    CBlock block;
+    CCoinsView viewDummy;
+    CCoinsViewCache coins;
+
+    CBenchBlock() : coins(&viewDummy)
+    {
+        CBasicKeyStore keystore;
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+        CMutableTransaction txFund;
+        txFund.vin.resize(1);
+        txFund.vin[0].prevout.hash = 1;
+        txFund.vin[0].prevout.n = 0;
+        txFund.vout.resize(NUM_BLOCK_TXS);
+        for (unsigned int i = 0; i < NUM_BLOCK_TXS; i++) {
+            txFund.vout[i].nValue = 10 * COIN;
+            txFund.vout[i].scriptPubKey = scriptPubKey;
+        }
+        CTransaction txFrom(txFund);
+        coins.ModifyCoins(txFrom.GetHash())->FromTx(txFrom, 1);
+
+        CMutableTransaction txCoinbase;
+        txCoinbase.vin.resize(1);
+        txCoinbase.vin[0].prevout.SetNull();
+        txCoinbase.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+        txCoinbase.vout.resize(1);
+        txCoinbase.vout[0].nValue = 0;
+        txCoinbase.vout[0].scriptPubKey = scriptPubKey;
+        block.vtx.push_back(txCoinbase);
+
+        for (unsigned int i = 0; i < NUM_BLOCK_TXS; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.hash = txFrom.GetHash();
+            tx.vin[0].prevout.n = i;
+            tx.vout.resize(1);
+            tx.vout[0].nValue = 10 * COIN - 1000;
+            tx.vout[0].scriptPubKey = scriptPubKey;
+            bool fSigned = SignSignature(keystore, txFrom, tx, 0);
+            assert(fSigned);
+            block.vtx.push_back(tx);
+        }
+
+        block.nVersion = 2;
+        block.hashPrevBlock = 2;
+        block.nTime = GetTime();
+        block.nBits = 0x1e0ffff0;
+        block.nNonce = 0;
+        block.hashMerkleRoot = block.BuildMerkleTree();
+    }
+};
+
+CBenchBlock& GetBenchBlock()
+{
+    static CBenchBlock data;
+    return data;
+}
+
+} // anon namespace
+
+static void BuildMerkleTree(benchmark::State& state)
+{
+    const CBlock& block = GetBenchBlock().block;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 100; i++) {
+            bool fMutated;
+            uint256 hash = block.BuildMerkleTree(&fMutated);
+            assert(hash == block.hashMerkleRoot);
+        }
+    }
+}
+
+static void SerializeBlock(benchmark::State& state)
+{
+    const CBlock& block = GetBenchBlock().block;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 100; i++) {
+            CNetDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+            stream << block;
+        }
+    }
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    CNetDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << GetBenchBlock().block;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 100; i++) {
+            CNetDataStream ssBlock(stream.begin(), stream.end(), SER_NETWORK, PROTOCOL_VERSION);
+            CBlock block;
+            ssBlock >> block;
+        }
+    }
+}
+
+/** Each transaction of the block arriving on its own, as when relayed */
+static void DeserializeTransactions(benchmark::State& state)
+{
+    const CBlock& block = GetBenchBlock().block;
+    std::vector<CNetDataStream> vStream;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        vStream.push_back(CNetDataStream(SER_NETWORK, PROTOCOL_VERSION));
+        vStream.back() << block.vtx[i];
+    }
+    while (state.KeepRunning()) {
+        for (unsigned int i = 0; i < vStream.size(); i++) {
+            CNetDataStream ssTx(vStream[i].begin(), vStream[i].end(), SER_NETWORK, PROTOCOL_VERSION);
+            CTransaction tx;
+            ssTx >> tx;
+        }
+    }
+}
+
+static void CheckBlockBench(benchmark::State& state)
+{
+    const CBlock& block = GetBenchBlock().block;
+    while (state.KeepRunning()) {
+        CValidationState validationState;
+        bool fValid = CheckBlock(block, validationState, false, true);
+        assert(fValid);
+    }
+}
+
+/**
+ * Connect the block to a fresh view on top of the spent coins, with full
+ * script verification but without writing anything to disk.
+ */
+static void ConnectBlockBench(benchmark::State& state)
+{
+    CBenchBlock& data = GetBenchBlock();
+    const CBlock& block = data.block;
+    uint256 hashBlock = block.GetHash();
+
+    LOCK(cs_main);
+    // Well past the last checkpoint, so that scripts are checked
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = std::max(Checkpoints::GetTotalBlocksEstimate(), 1000000);
+    BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(block.hashPrevBlock, &indexPrev)).first;
+    indexPrev.phashBlock = &mi->first;
+    CBlockIndex index(block);
+    index.phashBlock = &hashBlock;
+    index.pprev = &indexPrev;
+    index.nHeight = indexPrev.nHeight + 1;
+
+    CCoinsViewCache coins(&data.coins);
+    coins.SetBestBlock(block.hashPrevBlock);
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&coins);
+        CValidationState validationState;
+        bool fValid = ConnectBlock(block, validationState, &index, view, true);
+        assert(fValid);
+    }
+    mapBlockIndex.erase(mi);
+}
+
+BENCHMARK(BuildMerkleTree);
+BENCHMARK(SerializeBlock);
+BENCHMARK(DeserializeBlock);
+BENCHMARK(DeserializeTransactions);
+BENCHMARK(CheckBlockBench);
+BENCHMARK(ConnectBlockBench);
@@ -0,0 +1,70 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "checkqueue.h"
+#include "crypto/sha256.h"
+
+#include <cassert>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+/* Checks added to the queue per iteration, in batches as ConnectBlock adds them */
+static const unsigned int NUM_CHECKS = 2000;
+static const unsigned int CHECKS_PER_BATCH = 2;
+static const unsigned int QUEUE_BATCH_SIZE = 128;
+
+namespace {
+
+/** A check costing roughly as much as verifying a cheap input script */
+class CFakeCheck
+{
+public:
+    bool operator()()
+    {
+        unsigned char buf[CSHA256::OUTPUT_SIZE] = {};
+        for (int i = 0; i < 20; i++)
+            CSHA256().Write(buf, sizeof(buf)).Finalize(buf);
+        return true;
+    }
+
+    void swap(CFakeCheck& check) {}
+};
+
+} // anon namespace
+
+/** Run NUM_CHECKS checks on a queue served by the master and nThreads - 1 workers */
+static void CCheckQueueSpeed(benchmark::State& state, int nThreads)
+{
+    CCheckQueue<CFakeCheck> queue(QUEUE_BATCH_SIZE);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CFakeCheck>::Thread, &queue));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CFakeCheck> control(&queue);
+        for (unsigned int i = 0; i < NUM_CHECKS / CHECKS_PER_BATCH; i++) {
+            std::vector<CFakeCheck> vChecks(CHECKS_PER_BATCH);
+            control.Add(vChecks);
+        }
+        bool fOk = control.Wait();
+        assert(fOk);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+static void CCheckQueueSpeed_1Thread(benchmark::State& state) { CCheckQueueSpeed(state, 1); }
+static void CCheckQueueSpeed_2Threads(benchmark::State& state) { CCheckQueueSpeed(state, 2); }
+static void CCheckQueueSpeed_4Threads(benchmark::State& state) { CCheckQueueSpeed(state, 4); }
+static void CCheckQueueSpeed_8Threads(benchmark::State& state) { CCheckQueueSpeed(state, 8); }
+
+BENCHMARK(CCheckQueueSpeed_1Thread);
+BENCHMARK(CCheckQueueSpeed_2Threads);
+BENCHMARK(CCheckQueueSpeed_4Threads);
+BENCHMARK(CCheckQueueSpeed_8Threads);
@@ -0,0 +1,96 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/scrypt.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+
+#include <vector>
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000*1000;
+
+static void SHA256(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE,0);
+    while (state.KeepRunning())
+        CSHA256().Write(&in[0], in.size()).Finalize(hash);
+}
+
+static void SHA256_32b(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32,0);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000000; i++) {
+            CSHA256().Write(&in[0], in.size()).Finalize(&in[0]);
+        }
+    }
+}
+
+static void Hash256_80b(benchmark::State& state)
+{
+    // One block header's worth of input, double hashed.
+    uint8_t hash[CHash256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(80,0);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 100000; i++) {
+            CHash256().Write(&in[0], in.size()).Finalize(hash);
+            in[i % 80] ^= hash[0];
+        }
+    }
+}
+
+/** Merkle-tree style batch of 1024 64-byte double hashes with the given kernels. */
+static void SHA256D64_1024(benchmark::State& state, sha256_implementation::UseImplementation use)
+{
+    SHA256AutoDetect(use);
+    std::vector<uint8_t> in(64 * 1024);
+    std::vector<uint8_t> out(32 * 1024);
+    while (state.KeepRunning()) {
+        SHA256D64(&out[0], &in[0], 1024);
+    }
+    SHA256AutoDetect();
+}
+
+// Kernels this CPU or build does not support fall back to the standard code.
+static void SHA256D64_1024_STANDARD(benchmark::State& state) { SHA256D64_1024(state, sha256_implementation::STANDARD); }
+static void SHA256D64_1024_SSE41(benchmark::State& state) { SHA256D64_1024(state, sha256_implementation::USE_SSE41); }
+static void SHA256D64_1024_AVX2(benchmark::State& state) { SHA256D64_1024(state, sha256_implementation::USE_AVX2); }
+static void SHA256D64_1024_SHANI(benchmark::State& state) { SHA256D64_1024(state, sha256_implementation::USE_SHANI); }
+static void SHA256D64_1024_ALL(benchmark::State& state) { SHA256D64_1024(state, sha256_implementation::USE_ALL); }
+
+/** Proof-of-work hash of a block header, 1000 headers per iteration. */
+static void Scrypt(benchmark::State& state, void (*scrypt)(const char*, char*, char*))
+{
+    std::vector<char> in(80, 0);
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    char hash[32];
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            scrypt(&in[0], hash, &scratchpad[0]);
+            in[i % 80] ^= hash[0];
+        }
+    }
+}
+
+static void Scrypt_1000_GENERIC(benchmark::State& state) { Scrypt(state, scrypt_1024_1_1_256_sp_generic); }
+#if defined(USE_SSE2)
+static void Scrypt_1000_SSE2(benchmark::State& state) { Scrypt(state, scrypt_1024_1_1_256_sp_sse2); }
+#endif
+
+BENCHMARK(SHA256);
+BENCHMARK(SHA256_32b);
+BENCHMARK(Hash256_80b);
+BENCHMARK(SHA256D64_1024_STANDARD);
+BENCHMARK(SHA256D64_1024_SSE41);
+BENCHMARK(SHA256D64_1024_AVX2);
+BENCHMARK(SHA256D64_1024_SHANI);
+BENCHMARK(SHA256D64_1024_ALL);
+BENCHMARK(Scrypt_1000_GENERIC);
+#if defined(USE_SSE2)
+BENCHMARK(Scrypt_1000_SSE2);
+#endif
@@ -0,0 +1,96 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blocktimings.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+CBlockTimingsBuffer blockTimings;
+
+static const char* const ppszPhaseNames[BLOCK_PHASE_COUNT] = {
+    "read", "check", "utxo", "scripts", "updatecoins", "undo", "flushview", "flushstate", "mempool", "wallet", "total",
+};
+
+const char* GetBlockTimingPhaseName(int nPhase)
+{
+    if (nPhase < 0 || nPhase >= BLOCK_PHASE_COUNT)
+        return "unknown";
+    return ppszPhaseNames[nPhase];
+}
+
+CBlockTimings::CBlockTimings() : hashBlock(0), nHeight(-1), nTx(0), nInputs(0), nTimeConnected(0)
+{
+    memset(nPhaseTime, 0, sizeof(nPhaseTime));
+}
+
+CBlockTimingsBuffer::CBlockTimingsBuffer(unsigned int nMaxSizeIn) : nMaxSize(nMaxSizeIn), nNext(0)
+{
+}
+
+void CBlockTimingsBuffer::Add(const CBlockTimings& timings)
+{
+    LOCK(cs);
+    if (vTimings.size() < nMaxSize) {
+        vTimings.push_back(timings);
+        return;
+    }
+    vTimings[nNext] = timings;
+    nNext = (nNext + 1) % nMaxSize;
+}
+
+void CBlockTimingsBuffer::Clear()
+{
+    LOCK(cs);
+    vTimings.clear();
+    nNext = 0;
+}
+
+unsigned int CBlockTimingsBuffer::Size() const
+{
+    LOCK(cs);
+    return vTimings.size();
+}
+
+std::vector<CBlockTimings> CBlockTimingsBuffer::GetRecent(unsigned int nCount) const
+{
+    LOCK(cs);
+    std::vector<CBlockTimings> vRecent;
+    nCount = std::min(nCount, (unsigned int)vTimings.size());
+    vRecent.reserve(nCount);
+    // Until the buffer is full nNext is 0 and the newest entry is the last one
+    unsigned int nPos = nNext == 0 ? vTimings.size() : nNext;
+    for (unsigned int i = 0; i < nCount; i++) {
+        nPos = (nPos == 0 ? vTimings.size() : nPos) - 1;
+        vRecent.push_back(vTimings[nPos]);
+    }
+    return vRecent;
+}
+
+std::vector<int64_t> CBlockTimingsBuffer::GetPercentiles(int nPhase, const std::vector<double>& vPercentiles) const
+{
+    std::vector<int64_t> vTimes;
+    {
+        LOCK(cs);
+        vTimes.reserve(vTimings.size());
+        for (unsigned int i = 0; i < vTimings.size(); i++)
+            vTimes.push_back(vTimings[i].nPhaseTime[nPhase]);
+    }
+    std::sort(vTimes.begin(), vTimes.end());
+
+    std::vector<int64_t> vResult;
+    vResult.reserve(vPercentiles.size());
+    for (unsigned int i = 0; i < vPercentiles.size(); i++) {
+        if (vTimes.empty()) {
+            vResult.push_back(0);
+            continue;
+        }
+        // The smallest value that at least the given percentage of values are less or equal to
+        double dRank = std::ceil(vPercentiles[i] / 100.0 * vTimes.size());
+        unsigned int nRank = std::max(1.0, std::min(dRank, (double)vTimes.size()));
+        vResult.push_back(vTimes[nRank - 1]);
+    }
+    return vResult;
+}
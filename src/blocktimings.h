@@ -0,0 +1,81 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKTIMINGS_H
+#define BITCOIN_BLOCKTIMINGS_H
+
+#include "sync.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+/** Number of recently connected blocks whose timings are kept */
+static const unsigned int BLOCK_TIMINGS_BUFFER_SIZE = 1000;
+
+/** Phases of connecting a block to the tip */
+enum BlockTimingPhase
+{
+    BLOCK_PHASE_READ = 0,       //! Reading the block from disk, if it was not in memory
+    BLOCK_PHASE_CHECK,          //! CheckBlock: proof of work, merkle root and transaction checks
+    BLOCK_PHASE_UTXO,           //! Fetching the spent coins and accounting inputs, outputs and sigops
+    BLOCK_PHASE_SCRIPTS,        //! CheckInputs and waiting for the script check threads
+    BLOCK_PHASE_UPDATECOINS,    //! Applying the transactions to the coins view
+    BLOCK_PHASE_UNDO,           //! Writing the undo data and the optional indexes
+    BLOCK_PHASE_FLUSHVIEW,      //! Flushing the block's coins view into the tip's
+    BLOCK_PHASE_FLUSHSTATE,     //! FlushStateToDisk
+    BLOCK_PHASE_MEMPOOL,        //! Removing the block's and conflicting transactions from the pools
+    BLOCK_PHASE_WALLET,         //! Notifying the wallets
+    BLOCK_PHASE_TOTAL,          //! The whole of ConnectTip
+    BLOCK_PHASE_COUNT
+};
+
+/** Name of a phase, as used by the getblocktimings RPC */
+const char* GetBlockTimingPhaseName(int nPhase);
+
+/** Time spent in each phase of connecting one block */
+class CBlockTimings
+{
+public:
+    uint256 hashBlock;
+    int nHeight;
+    unsigned int nTx;
+    unsigned int nInputs;
+    int64_t nTimeConnected; //! When the block was connected (seconds since epoch)
+    int64_t nPhaseTime[BLOCK_PHASE_COUNT]; //! In microseconds
+
+    CBlockTimings();
+};
+
+/**
+ * Ring buffer of the timings of the most recently connected blocks, from
+ * which per phase percentiles are computed on demand.
+ */
+class CBlockTimingsBuffer
+{
+private:
+    mutable CCriticalSection cs;
+    std::vector<CBlockTimings> vTimings;
+    unsigned int nMaxSize;
+    unsigned int nNext; //! Slot the next entry goes into, once the buffer is full
+
+public:
+    CBlockTimingsBuffer(unsigned int nMaxSizeIn = BLOCK_TIMINGS_BUFFER_SIZE);
+
+    void Add(const CBlockTimings& timings);
+    void Clear();
+    unsigned int Size() const;
+    /** Up to nCount of the most recent entries, newest first */
+    std::vector<CBlockTimings> GetRecent(unsigned int nCount) const;
+    /**
+     * Nearest rank percentiles (0 to 100) of the time of a phase over the
+     * buffered blocks; all 0 if the buffer is empty.
+     */
+    std::vector<int64_t> GetPercentiles(int nPhase, const std::vector<double>& vPercentiles) const;
+};
+
+/** Timings of the blocks connected to chainActive */
+extern CBlockTimingsBuffer blockTimings;
+
+#endif // BITCOIN_BLOCKTIMINGS_H
@@ -4,6 +4,7 @@
 
 #include "bloom.h"
 
+#include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "hash.h"
 #include "script/script.h"
@@ -20,13 +21,13 @@
 
 using namespace std;
 
-CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweakIn, unsigned char nFlagsIn) :
+CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweakIn, unsigned char nFlagsIn, unsigned int nMaxSize) :
 /**
  * The ideal size for a bloom filter with a given number of elements and false positive rate is:
  * - nElements * log(fp rate) / ln(2)^2
  * We ignore filter parameters which will create a bloom filter larger than the protocol limits
  */
-vData(min((unsigned int)(-1  / LN2SQUARED * nElements * log(nFPRate)), MAX_BLOOM_FILTER_SIZE * 8) / 8),
+vData(min((unsigned int)(-1  / LN2SQUARED * nElements * log(nFPRate)), nMaxSize * 8) / 8),
 /**
  * The ideal number of hash functions is filter size * ln(2) / number of elements
  * Again, we ignore filter parameters which will create a bloom filter with more hash functions than the protocol limits
@@ -197,3 +198,57 @@ void CBloomFilter::UpdateEmptyFull()
     isFull = full;
     isEmpty = empty;
 }
+
+//! The data pushed by a script, which a block filter holds besides the whole script
+static void GetScriptPushes(const CScript& script, vector<vector<unsigned char> >& vPushes)
+{
+    CScript::const_iterator pc = script.begin();
+    vector<unsigned char> data;
+    opcodetype opcode;
+    while (pc < script.end())
+    {
+        if (!script.GetOp(pc, opcode, data))
+            break;
+        if (!data.empty())
+            vPushes.push_back(data);
+    }
+}
+
+CBloomFilter BuildBlockFilter(const CBlock& block)
+{
+    // Count exactly what is inserted, so the filter is sized for its false positive rate
+    unsigned int nElements = 0;
+    vector<vector<unsigned char> > vPushes;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        {
+            vPushes.clear();
+            GetScriptPushes(txout.scriptPubKey, vPushes);
+            nElements += 1 + vPushes.size();
+        }
+        if (!tx.IsCoinBase())
+            nElements += tx.vin.size();
+    }
+
+    CBloomFilter filter(std::max(nElements, 1U), BLOCK_FILTER_FP_RATE, 0, BLOOM_UPDATE_NONE, MAX_BLOCK_FILTER_SIZE);
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        {
+            const CScript& script = txout.scriptPubKey;
+            filter.insert(vector<unsigned char>(script.begin(), script.end()));
+
+            vPushes.clear();
+            GetScriptPushes(script, vPushes);
+            BOOST_FOREACH(const vector<unsigned char>& data, vPushes)
+                filter.insert(data);
+        }
+        if (!tx.IsCoinBase())
+        {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                filter.insert(txin.prevout);
+        }
+    }
+    return filter;
+}
@@ -9,6 +9,7 @@
 
 #include <vector>
 
+class CBlock;
 class COutPoint;
 class CTransaction;
 class uint256;
@@ -17,6 +18,13 @@ class uint256;
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
 static const unsigned int MAX_HASH_FUNCS = 50;
 
+//! False positive rate of the per-block filters kept by -blockfilterindex
+static const double BLOCK_FILTER_FP_RATE = 0.00001;
+//! Block filters are never relayed, so they are not bound by MAX_BLOOM_FILTER_SIZE.
+//! Each element takes at least 2 bytes of a block and 3 bytes of a filter at
+//! BLOCK_FILTER_FP_RATE, so this keeps the rate for any block up to 1MB.
+static const unsigned int MAX_BLOCK_FILTER_SIZE = 1500000; // bytes
+
 /**
  * First two bits of nFlags control how much IsRelevantAndUpdate actually updates
  * The remaining bits are reserved
@@ -62,8 +70,9 @@ public:
      * nTweak is a constant which is added to the seed value passed to the hash function
      * It should generally always be a random value (and is largely only exposed for unit testing)
      * nFlags should be one of the BLOOM_UPDATE_* enums (not _MASK)
+     * nMaxSize replaces the protocol's size limit for filters that are never relayed
      */
-    CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak, unsigned char nFlagsIn);
+    CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak, unsigned char nFlagsIn, unsigned int nMaxSize = MAX_BLOOM_FILTER_SIZE);
     CBloomFilter() : isFull(true), isEmpty(false), nHashFuncs(0), nTweak(0), nFlags(0) {}
 
     ADD_SERIALIZE_METHODS;
@@ -97,4 +106,11 @@ public:
     void UpdateEmptyFull();
 };
 
+/**
+ * Build the filter -blockfilterindex stores for a block. It contains every
+ * output script, every data push in those scripts (so keys and key/script
+ * hashes can be looked up directly) and every outpoint spent by the block.
+ */
+CBloomFilter BuildBlockFilter(const CBlock& block);
+
 #endif // BITCOIN_BLOOM_H
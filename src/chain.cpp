@@ -13,11 +13,14 @@ using namespace std;
 void CChain::SetTip(CBlockIndex *pindex) {
     if (pindex == NULL) {
         vChain.clear();
+        vTime.clear();
         return;
     }
     vChain.resize(pindex->nHeight + 1);
+    vTime.resize(pindex->nHeight + 1);
     while (pindex && vChain[pindex->nHeight] != pindex) {
         vChain[pindex->nHeight] = pindex;
+        vTime[pindex->nHeight] = pindex->nTime;
         pindex = pindex->pprev;
     }
 }
@@ -57,3 +60,11 @@ const CBlockIndex *CChain::FindFork(const CBlockIndex *pindex) const {
         pindex = pindex->pprev;
     return pindex;
 }
+
+CBlockIndex *CChain::GetAncestor(CBlockIndex *pindex, int nHeight) const {
+    if (nHeight > pindex->nHeight || nHeight < 0)
+        return NULL;
+    if (Contains(pindex))
+        return vChain[nHeight];
+    return pindex->GetAncestor(nHeight);
+}
@@ -141,6 +141,12 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    //! (memory only) Median time past of this block, 0 if not cached. See BuildCaches.
+    int64_t nTimeMedianPast;
+
+    //! (memory only) Work required of a successor of this block, 0 if not cached. See BuildCaches.
+    unsigned int nBitsNext;
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -155,6 +161,8 @@ public:
         nChainTx = 0;
         nStatus = 0;
         nSequenceId = 0;
+        nTimeMedianPast = 0;
+        nBitsNext = 0;
 
         nVersion       = 0;
         hashMerkleRoot = 0;
@@ -229,6 +237,9 @@ public:
 
     int64_t GetMedianTimePast() const
     {
+        if (nTimeMedianPast)
+            return nTimeMedianPast;
+
         int64_t pmedian[nMedianTimeSpan];
         int64_t* pbegin = &pmedian[nMedianTimeSpan];
         int64_t* pend = &pmedian[nMedianTimeSpan];
@@ -283,6 +294,12 @@ public:
     //! Build the skiplist pointer for this entry.
     void BuildSkip();
 
+    //! Cache the median time past and the work required of successors, which
+    //! header checks and the miner otherwise recompute from the ancestors on
+    //! every call. Must be called before the entry is visible to other threads,
+    //! as they read the caches without locking.
+    void BuildCaches();
+
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
@@ -352,10 +369,19 @@ public:
     }
 };
 
-/** An in-memory indexed chain of blocks. */
+/**
+ * An in-memory indexed chain of blocks.
+ *
+ * Blocks are stored in a flat array by height, so ancestor lookups for
+ * blocks in the chain are a single index instead of a walk over the skip
+ * pointers of scattered CBlockIndex objects. Block timestamps are copied into
+ * a parallel array, so scans over a range of heights (such as the network
+ * hash rate estimate) do not touch every CBlockIndex.
+ */
 class CChain {
 private:
     std::vector<CBlockIndex*> vChain;
+    std::vector<unsigned int> vTime;
 
 public:
     /** Returns the index entry for the genesis block of this chain, or NULL if none. */
@@ -394,6 +420,11 @@ public:
             return NULL;
     }
 
+    /** Returns the timestamp of the block at a height of this chain, which must exist. */
+    int64_t GetBlockTime(int nHeight) const {
+        return (int64_t)vTime[nHeight];
+    }
+
     /** Return the maximal height in the chain. Is equal to chain.Tip() ? chain.Tip()->nHeight : -1. */
     int Height() const {
         return vChain.size() - 1;
@@ -407,6 +438,12 @@ public:
 
     /** Find the last common block between this chain and a block index entry. */
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
+
+    /**
+     * Returns the ancestor of pindex at nHeight: by index when pindex is in
+     * this chain, through the skiplist otherwise.
+     */
+    CBlockIndex *GetAncestor(CBlockIndex *pindex, int nHeight) const;
 };
 
 #endif // BITCOIN_CHAIN_H
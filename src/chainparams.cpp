@@ -147,6 +147,7 @@ public:
         nTargetTimespans = 5 * 60; // 5 minutes
         nTargetSpacing = 2.5 * 60; // 2.5 minutes
         nMaxTipAge = 24 * 60 * 60;
+        nPruneAfterHeight = 100000;
 
         /**
          * Build the genesis block. Note that the output of the genesis coinbase cannot
@@ -259,6 +260,7 @@ public:
         nTargetSpacing = 2.5 * 60; // 2.5 minutes
         nMaxTipAge = 24 * 60 * 60;
         //nMaxTipAge = 0x7fffffff;
+        nPruneAfterHeight = 1000;
 
         //! Modify the testnet genesis block so the timestamp is valid for a later start.
         genesis.nTime = 1487116800;
@@ -347,6 +349,7 @@ public:
         nTargetSpacing = 2.5 * 60; // 2.5 minutes
         bnProofOfWorkLimit = ~uint256(0) >> 1;
         nMaxTipAge = 24 * 60 * 60;
+        nPruneAfterHeight = 1000;
         genesis.nTime = 1487116200;
         genesis.nBits = 0x207fffff;
         genesis.nNonce = 2;
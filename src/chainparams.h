@@ -75,6 +75,8 @@ public:
     int64_t Intervalx() const { return nTargetTimespanx / nTargetSpacing; }
     int64_t Intervals() const { return nTargetTimespans / nTargetSpacing; }
     int64_t MaxTipAge() const { return nMaxTipAge; }
+    /** Height below which -prune never deletes block files */
+    uint64_t PruneAfterHeight() const { return nPruneAfterHeight; }
     /** Make miner stop after a block is found. In RPC, don't return until nGenProcLimit blocks are generated */
     bool MineBlocksOnDemand() const { return fMineBlocksOnDemand; }
     /** In the future use NetworkIDString() for RPC fields */
@@ -108,6 +110,7 @@ protected:
     int64_t nTargetSpacing;
     int nMinerThreads;
     long nMaxTipAge;
+    uint64_t nPruneAfterHeight;
     std::vector<CDNSSeedData> vSeeds;
     std::vector<unsigned char> base58Prefixes[MAX_BASE58_TYPES];
     CBaseChainParams::Network networkID;
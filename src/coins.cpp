@@ -4,6 +4,7 @@
 
 #include "coins.h"
 
+#include "metrics.h"
 #include "random.h"
 
 #include <assert.h>
@@ -80,8 +81,11 @@ CCoinsViewCache::~CCoinsViewCache()
 
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
     CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        metricCoinsCacheHits.Inc();
         return it;
+    }
+    metricCoinsCacheMisses.Inc();
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
         return cacheCoins.end();
@@ -7,13 +7,17 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blocktimings.h"
+#include "bloom.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "init.h"
 #include "merkleblock.h"
+#include "metrics.h"
 #include "net.h"
 #include "pow.h"
+#include "pubkey.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -50,9 +54,14 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fHavePruned = false;
+bool fPruneMode = false;
+bool fBlockFilterIndex = false;
+bool fAddressIndex = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 unsigned int nCoinCacheSize = 5000;
+uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
@@ -60,13 +69,7 @@ CFeeRate minRelayTxFee = CFeeRate(DEFAULT_TX_FEE);
 
 CTxMemPool mempool(::minRelayTxFee);
 
-struct COrphanTx {
-    CTransaction tx;
-    NodeId fromPeer;
-};
-map<uint256, COrphanTx> mapOrphanTransactions;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
-void EraseOrphansFor(NodeId peer);
+CTxOrphanPool orphanpool;
 
 static void CheckBlockIndex();
 
@@ -101,6 +104,12 @@ namespace {
 
     CBlockIndex *pindexBestInvalid;
 
+    /**
+     * The chain ending at pindexBestHeader, so that ancestor lookups for the
+     * headers announced by peers during sync are array lookups too.
+     */
+    CChain chainBestHeader;
+
     /**
      * The set of all CBlockIndex entries with BLOCK_VALID_TRANSACTIONS (for itself and all ancestors) and
      * as good as our current tip or better. Entries may be failed, though.
@@ -150,6 +159,13 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Global flag to indicate we should check to see if there are block/undo files that should be deleted. Set on startup or if we allocate more file space when we're in prune mode. */
+    bool fCheckForPruning = false;
+
+    /** Block index entries loaded from the block index snapshot, allocated as one array. */
+    CBlockIndex* pBlockIndexArena = NULL;
+    size_t nBlockIndexArenaSize = 0;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -322,7 +338,7 @@ void FinalizeNode(NodeId nodeid) {
 
     BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight)
         mapBlocksInFlight.erase(entry.hash);
-    EraseOrphansFor(nodeid);
+    orphanpool.EraseForPeer(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
 
     mapNodeState.erase(nodeid);
@@ -389,13 +405,31 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
     }
 }
 
+/** Make pindex the best known header. */
+void SetBestHeader(CBlockIndex* pindex) {
+    pindexBestHeader = pindex;
+    chainBestHeader.SetTip(pindex);
+}
+
+/** Find the ancestor of a block at a given height, by index if the block is in the active or best header chain. */
+CBlockIndex* FindAncestor(CBlockIndex* pindex, int nHeight) {
+    if (chainActive.Contains(pindex))
+        return chainActive[nHeight];
+    return chainBestHeader.GetAncestor(pindex, nHeight);
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
+    // Two blocks in the same chain meet at the lower one.
+    if ((chainActive.Contains(pa) && chainActive.Contains(pb)) ||
+        (chainBestHeader.Contains(pa) && chainBestHeader.Contains(pb)))
+        return pa->nHeight < pb->nHeight ? pa : pb;
+
     if (pa->nHeight > pb->nHeight) {
-        pa = pa->GetAncestor(pb->nHeight);
+        pa = FindAncestor(pa, pb->nHeight);
     } else if (pb->nHeight > pa->nHeight) {
-        pb = pb->GetAncestor(pa->nHeight);
+        pb = FindAncestor(pb, pa->nHeight);
     }
 
     while (pa != pb && pa && pb) {
@@ -449,13 +483,20 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
-        // as iterating over ~100 CBlockIndex* entries anyway.
+        // as iterating over ~100 CBlockIndex* entries anyway. When pindexBestKnownBlock is in the best header
+        // chain (the usual case during sync), they are copied from its array instead.
         int nToFetch = std::min(nMaxHeight - pindexWalk->nHeight, std::max<int>(count - vBlocks.size(), 128));
         vToFetch.resize(nToFetch);
-        pindexWalk = state->pindexBestKnownBlock->GetAncestor(pindexWalk->nHeight + nToFetch);
-        vToFetch[nToFetch - 1] = pindexWalk;
-        for (unsigned int i = nToFetch - 1; i > 0; i--) {
-            vToFetch[i - 1] = vToFetch[i]->pprev;
+        if (chainBestHeader.Contains(state->pindexBestKnownBlock)) {
+            for (int i = 0; i < nToFetch; i++)
+                vToFetch[i] = chainBestHeader[pindexWalk->nHeight + 1 + i];
+            pindexWalk = vToFetch[nToFetch - 1];
+        } else {
+            pindexWalk = FindAncestor(state->pindexBestKnownBlock, pindexWalk->nHeight + nToFetch);
+            vToFetch[nToFetch - 1] = pindexWalk;
+            for (unsigned int i = nToFetch - 1; i > 0; i--) {
+                vToFetch[i - 1] = vToFetch[i]->pprev;
+            }
         }
 
         // Iterate over those blocks in vToFetch (in forward direction), adding the ones that
@@ -466,7 +507,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                 // We consider the chain that this peer is on invalid.
                 return;
             }
-            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+            if (pindex->nStatus & BLOCK_HAVE_DATA || chainActive.Contains(pindex)) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
@@ -544,97 +585,6 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
-//////////////////////////////////////////////////////////////////////////////
-//
-// mapOrphanTransactions
-//
-
-bool AddOrphanTx(const CTransaction& tx, NodeId peer)
-{
-    uint256 hash = tx.GetHash();
-    if (mapOrphanTransactions.count(hash))
-        return false;
-
-    // Ignore big transactions, to avoid a
-    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
-    // large transaction with a missing parent then we assume
-    // it will rebroadcast it later, after the parent transaction(s)
-    // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
-    unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-    if (sz > 5000)
-    {
-        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
-        return false;
-    }
-
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
-
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
-    return true;
-}
-
-void static EraseOrphanTx(uint256 hash)
-{
-    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end())
-        return;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
-    {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
-        if (itPrev == mapOrphanTransactionsByPrev.end())
-            continue;
-        itPrev->second.erase(hash);
-        if (itPrev->second.empty())
-            mapOrphanTransactionsByPrev.erase(itPrev);
-    }
-    mapOrphanTransactions.erase(it);
-}
-
-void EraseOrphansFor(NodeId peer)
-{
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
-}
-
-
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
-{
-    unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
-    {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
-        ++nEvicted;
-    }
-    return nEvicted;
-}
-
-
-
-
-
-
-
 bool IsStandardTx(const CTransaction& tx, string& reason)
 {
     AssertLockHeld(cs_main);
@@ -940,8 +890,8 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectInsaneFee)
+static bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                     bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1041,7 +991,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CAmount nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        // nModifiedFees includes any fee deltas from prioritisetransaction
+        CAmount nModifiedFees = nFees;
+        double dPriorityDummy = 0;
+        pool.ApplyDeltas(hash, dPriorityDummy, nModifiedFees);
+
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx));
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1051,6 +1006,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                       hash.ToString(), nFees, txMinFee),
                              REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+        // Once the pool has had to evict, require at least the fee rate of what was evicted
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee)
+            return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                      hash.ToString(), nModifiedFees, mempoolRejectFee),
+                             REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
         // Require that free transactions have sufficient priority to be mined in the next block.
         if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1085,6 +1047,17 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                          hash.ToString(),
                          nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+            return state.DoS(0, error("AcceptToMemoryPool : too long mempool chain %s: %s", hash.ToString(), errString),
+                             REJECT_NONSTANDARD, "too-long-mempool-chain");
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
@@ -1107,7 +1080,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
+        if (fAddressIndex)
+            pool.addAddressIndex(entry, view);
+
+        // Evict the lowest fee rate transactions if the pool outgrew -maxmempool,
+        // this may include the transaction just added
+        pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1115,18 +1096,151 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return true;
 }
 
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    bool fAccepted = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fRejectInsaneFee);
+    if (&pool == &mempool) {
+        metricMempoolAcceptTime.Observe(GetTimeMicros() - nTimeStart);
+        if (fAccepted)
+            metricMempoolAccepted.Inc();
+        else
+            metricMempoolRejected.Inc();
+        // Even a rejected transaction may have trimmed the pool
+        metricMempoolTransactions.Set(pool.size());
+        metricMempoolBytes.Set(pool.GetTotalTxSize());
+    }
+    return fAccepted;
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fRejectInsaneFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectInsaneFee);
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+static bool CompareMempoolDumpOrder(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b)
+{
+    return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+}
+
+bool LoadMempool()
+{
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    // Allowed to fail as this file IS missing on first startup.
+    if (file.IsNull()) {
+        LogPrintf("%s: no mempool file at %s, starting with an empty mempool\n", __func__, path.string());
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    int64_t nCount = 0;
+    int64_t nFailed = 0;
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s: unknown mempool file version %d", __func__, nVersion);
+
+        // Deltas go in first, so that entries pick them up when they are added
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        uint64_t nEntries;
+        file >> nEntries;
+        while (nEntries--) {
+            CTransaction tx;
+            int64_t nTime;
+            file >> tx;
+            file >> nTime;
+
+            CValidationState state;
+            {
+                LOCK(cs_main);
+                AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime);
+            }
+            if (state.IsValid() && mempool.exists(tx.GetHash()))
+                ++nCount;
+            else
+                ++nFailed;
+
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception &e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %d successes, %d failed  %dms\n", nCount, nFailed, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMillis();
+
+    // Copy out under the lock; the disk write happens without it
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<std::pair<CTransaction, int64_t> > vEntries;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        // Parents before children, so that reloading re-adds them in a valid order
+        std::vector<CTxMemPool::txiter> vSorted;
+        vSorted.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            vSorted.push_back(it);
+        std::sort(vSorted.begin(), vSorted.end(), CompareMempoolDumpOrder);
+        vEntries.reserve(vSorted.size());
+        BOOST_FOREACH(CTxMemPool::txiter it, vSorted)
+            vEntries.push_back(std::make_pair(it->GetTx(), it->GetTime()));
+    }
+
+    boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+    CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+
+    try {
+        file << MEMPOOL_DUMP_VERSION;
+        file << mapDeltas;
+        file << (uint64_t)vEntries.size();
+        for (std::vector<std::pair<CTransaction, int64_t> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it) {
+            file << it->first;
+            file << it->second;
+        }
+        FileCommit(file.Get());
+        file.fclose();
+    } catch (const std::exception &e) {
+        return error("%s: serialize or I/O error - %s", __func__, e.what());
+    }
+
+    if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+        return error("%s: rename to mempool.dat failed", __func__);
+
+    LogPrintf("Dumped mempool: %u transactions  %dms\n", vEntries.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, bool fAllowSlow)
 {
     CBlockIndex *pindexSlow = NULL;
-
-    LOCK(cs_main);
+    CDiskBlockPos posSlow;
 
     if (mempool.lookup(hash, txOut))
     {
         return true;
     }
 
+    // The tx index and block files are read without cs_main, so concurrent
+    // lookups (e.g. parallel RPC batches) do not serialize on disk access.
     if (fTxIndex) {
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
@@ -1150,6 +1264,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
+        LOCK(cs_main);
         {
             CCoinsViewCache &view = *pcoinsTip;
             const CCoins* coins = view.AccessCoins(hash);
@@ -1158,11 +1273,14 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
+        // Pruning resets the position under cs_main, so take it here
+        if (pindexSlow && (pindexSlow->nStatus & BLOCK_HAVE_DATA))
+            posSlow = pindexSlow->GetBlockPos();
     }
 
-    if (pindexSlow) {
+    if (!posSlow.IsNull()) {
         CBlock block;
-        if (ReadBlockFromDisk(block, pindexSlow)) {
+        if (ReadBlockFromDisk(block, posSlow) && block.GetHash() == pindexSlow->GetBlockHash()) {
             BOOST_FOREACH(const CTransaction &tx, block.vtx) {
                 if (tx.GetHash() == hash) {
                     txOut = tx;
@@ -1240,6 +1358,48 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadBlockFilter(const CBlockIndex* pindex, CBloomFilter& filter)
+{
+    if (!fBlockFilterIndex)
+        return false;
+    return pblocktree->ReadBlockFilter(pindex->GetBlockHash(), filter);
+}
+
+bool GetAddressIndexKey(const CScript& scriptPubKey, unsigned char& type, uint160& hashBytes)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest))
+        return false;
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        type = ADDRESS_INDEX_PUBKEYHASH;
+        hashBytes = *keyID;
+        return true;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        type = ADDRESS_INDEX_SCRIPTHASH;
+        hashBytes = *scriptID;
+        return true;
+    }
+    return false;
+}
+
+bool GetAddressIndex(unsigned char type, const uint160& hashBytes,
+                     std::vector<std::pair<CAddressIndexKey, CAmount> >& addressIndex,
+                     int nStart, int nEnd)
+{
+    if (!fAddressIndex)
+        return false;
+    return pblocktree->ReadAddressIndex(type, hashBytes, addressIndex, nStart, nEnd);
+}
+
+bool GetAddressUnspent(unsigned char type, const uint160& hashBytes,
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& unspentOutputs)
+{
+    if (!fAddressIndex)
+        return false;
+    return pblocktree->ReadAddressUnspentIndex(type, hashBytes, unspentOutputs);
+}
+
 
 // miner's coin base reward based on nBits
 CAmount GetProofOfWorkReward(unsigned int nHeight)
@@ -1654,11 +1814,29 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock() : block and undo data inconsistent");
 
+    // VerifyDB disconnects on a scratch view (and passes pfClean); only a real
+    // disconnect of the tip touches the address index
+    bool fUpdateAddressIndex = fAddressIndex && !pfClean;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspentIndex;
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
+        if (fUpdateAddressIndex) {
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut &out = tx.vout[k];
+                unsigned char type;
+                uint160 hashBytes;
+                if (!GetAddressIndexKey(out.scriptPubKey, type, hashBytes))
+                    continue;
+                vAddressIndex.push_back(make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, k, false), out.nValue));
+                vAddressUnspentIndex.push_back(make_pair(CAddressUnspentKey(type, hashBytes, hash, k), CAddressUnspentValue()));
+            }
+        }
+
         // Check that all outputs are available and match the outputs in the block itself
         // exactly. Note that transactions with only provably unspendable outputs won't
         // have outputs available even in the block itself, so we handle that case
@@ -1707,10 +1885,23 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 if (coins->vout.size() < out.n+1)
                     coins->vout.resize(out.n+1);
                 coins->vout[out.n] = undo.txout;
+
+                unsigned char type;
+                uint160 hashBytes;
+                if (fUpdateAddressIndex && GetAddressIndexKey(undo.txout.scriptPubKey, type, hashBytes)) {
+                    vAddressIndex.push_back(make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, j, true), undo.txout.nValue * -1));
+                    vAddressUnspentIndex.push_back(make_pair(CAddressUnspentKey(type, hashBytes, out.hash, out.n),
+                                                             CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, coins->nHeight)));
+                }
             }
         }
     }
 
+    if (fUpdateAddressIndex) {
+        if (!pblocktree->EraseAddressIndex(vAddressIndex, vAddressUnspentIndex))
+            return error("DisconnectBlock() : failed to erase address index");
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -1760,12 +1951,14 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, CBlockTimings* pTimings)
 {
     AssertLockHeld(cs_main);
+    int64_t nTimeCheckStart = GetTimeMicros();
     // Check it again in case a previous version let a bad block in
     if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
         return false;
+    int64_t nTimeChecked = GetTimeMicros();
 
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256(0) : pindex->pprev->GetBlockHash();
@@ -1824,12 +2017,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
+    int64_t nTimeScripts = 0;
+    int64_t nTimeUpdateCoins = 0;
     CAmount nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspentIndex;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
@@ -1861,16 +2058,44 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
             std::vector<CScriptCheck> vChecks;
+            int64_t nTimeInputs = GetTimeMicros();
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
+            metricScriptChecks.Inc(vChecks.size());
             control.Add(vChecks);
+            nTimeScripts += GetTimeMicros() - nTimeInputs;
+        }
+
+        if (fAddressIndex && !fJustCheck) {
+            const uint256& hash = tx.GetHash();
+            unsigned char type;
+            uint160 hashBytes;
+            if (!tx.IsCoinBase()) {
+                for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                    const CTxIn &in = tx.vin[j];
+                    const CTxOut &prevout = view.GetOutputFor(in);
+                    if (!GetAddressIndexKey(prevout.scriptPubKey, type, hashBytes))
+                        continue;
+                    vAddressIndex.push_back(make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
+                    vAddressUnspentIndex.push_back(make_pair(CAddressUnspentKey(type, hashBytes, in.prevout.hash, in.prevout.n), CAddressUnspentValue()));
+                }
+            }
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut &out = tx.vout[k];
+                if (!GetAddressIndexKey(out.scriptPubKey, type, hashBytes))
+                    continue;
+                vAddressIndex.push_back(make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, i, hash, k, false), out.nValue));
+                vAddressUnspentIndex.push_back(make_pair(CAddressUnspentKey(type, hashBytes, hash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
+            }
         }
 
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
+        int64_t nTimeUpdate = GetTimeMicros();
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        nTimeUpdateCoins += GetTimeMicros() - nTimeUpdate;
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
@@ -1887,8 +2112,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (!control.Wait())
         return state.DoS(100, false);
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
+    if (fScriptChecks && nScriptCheckThreads)
+        metricScriptCheckWaitTime.Observe(nTime2 - nTime1);
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
+    if (pTimings) {
+        // Waiting for the script check threads counts as script time
+        nTimeScripts += nTime2 - nTime1;
+        pTimings->nTx = block.vtx.size();
+        pTimings->nInputs = nInputs - 1;
+        pTimings->nPhaseTime[BLOCK_PHASE_CHECK] += nTimeChecked - nTimeCheckStart;
+        pTimings->nPhaseTime[BLOCK_PHASE_SCRIPTS] += nTimeScripts;
+        pTimings->nPhaseTime[BLOCK_PHASE_UPDATECOINS] += nTimeUpdateCoins;
+        pTimings->nPhaseTime[BLOCK_PHASE_UTXO] += (nTime2 - nTimeChecked) - nTimeScripts - nTimeUpdateCoins;
+    }
+
     if (fJustCheck)
         return true;
 
@@ -1915,11 +2153,22 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    if (fBlockFilterIndex)
+        if (!pblocktree->WriteBlockFilter(pindex->GetBlockHash(), BuildBlockFilter(block)))
+            return state.Abort("Failed to write block filter index");
+
+    if (fAddressIndex) {
+        if (!pblocktree->WriteAddressIndex(vAddressIndex, vAddressUnspentIndex))
+            return state.Abort("Failed to write address index");
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime3 = GetTimeMicros(); nTimeIndex += nTime3 - nTime2;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
+    if (pTimings)
+        pTimings->nPhaseTime[BLOCK_PHASE_UNDO] += nTime3 - nTime2;
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
@@ -1944,10 +2193,23 @@ enum FlushStateMode {
  * fast is not set and it's been a while since the last write.
  */
 bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_LastBlockFile);
     static int64_t nLastWrite = 0;
+    std::set<int> setFilesToPrune;
+    bool fFlushForPrune = false;
     try {
-    if ((mode == FLUSH_STATE_ALWAYS) ||
+    if (fPruneMode && fCheckForPruning && !fReindex) {
+        FindFilesToPrune(setFilesToPrune);
+        fCheckForPruning = false;
+        if (!setFilesToPrune.empty()) {
+            fFlushForPrune = true;
+            if (!fHavePruned) {
+                pblocktree->WriteFlag("prunedblockfiles", true);
+                fHavePruned = true;
+            }
+        }
+    }
+    if ((mode == FLUSH_STATE_ALWAYS) || fFlushForPrune ||
         ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
         (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
         // Typical CCoins structures on disk are around 100 bytes in size.
@@ -1981,6 +2243,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         // Finally flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return state.Abort("Failed to write to coin database");
+        // The block index no longer refers to the pruned files, so they can go.
+        if (fFlushForPrune)
+            UnlinkPrunedFiles(setFilesToPrune);
         // Update best block in wallet (so we can detect restored wallets).
         if (mode != FLUSH_STATE_IF_NEEDED) {
             g_signals.SetBestChain(chainActive.GetLocator());
@@ -1998,9 +2263,19 @@ void FlushStateToDisk() {
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+void PruneAndFlush() {
+    CValidationState state;
+    fCheckForPruning = true;
+    FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     chainActive.SetTip(pindexNew);
+    metricChainHeight.Set(pindexNew->nHeight);
+    metricChainTipTime.Set(pindexNew->GetBlockTime());
+    metricMempoolTransactions.Set(mempool.size());
+    metricMempoolBytes.Set(mempool.GetTotalTxSize());
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -2103,10 +2378,12 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    CBlockTimings timings;
+    timings.nPhaseTime[BLOCK_PHASE_READ] = nTime2 - nTime1;
     {
         CCoinsViewCache view(pcoinsTip);
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, &timings);
         g_signals.BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2127,10 +2404,13 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
-    mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted);
+    mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
+    orphanpool.EraseForBlock(*pblock);
     mempool.check(pcoinsTip);
+    int64_t nTimeMempool = GetTimeMicros();
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    int64_t nTimeWalletStart = GetTimeMicros();
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH(const CTransaction &tx, txConflicted) {
@@ -2144,6 +2424,19 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+
+    timings.hashBlock = pindexNew->GetBlockHash();
+    timings.nHeight = pindexNew->nHeight;
+    timings.nTimeConnected = GetTime();
+    timings.nPhaseTime[BLOCK_PHASE_FLUSHVIEW] = nTime4 - nTime3;
+    timings.nPhaseTime[BLOCK_PHASE_FLUSHSTATE] = nTime5 - nTime4;
+    timings.nPhaseTime[BLOCK_PHASE_MEMPOOL] = nTimeMempool - nTime5;
+    timings.nPhaseTime[BLOCK_PHASE_WALLET] = nTime6 - nTimeWalletStart;
+    timings.nPhaseTime[BLOCK_PHASE_TOTAL] = nTime6 - nTime1;
+    blockTimings.Add(timings);
+    metricBlocksConnected.Inc();
+    metricBlockTransactions.Inc(pblock->vtx.size());
+    metricBlockConnectTime.Observe(nTime6 - nTime1);
     return true;
 }
 
@@ -2168,15 +2461,29 @@ static CBlockIndex* FindMostWorkChain() {
         CBlockIndex *pindexTest = pindexNew;
         bool fInvalidAncestor = false;
         while (pindexTest && !chainActive.Contains(pindexTest)) {
-            assert(pindexTest->nStatus & BLOCK_HAVE_DATA);
             assert(pindexTest->nChainTx || pindexTest->nHeight == 0);
-            if (pindexTest->nStatus & BLOCK_FAILED_MASK) {
-                // Candidate has an invalid ancestor, remove entire chain from the set.
-                if (pindexBestInvalid == NULL || pindexNew->nChainWork > pindexBestInvalid->nChainWork)
+
+            // Pruned nodes may have entries in setBlockIndexCandidates for
+            // which block files have been deleted. Remove those as candidates
+            // for the most work chain if we come across them; we can't switch
+            // to a chain unless we have all the non-active-chain parent blocks.
+            bool fFailedChain = pindexTest->nStatus & BLOCK_FAILED_MASK;
+            bool fMissingData = !(pindexTest->nStatus & BLOCK_HAVE_DATA);
+            if (fFailedChain || fMissingData) {
+                // Candidate chain is not usable (either invalid or missing data)
+                if (fFailedChain && (pindexBestInvalid == NULL || pindexNew->nChainWork > pindexBestInvalid->nChainWork))
                     pindexBestInvalid = pindexNew;
                 CBlockIndex *pindexFailed = pindexNew;
+                // Remove the entire chain from the set.
                 while (pindexTest != pindexFailed) {
-                    pindexFailed->nStatus |= BLOCK_FAILED_CHILD;
+                    if (fFailedChain) {
+                        pindexFailed->nStatus |= BLOCK_FAILED_CHILD;
+                    } else if (fMissingData) {
+                        // If we're missing data, then add back to mapBlocksUnlinked,
+                        // so that if the block arrives in the future we can try adding
+                        // to setBlockIndexCandidates again.
+                        mapBlocksUnlinked.insert(std::make_pair(pindexFailed->pprev, pindexFailed));
+                    }
                     setBlockIndexCandidates.erase(pindexFailed);
                     pindexFailed = pindexFailed->pprev;
                 }
@@ -2416,9 +2723,10 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         pindexNew->BuildSkip();
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
+    pindexNew->BuildCaches();
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
-        pindexBestHeader = pindexNew;
+        SetBestHeader(pindexNew);
 
     setDirtyBlockIndex.insert(pindexNew);
 
@@ -2504,6 +2812,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         if (nNewChunks > nOldChunks) {
+            if (fPruneMode)
+                fCheckForPruning = true;
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
                 FILE *file = OpenBlockFile(pos);
                 if (file) {
@@ -2535,6 +2845,8 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     if (nNewChunks > nOldChunks) {
+        if (fPruneMode)
+            fCheckForPruning = true;
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
             FILE *file = OpenUndoFile(pos);
             if (file) {
@@ -2914,6 +3226,17 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+void CBlockIndex::BuildCaches()
+{
+    nTimeMedianPast = 0;
+    nTimeMedianPast = GetMedianTimePast();
+    // Under the min-difficulty rule the work required depends on the
+    // successor's timestamp, so it can't be cached
+    nBitsNext = 0;
+    if (!Params().AllowMinDifficultyBlocks())
+        nBitsNext = GetNextWorkRequired(this, NULL);
+}
+
 bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp)
 {
     // Preliminary checks
@@ -2995,6 +3318,100 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes)
     return true;
 }
 
+uint64_t CalculateCurrentUsage()
+{
+    uint64_t retval = 0;
+    BOOST_FOREACH(const CBlockFileInfo &file, vinfoBlockFile) {
+        retval += file.nSize + file.nUndoSize;
+    }
+    return retval;
+}
+
+void PruneOneBlockFile(int fileNumber)
+{
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if ((pindex->nStatus & BLOCK_HAVE_DATA) && pindex->nFile == fileNumber) {
+            pindex->nStatus &= ~BLOCK_HAVE_DATA;
+            pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nFile = 0;
+            pindex->nDataPos = 0;
+            pindex->nUndoPos = 0;
+            setDirtyBlockIndex.insert(pindex);
+
+            // Prune from mapBlocksUnlinked -- any block we prune would have
+            // to be downloaded again in order to consider its chain, at which
+            // point it would be considered as a candidate for
+            // mapBlocksUnlinked or setBlockIndexCandidates.
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+            while (range.first != range.second) {
+                std::multimap<CBlockIndex*, CBlockIndex*>::iterator itUnlinked = range.first;
+                range.first++;
+                if (itUnlinked->second == pindex)
+                    mapBlocksUnlinked.erase(itUnlinked);
+            }
+        }
+    }
+
+    vinfoBlockFile[fileNumber].SetNull();
+    setDirtyFileInfo.insert(fileNumber);
+}
+
+void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
+{
+    for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
+        CDiskBlockPos pos(*it, 0);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    }
+}
+
+void FindFilesToPrune(std::set<int>& setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || nPruneTarget == 0)
+        return;
+    if ((uint64_t)chainActive.Tip()->nHeight <= Params().PruneAfterHeight())
+        return;
+
+    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    // We don't check to prune until after we've allocated new space for files,
+    // so leave a buffer under our target to account for another allocation
+    // before the next pruning.
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    int count = 0;
+
+    if (nCurrentUsage + nBuffer >= nPruneTarget) {
+        // The file currently written to is never pruned
+        for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
+            uint64_t nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+
+            if (vinfoBlockFile[fileNumber].nSize == 0)
+                continue;
+
+            if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
+                break;
+
+            // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip, but keep scanning
+            if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+                continue;
+
+            PruneOneBlockFile(fileNumber);
+            // Queue up the files for removal
+            setFilesToPrune.insert(fileNumber);
+            nCurrentUsage -= nBytesToPrune;
+            count++;
+        }
+    }
+
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
+             nPruneTarget/1024/1024, nCurrentUsage/1024/1024,
+             ((int64_t)nPruneTarget - (int64_t)nCurrentUsage)/1024/1024,
+             nLastBlockWeCanPrune, count);
+}
+
 FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
 {
     if (pos.IsNull())
@@ -3051,7 +3468,196 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
-bool static LoadBlockIndexDB()
+static const uint32_t BLOCK_INDEX_SNAPSHOT_VERSION = 1;
+/** Serialized size of one block index snapshot entry */
+static const size_t BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE = 148;
+
+static boost::filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "blockindex.dat";
+}
+
+static bool CompareBlockIndexByHeight(const CBlockIndex* a, const CBlockIndex* b)
+{
+    return a->nHeight < b->nHeight;
+}
+
+static void ClearBlockIndexArena()
+{
+    mapBlockIndex.clear();
+    delete[] pBlockIndexArena;
+    pBlockIndexArena = NULL;
+    nBlockIndexArenaSize = 0;
+}
+
+/**
+ * The block index snapshot is a flat copy of mapBlockIndex written at
+ * shutdown: a header (version, snapshot id, best block, entry count)
+ * followed by fixed-size entries in height order and a checksum. Each entry
+ * holds everything LoadBlockIndexDB would otherwise compute (block hash,
+ * chain work, transaction count of the chain) and refers to its pprev and
+ * pskip by position, so loading is one read and a single pass over an
+ * array of CBlockIndex objects.
+ *
+ * The snapshot is only valid while the block tree database holds the same
+ * snapshot id; the id is erased as soon as the index is loaded, before the
+ * database can change.
+ */
+bool WriteBlockIndexSnapshot()
+{
+    LOCK(cs_main);
+    if (fReindex || chainActive.Tip() == NULL)
+        return false;
+    if (!setDirtyBlockIndex.empty() || !setDirtyFileInfo.empty())
+        return error("%s: block index has unflushed changes", __func__);
+
+    int64_t nStart = GetTimeMillis();
+    std::vector<CBlockIndex*> vSorted;
+    vSorted.reserve(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSorted.push_back(item.second);
+    // Parents before children, so that every entry refers back
+    std::sort(vSorted.begin(), vSorted.end(), CompareBlockIndexByHeight);
+    boost::unordered_map<const CBlockIndex*, int32_t> mapPosition;
+    mapPosition.reserve(vSorted.size());
+    for (unsigned int i = 0; i < vSorted.size(); i++)
+        mapPosition[vSorted[i]] = i;
+
+    uint256 id = GetRandHash();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(vSorted.size() * BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE + 128);
+    ss << BLOCK_INDEX_SNAPSHOT_VERSION << id << pcoinsTip->GetBestBlock() << (uint32_t)vSorted.size();
+    BOOST_FOREACH(const CBlockIndex* pindex, vSorted)
+    {
+        int32_t nPrev = pindex->pprev ? mapPosition[pindex->pprev] : -1;
+        int32_t nSkip = pindex->pskip ? mapPosition[pindex->pskip] : -1;
+        ss << pindex->GetBlockHash() << nPrev << nSkip;
+        ss << pindex->nHeight << pindex->nFile << pindex->nDataPos << pindex->nUndoPos;
+        ss << pindex->nChainWork << pindex->nTx << pindex->nChainTx << pindex->nStatus;
+        ss << pindex->nVersion << pindex->hashMerkleRoot << pindex->nTime << pindex->nBits << pindex->nNonce;
+    }
+    ss << Hash(ss.begin(), ss.end());
+
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    boost::filesystem::path pathTmp = GetDataDir() / "blocks" / "blockindex.dat.new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+    bool fWritten = fwrite(&ss[0], 1, ss.size(), file) == ss.size();
+    FileCommit(file);
+    fclose(file);
+    if (!fWritten)
+        return error("%s: failed to write %s", __func__, pathTmp.string());
+    if (!RenameOver(pathTmp, path))
+        return error("%s: rename to %s failed", __func__, path.string());
+    if (!pblocktree->WriteBlockIndexSnapshot(id))
+        return error("%s: failed to record the snapshot in the block index", __func__);
+
+    LogPrintf("Wrote block index snapshot: %u entries  %dms\n", vSorted.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/** Load mapBlockIndex from the block index snapshot, if there is a valid one */
+static bool LoadBlockIndexSnapshot()
+{
+    uint256 id;
+    if (!pblocktree->ReadBlockIndexSnapshot(id))
+        return false;
+    // The snapshot matches the database as it is now, which is about to change
+    if (!pblocktree->EraseBlockIndexSnapshot())
+        return error("%s: failed to erase the snapshot id", __func__);
+    if (!GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCK_INDEX_SNAPSHOT))
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return error("%s: failed to open %s", __func__, path.string());
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    bool fRead = false;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long nSize = ftell(file);
+        if (nSize > 0 && fseek(file, 0, SEEK_SET) == 0) {
+            ss.resize(nSize);
+            fRead = fread(&ss[0], 1, nSize, file) == (size_t)nSize;
+        }
+    }
+    fclose(file);
+    if (!fRead || ss.size() < sizeof(uint256))
+        return error("%s: failed to read %s", __func__, path.string());
+
+    uint256 hashStored;
+    memcpy(hashStored.begin(), &ss[ss.size() - sizeof(uint256)], sizeof(uint256));
+    if (Hash(ss.begin(), ss.end() - sizeof(uint256)) != hashStored)
+        return error("%s: checksum mismatch in %s", __func__, path.string());
+    ss.resize(ss.size() - sizeof(uint256));
+
+    try {
+        uint32_t nVersion, nEntries;
+        uint256 idFile, hashBestBlock;
+        ss >> nVersion >> idFile >> hashBestBlock >> nEntries;
+        if (nVersion != BLOCK_INDEX_SNAPSHOT_VERSION || idFile != id)
+            return error("%s: snapshot does not belong to the block index", __func__);
+        if (hashBestBlock != pcoinsTip->GetBestBlock())
+            return error("%s: snapshot does not match the chainstate", __func__);
+        if (ss.size() != (uint64_t)nEntries * BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE)
+            return error("%s: unexpected snapshot size", __func__);
+
+        pBlockIndexArena = new CBlockIndex[nEntries];
+        nBlockIndexArenaSize = nEntries;
+        mapBlockIndex.reserve(nEntries);
+        for (uint32_t i = 0; i < nEntries; i++)
+        {
+            CBlockIndex* pindex = &pBlockIndexArena[i];
+            uint256 hash;
+            int32_t nPrev, nSkip;
+            ss >> hash >> nPrev >> nSkip;
+            if (nPrev < -1 || nPrev >= (int32_t)i || nSkip < -1 || nSkip >= (int32_t)i) {
+                ClearBlockIndexArena();
+                return error("%s: corrupt snapshot entry %u", __func__, i);
+            }
+            pindex->pprev = nPrev < 0 ? NULL : &pBlockIndexArena[nPrev];
+            pindex->pskip = nSkip < 0 ? NULL : &pBlockIndexArena[nSkip];
+            ss >> pindex->nHeight >> pindex->nFile >> pindex->nDataPos >> pindex->nUndoPos;
+            ss >> pindex->nChainWork >> pindex->nTx >> pindex->nChainTx >> pindex->nStatus;
+            ss >> pindex->nVersion >> pindex->hashMerkleRoot >> pindex->nTime >> pindex->nBits >> pindex->nNonce;
+            std::pair<BlockMap::iterator, bool> ret = mapBlockIndex.insert(make_pair(hash, pindex));
+            if (!ret.second) {
+                ClearBlockIndexArena();
+                return error("%s: duplicate snapshot entry %s", __func__, hash.ToString());
+            }
+            pindex->phashBlock = &ret.first->first;
+        }
+    } catch (const std::exception &e) {
+        ClearBlockIndexArena();
+        return error("%s: deserialize error - %s", __func__, e.what());
+    }
+
+    // Only entries at least as good as the tip can become candidates, so
+    // skip the rest rather than insert them and prune them right away.
+    BlockMap::iterator itTip = mapBlockIndex.find(pcoinsTip->GetBestBlock());
+    const CBlockIndex* pindexTip = itTip == mapBlockIndex.end() ? NULL : itTip->second;
+    for (size_t i = 0; i < nBlockIndexArenaSize; i++)
+    {
+        CBlockIndex* pindex = &pBlockIndexArena[i];
+        if (pindex->nTx > 0 && pindex->nChainTx == 0 && pindex->pprev)
+            mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
+        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL) &&
+            (pindexTip == NULL || pindex->nChainWork >= pindexTip->nChainWork))
+            setBlockIndexCandidates.insert(pindex);
+        if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
+            pindexBestInvalid = pindex;
+        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
+            pindexBestHeader = pindex;
+    }
+
+    LogPrintf("Loaded block index snapshot: %u entries  %dms\n", nBlockIndexArenaSize, GetTimeMillis() - nStart);
+    return true;
+}
+
+/** Load mapBlockIndex from the block tree database, computing the in-memory fields */
+static bool LoadBlockIndexFromDB()
 {
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
@@ -3071,7 +3677,9 @@ bool static LoadBlockIndexDB()
     {
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        // We can link the chain of blocks for which we've received transactions at some point.
+        // Pruned nodes may have deleted the block.
+        if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -3093,6 +3701,14 @@ bool static LoadBlockIndexDB()
             pindexBestHeader = pindex;
     }
 
+    return true;
+}
+
+bool static LoadBlockIndexDB()
+{
+    if (!LoadBlockIndexSnapshot() && !LoadBlockIndexFromDB())
+        return false;
+
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
@@ -3133,10 +3749,25 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
+    // Check whether we have ever pruned block & undo files
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
+
     // Check whether we have a transaction index
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have an address index
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("LoadBlockIndexDB(): address index %s\n", fAddressIndex ? "enabled" : "disabled");
+
+    // Check whether we have a block filter index
+    pblocktree->ReadFlag("blockfilterindex", fBlockFilterIndex);
+    LogPrintf("LoadBlockIndexDB(): block filter index %s\n", fBlockFilterIndex ? "enabled" : "disabled");
+
+    chainBestHeader.SetTip(pindexBestHeader);
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -3187,6 +3818,11 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -3246,6 +3882,7 @@ void UnloadBlockIndex()
     mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    SetBestHeader(NULL);
     pindexBestInvalid = NULL;
 }
 
@@ -3267,6 +3904,10 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", false);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fAddressIndex = GetBoolArg("-addressindex", false);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fBlockFilterIndex = GetBoolArg("-blockfilterindex", false);
+    pblocktree->WriteFlag("blockfilterindex", fBlockFilterIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -3436,14 +4077,18 @@ void static CheckBlockIndex()
     int nHeight = 0;
     CBlockIndex* pindexFirstInvalid = NULL; // Oldest ancestor of pindex which is invalid.
     CBlockIndex* pindexFirstMissing = NULL; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstNeverProcessed = NULL; // Oldest ancestor of pindex for which nTx == 0.
     CBlockIndex* pindexFirstNotTreeValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
+    CBlockIndex* pindexFirstNotTransactionsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
     while (pindex != NULL) {
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
         if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
+        if (pindex->pprev != NULL && pindexFirstNotTransactionsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
 
@@ -3453,12 +4098,22 @@ void static CheckBlockIndex()
             assert(pindex->GetBlockHash() == Params().HashGenesisBlock()); // Genesis block's hash must match.
             assert(pindex == chainActive.Genesis()); // The current active chain's genesis block must be this block.
         }
-        // HAVE_DATA is equivalent to VALID_TRANSACTIONS and equivalent to nTx > 0 (we stored the number of transactions in the block)
-        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
-        // All parents having data is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstMissing != NULL) == (pindex->nChainTx == 0)); // nChainTx == 0 is used to signal that all parent block's transaction data is available.
+        // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
+        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
+        if (!fHavePruned) {
+            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
+            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+        } else {
+            // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
+            if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
+        }
+        if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
+        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+        // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
+        assert((pindexFirstNotTransactionsValid != NULL) == (pindex->nChainTx == 0));
         assert(pindex->nHeight == nHeight); // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
@@ -3470,11 +4125,20 @@ void static CheckBlockIndex()
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstMissing == NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block sorts at least as good as the current tip and is valid, it must be in setBlockIndexCandidates.
-                 assert(setBlockIndexCandidates.count(pindex));
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
+            if (pindexFirstInvalid == NULL) {
+                // If this block sorts at least as good as the current tip and
+                // is valid and we have all data for its parents, it must be in
+                // setBlockIndexCandidates. chainActive.Tip() must also be there
+                // even if some data has been pruned.
+                if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
+                    assert(setBlockIndexCandidates.count(pindex));
+                }
+                // If some parent is missing, then it could be that this block was in
+                // setBlockIndexCandidates but had to be removed because of the missing data.
+                // In this case it must be in mapBlocksUnlinked -- see test below.
             }
-        } else { // If this block sorts worse than the current tip, it cannot be in setBlockIndexCandidates.
+        } else { // If this block sorts worse than the current tip or some ancestor's block has never been seen, it cannot be in setBlockIndexCandidates.
             assert(setBlockIndexCandidates.count(pindex) == 0);
         }
         // Check whether this block is in mapBlocksUnlinked.
@@ -3488,12 +4152,28 @@ void static CheckBlockIndex()
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstMissing != NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block has block data available, some parent doesn't, and has no invalid parents, it must be in mapBlocksUnlinked.
-                assert(foundInUnlinked);
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
+            // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
+            assert(foundInUnlinked);
+        }
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
+        if (pindexFirstMissing == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
+            // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
+            assert(fHavePruned); // We must have pruned.
+            // This block may have entered mapBlocksUnlinked if:
+            //  - it has a descendant that at some point had more work than the
+            //    tip, and
+            //  - we tried switching to that descendant but were missing
+            //    data for some intermediate block between chainActive and the
+            //    tip.
+            // So if this block is itself better than chainActive.Tip() and it wasn't in
+            // setBlockIndexCandidates, then it must be in mapBlocksUnlinked.
+            if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
+                if (pindexFirstInvalid == NULL) {
+                    assert(foundInUnlinked);
+                }
             }
-        } else { // If this block does not have block data available, or all parents do, it cannot be in mapBlocksUnlinked.
-            assert(!foundInUnlinked);
         }
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
         // End: actual consistency checks.
@@ -3513,7 +4193,9 @@ void static CheckBlockIndex()
             // If pindex was the first with a certain property, unset the corresponding variable.
             if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
             if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+            if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
             if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
+            if (pindex == pindexFirstNotTransactionsValid) pindexFirstNotTransactionsValid = NULL;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
             // Find our parent.
@@ -3627,7 +4309,7 @@ bool static AlreadyHave(const CInv& inv)
         {
             bool txInMap = false;
             txInMap = mempool.exists(inv.hash);
-            return txInMap || mapOrphanTransactions.count(inv.hash) ||
+            return txInMap || orphanpool.HaveTx(inv.hash) ||
                 pcoinsTip->HaveCoins(inv.hash);
         }
     case MSG_BLOCK:
@@ -3675,7 +4357,9 @@ void static ProcessGetData(CNode* pfrom)
                         }
                     }
                 }
-                if (send)
+                // Pruned nodes may have deleted the block, so check whether
+                // it's available before trying to send.
+                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
                     // Send block from disk
                     CBlock block;
@@ -3724,7 +4408,7 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CNetDataStream>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
                         pfrom->PushMessage(inv.GetCommand(), (*mi).second);
                         pushed = true;
@@ -3733,7 +4417,7 @@ void static ProcessGetData(CNode* pfrom)
                 if (!pushed && inv.type == MSG_TX) {
                     CTransaction tx;
                     if (mempool.lookup(inv.hash, tx)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        CNetDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << tx;
                         pfrom->PushMessage("tx", ss);
@@ -3767,7 +4451,51 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+/**
+ * Reconsider up to ORPHAN_WORK_BATCH_SIZE of the orphans sent by pfrom whose
+ * missing parents have since been accepted. Orphans accepted here queue their
+ * own children in turn, so a chain of orphans is worked through over several
+ * passes instead of recursively under a single cs_main hold.
+ */
+void static ProcessOrphanWork(CNode* pfrom)
+{
+    LOCK(cs_main);
+    CTransaction orphanTx;
+    for (unsigned int i = 0; i < ORPHAN_WORK_BATCH_SIZE && orphanpool.GetTxToReconsider(pfrom->GetId(), orphanTx); i++)
+    {
+        const uint256& orphanHash = orphanTx.GetHash();
+        bool fMissingInputs = false;
+        // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+        // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+        // anyone relaying LegitTxX banned)
+        CValidationState stateDummy;
+
+        if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs))
+        {
+            LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+            RelayTransaction(orphanTx);
+            orphanpool.AddChildrenToWorkSet(orphanTx);
+            orphanpool.EraseTx(orphanHash);
+        }
+        else if (!fMissingInputs)
+        {
+            int nDos = 0;
+            if (stateDummy.IsInvalid(nDos) && nDos > 0)
+            {
+                // Punish peer that gave us an invalid orphan tx
+                Misbehaving(pfrom->GetId(), nDos);
+                LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+            }
+            // too-little-fee orphan
+            LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+            orphanpool.EraseTx(orphanHash);
+        }
+        // otherwise the orphan still waits for another parent
+        mempool.check(pcoinsTip);
+    }
+}
+
+bool static ProcessMessage(CNode* pfrom, string strCommand, CNetDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -4036,7 +4764,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     // time the block arrives, the header chain leading up to it is already validated. Not
                     // doing this will result in the received block being rejected as an orphan in case it is
                     // not a direct successor.
-                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                    pfrom->PushMessage("getheaders", chainBestHeader.GetLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20 &&
                         nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
@@ -4113,6 +4841,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 LogPrint("net", "  getblocks stopping at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
                 break;
             }
+            // If pruning, don't inv blocks unless we have them on disk and are likely to still have
+            // them for some reasonable time window (1 hour) that block relay might require.
+            const int nPrunedBlocksLikelyToHave = MIN_BLOCKS_TO_KEEP - 3600 / Params().TargetSpacing();
+            if (fPruneMode && (!(pindex->nStatus & BLOCK_HAVE_DATA) || pindex->nHeight <= chainActive.Tip()->nHeight - nPrunedBlocksLikelyToHave))
+            {
+                LogPrint("net", "  getblocks stopping, pruned or too old block at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+                break;
+            }
             pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
             if (--nLimit <= 0)
             {
@@ -4167,8 +4903,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "tx")
     {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
@@ -4186,73 +4920,27 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         {
             mempool.check(pcoinsTip);
             RelayTransaction(tx);
-            vWorkQueue.push_back(inv.hash);
-            vEraseQueue.push_back(inv.hash);
 
             LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s : accepted %s (poolsz %u)\n",
                 pfrom->id, pfrom->cleanSubVer,
                 tx.GetHash().ToString(),
                 mempool.mapTx.size());
 
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-                    vEraseQueue.push_back(orphanHash);
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // too-little-fee orphan
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
+            // Orphans that depended on this one are reconsidered from
+            // ProcessMessages, a batch at a time
+            orphanpool.AddChildrenToWorkSet(tx);
+            orphanpool.EraseTx(inv.hash);
         }
         else if (fMissingInputs)
         {
-            AddOrphanTx(tx, pfrom->GetId());
+            orphanpool.AddTx(tx, pfrom->GetId());
 
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+            // DoS prevention: do not allow the orphan pool to grow unbounded
             unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            size_t nMaxOrphanSize = (size_t)std::max((int64_t)0, GetArg("-maxorphansize", DEFAULT_MAX_ORPHAN_SIZE)) * 1000;
+            unsigned int nEvicted = orphanpool.LimitOrphans(nMaxOrphanTx, nMaxOrphanSize);
             if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+                LogPrint("mempool", "orphan pool overflow, removed %u tx\n", nEvicted);
         } else if (pfrom->fWhitelisted) {
             // Always relay transactions received from whitelisted peers, even
             // if they are already in the mempool (allowing the node to function
@@ -4321,7 +5009,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
             LogPrint("net", "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
-            pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256(0));
+            pfrom->PushMessage("getheaders", chainBestHeader.GetLocator(pindexLast), uint256(0));
         }
 
         CheckBlockIndex();
@@ -4603,9 +5291,16 @@ bool ProcessMessages(CNode* pfrom)
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom);
 
+    if (orphanpool.HaveTxToReconsider(pfrom->GetId()))
+        ProcessOrphanWork(pfrom);
+    pfrom->fOrphanWork = orphanpool.HaveTxToReconsider(pfrom->GetId());
+
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    // orphans resolved by earlier messages are dealt with before the next one
+    if (pfrom->fOrphanWork) return fOk;
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -4647,7 +5342,7 @@ bool ProcessMessages(CNode* pfrom)
         unsigned int nMessageSize = hdr.nMessageSize;
 
         // Checksum
-        CDataStream& vRecv = msg.vRecv;
+        CNetDataStream& vRecv = msg.vRecv;
         uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
         unsigned int nChecksum = 0;
         memcpy(&nChecksum, &hash, sizeof(nChecksum));
@@ -4660,6 +5355,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nProcessStart = GetTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
@@ -4691,6 +5387,7 @@ bool ProcessMessages(CNode* pfrom)
         } catch (...) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
+        pfrom->RecordMsgProcessed(strCommand, nProcessStart - msg.nTime, GetTimeMicros() - nProcessStart);
 
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
@@ -4702,6 +5399,8 @@ bool ProcessMessages(CNode* pfrom)
     if (!pfrom->fDisconnect)
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
 
+    pfrom->fOrphanWork = orphanpool.HaveTxToReconsider(pfrom->GetId());
+
     return fOk;
 }
 
@@ -4812,7 +5511,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 
         // Start block sync
         if (pindexBestHeader == NULL)
-            pindexBestHeader = chainActive.Tip();
+            SetBestHeader(chainActive.Tip());
         bool fFetch = state.fPreferredDownload || (nPreferredDownload == 0 && !pto->fClient && !pto->fOneShot); // Download if this is a nice peer, or we have no nice peers and this one might do.
         if (!state.fSyncStarted && !pto->fClient && fFetch && !fImporting && !fReindex) {
             // Only actively request headers from a single peer, unless we're close to today.
@@ -4821,7 +5520,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 nSyncStarted++;
                 CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
                 LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
+                pto->PushMessage("getheaders", chainBestHeader.GetLocator(pindexStart), uint256(0));
             }
         }
 
@@ -5014,14 +5713,14 @@ class CMainCleanup
 public:
     CMainCleanup() {}
     ~CMainCleanup() {
-        // block headers
+        // block headers; those loaded from the snapshot share one allocation
         BlockMap::iterator it1 = mapBlockIndex.begin();
         for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
-        mapBlockIndex.clear();
+            if (it1->second < pBlockIndexArena || it1->second >= pBlockIndexArena + nBlockIndexArenaSize)
+                delete (*it1).second;
+        ClearBlockIndexArena();
 
         // orphan transactions
-        mapOrphanTransactions.clear();
-        mapOrphanTransactionsByPrev.clear();
+        orphanpool.clear();
     }
 } instance_of_cmaincleanup;
@@ -10,6 +10,7 @@
 #include "config/bitcoin-config.h"
 #endif
 
+#include "addressindex.h"
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
@@ -24,6 +25,7 @@
 #include "sync.h"
 #include "tinyformat.h"
 #include "txmempool.h"
+#include "txorphanpool.h"
 #include "uint256.h"
 #include "undo.h"
 
@@ -39,6 +41,7 @@
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
+class CBlockTimings;
 class CBlockTreeDB;
 class CBloomFilter;
 class CInv;
@@ -66,6 +69,22 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphansize, maximum kilobytes of orphan transactions kept in memory */
+static const unsigned int DEFAULT_MAX_ORPHAN_SIZE = 250;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -persistmempool, save the mempool on shutdown and reload it on startup */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -blockindexsnapshot, save the block index to a flat file on shutdown for a faster startup */
+static const bool DEFAULT_BLOCK_INDEX_SNAPSHOT = true;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -121,6 +140,7 @@ struct BlockHasher
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
+extern CTxOrphanPool orphanpool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
@@ -133,6 +153,14 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+/** True if any block files have ever been pruned. */
+extern bool fHavePruned;
+/** True if we're running in -prune mode. */
+extern bool fPruneMode;
+/** Number of MiB of block files that we're trying to stay below. */
+extern uint64_t nPruneTarget;
+extern bool fBlockFilterIndex;
+extern bool fAddressIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern unsigned int nCoinCacheSize;
@@ -145,6 +173,21 @@ extern CBlockIndex *pindexBestHeader;
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
+/** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
+static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+
+/**
+ * Require that the user allocate at least 550MB for block & undo files (blk???.dat and rev???.dat).
+ * At 1MB per block, 288 blocks = 288MB.
+ * Add 15% for undo data = 331MB.
+ * Add 20% for the orphan block rate = 397MB.
+ * We want the low water mark after pruning to be at least 397MB, and since we prune in
+ * full block file chunks, the high water mark which triggers the prune must be one 128MB
+ * block file + 15% undo data = 147MB greater, for a total of 545MB.
+ * Setting the target to more than 550MB makes it likely we can respect the target.
+ */
+static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
+
 /** Register a wallet to receive updates from core */
 void RegisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister a wallet from core */
@@ -222,10 +265,36 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Prune block files and flush state to disk. */
+void PruneAndFlush();
+
+/** Calculate the amount of disk space the block & undo files currently use */
+uint64_t CalculateCurrentUsage();
+/**
+ * Find the block files to delete to stay below nPruneTarget, and mark their
+ * blocks as no longer having data (see PruneOneBlockFile). Files holding any
+ * block within MIN_BLOCKS_TO_KEEP of the tip, and anything below the chain's
+ * PruneAfterHeight, are never pruned.
+ */
+void FindFilesToPrune(std::set<int>& setFilesToPrune);
+/** Mark one block file as pruned: its blocks lose BLOCK_HAVE_DATA and BLOCK_HAVE_UNDO */
+void PruneOneBlockFile(int fileNumber);
+/** Actually unlink the specified files */
+void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectInsaneFee=false);
+/** (try to) add transaction to memory pool, recording nAcceptTime as its entry time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee=false);
+
+/** Load the mempool from mempool.dat, through AcceptToMemoryPool */
+bool LoadMempool();
+/** Dump the mempool to mempool.dat */
+bool DumpMempool();
+/** Write the block index snapshot (blocks/blockindex.dat) that the next startup loads from */
+bool WriteBlockIndexSnapshot();
 
 
 struct CNodeStateStats {
@@ -377,6 +446,16 @@ public:
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the -blockfilterindex filter of a block; false if there is none */
+bool ReadBlockFilter(const CBlockIndex* pindex, CBloomFilter& filter);
+/** Map an output script to its -addressindex key; false if it does not pay to an address */
+bool GetAddressIndexKey(const CScript& scriptPubKey, unsigned char& type, uint160& hashBytes);
+/** Look up the -addressindex entries or unspent outputs of an address; false if there is no index */
+bool GetAddressIndex(unsigned char type, const uint160& hashBytes,
+                     std::vector<std::pair<CAddressIndexKey, CAmount> >& addressIndex,
+                     int nStart = 0, int nEnd = 0);
+bool GetAddressUnspent(unsigned char type, const uint160& hashBytes,
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& unspentOutputs);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -387,8 +466,9 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
  *  of problems. Note that in any case, coins may be modified. */
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  If pTimings is provided, the time spent in each phase is added to it. */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false, CBlockTimings* pTimings = NULL);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
@@ -0,0 +1,124 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include "tinyformat.h"
+
+#include <algorithm>
+#include <assert.h>
+
+// Constant initialized, so they are set before any metric is constructed
+static const CMetric* pmetricFirst = NULL;
+static CMetric* pmetricLast = NULL;
+
+CMetric::CMetric(const char* pszNameIn, const char* pszHelpIn) : pnext(NULL), pszName(pszNameIn), pszHelp(pszHelpIn)
+{
+    // Only ever called during static initialization, keeping definition order
+    if (pmetricLast)
+        pmetricLast->pnext = this;
+    else
+        pmetricFirst = this;
+    pmetricLast = this;
+}
+
+void CMetricCounter::Render(std::string& strOut) const
+{
+    strOut += strprintf("%s %d\n", pszName, Get());
+}
+
+void CMetricGauge::Render(std::string& strOut) const
+{
+    strOut += strprintf("%s %d\n", pszName, Get());
+}
+
+CMetricHistogram::CMetricHistogram(const char* pszNameIn, const char* pszHelpIn, const int64_t* pBoundsIn, unsigned int nBoundsIn, double dScaleIn) :
+    CMetric(pszNameIn, pszHelpIn), pBounds(pBoundsIn), nBounds(nBoundsIn), dScale(dScaleIn), nSum(0)
+{
+    assert(nBounds <= MAX_METRIC_BUCKETS);
+    for (unsigned int i = 0; i <= MAX_METRIC_BUCKETS; i++)
+        nBucketCount[i].store(0, boost::memory_order_relaxed);
+}
+
+void CMetricHistogram::Observe(int64_t n)
+{
+    unsigned int nBucket = 0;
+    while (nBucket < nBounds && n > pBounds[nBucket])
+        nBucket++;
+    nBucketCount[nBucket].fetch_add(1, boost::memory_order_relaxed);
+    nSum.fetch_add(n, boost::memory_order_relaxed);
+}
+
+uint64_t CMetricHistogram::GetCount(unsigned int nBucket) const
+{
+    uint64_t nCount = 0;
+    for (unsigned int i = 0; i <= std::min(nBucket, nBounds); i++)
+        nCount += nBucketCount[i].load(boost::memory_order_relaxed);
+    return nCount;
+}
+
+void CMetricHistogram::Render(std::string& strOut) const
+{
+    // Buckets are cumulative; _count is derived from them so it always
+    // matches the +Inf bucket, even while observations are coming in
+    uint64_t nCount = 0;
+    for (unsigned int i = 0; i < nBounds; i++) {
+        nCount += nBucketCount[i].load(boost::memory_order_relaxed);
+        strOut += strprintf("%s_bucket{le=\"%g\"} %d\n", pszName, pBounds[i] * dScale, nCount);
+    }
+    nCount += nBucketCount[nBounds].load(boost::memory_order_relaxed);
+    strOut += strprintf("%s_bucket{le=\"+Inf\"} %d\n", pszName, nCount);
+    strOut += strprintf("%s_sum %.6f\n", pszName, GetSum() * dScale);
+    strOut += strprintf("%s_count %d\n", pszName, nCount);
+}
+
+std::string GetMetricsText()
+{
+    std::string strOut;
+    for (const CMetric* pmetric = pmetricFirst; pmetric; pmetric = pmetric->Next()) {
+        strOut += strprintf("# HELP %s %s\n", pmetric->pszName, pmetric->pszHelp);
+        strOut += strprintf("# TYPE %s %s\n", pmetric->pszName, pmetric->GetType());
+        pmetric->Render(strOut);
+    }
+    return strOut;
+}
+
+const int64_t METRIC_TIME_BUCKETS[] = {
+    100, 250, 500,
+    1000, 2500, 5000,
+    10000, 25000, 50000,
+    100000, 250000, 500000,
+    1000000, 2500000, 5000000,
+    10000000, 30000000,
+};
+const unsigned int METRIC_TIME_BUCKETS_COUNT = sizeof(METRIC_TIME_BUCKETS) / sizeof(METRIC_TIME_BUCKETS[0]);
+
+CMetricCounter metricBlocksConnected("briliantcoin_blocks_connected_total", "Blocks connected to the active chain");
+CMetricCounter metricBlockTransactions("briliantcoin_block_transactions_total", "Transactions in blocks connected to the active chain");
+CMetricHistogram metricBlockConnectTime("briliantcoin_block_connect_seconds", "Time taken to connect a block to the active chain",
+                                        METRIC_TIME_BUCKETS, METRIC_TIME_BUCKETS_COUNT, 0.000001);
+CMetricGauge metricChainHeight("briliantcoin_chain_height", "Height of the active chain tip");
+CMetricGauge metricChainTipTime("briliantcoin_chain_tip_timestamp_seconds", "Timestamp of the active chain tip's header");
+
+CMetricCounter metricMempoolAccepted("briliantcoin_mempool_accepted_total", "Transactions accepted to the memory pool");
+CMetricCounter metricMempoolRejected("briliantcoin_mempool_rejected_total", "Transactions not accepted to the memory pool, including orphans");
+CMetricHistogram metricMempoolAcceptTime("briliantcoin_mempool_accept_seconds", "Time taken to validate a transaction for the memory pool",
+                                         METRIC_TIME_BUCKETS, METRIC_TIME_BUCKETS_COUNT, 0.000001);
+CMetricGauge metricMempoolTransactions("briliantcoin_mempool_transactions", "Transactions in the memory pool");
+CMetricGauge metricMempoolBytes("briliantcoin_mempool_bytes", "Serialized size of the transactions in the memory pool");
+
+CMetricCounter metricCoinsCacheHits("briliantcoin_coins_cache_hits_total", "Coins lookups answered by a coins view cache, over all cache layers");
+CMetricCounter metricCoinsCacheMisses("briliantcoin_coins_cache_misses_total", "Coins lookups passed on to the view below a coins view cache, over all cache layers");
+
+CMetricCounter metricScriptChecks("briliantcoin_script_checks_total", "Input script checks queued for the script verification threads");
+CMetricHistogram metricScriptCheckWaitTime("briliantcoin_script_check_wait_seconds", "Time a block waited for its queued script checks to finish",
+                                           METRIC_TIME_BUCKETS, METRIC_TIME_BUCKETS_COUNT, 0.000001);
+
+CMetricCounter metricNetBytesRecv("briliantcoin_net_received_bytes_total", "Bytes received from peers");
+CMetricCounter metricNetBytesSent("briliantcoin_net_sent_bytes_total", "Bytes sent to peers");
+CMetricCounter metricNetMessagesRecv("briliantcoin_net_received_messages_total", "Messages received from peers");
+CMetricCounter metricNetMessagesSent("briliantcoin_net_sent_messages_total", "Messages queued for sending to peers");
+CMetricGauge metricNetPeers("briliantcoin_net_peers", "Connected peers");
+
+CMetricGauge metricHashesPerSec("briliantcoin_miner_hashes_per_second", "Hash rate of the internal miner, as last measured");
@@ -0,0 +1,140 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_METRICS_H
+#define BITCOIN_METRICS_H
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/atomic.hpp>
+
+/** Most buckets a histogram can have, not counting the +Inf one */
+static const unsigned int MAX_METRIC_BUCKETS = 20;
+
+/**
+ * A metric exported on /metrics in the Prometheus text format.
+ *
+ * Metrics are global objects that link themselves into a registry when they
+ * are constructed, before main() runs, so the registry is never modified
+ * once the node is up and can be walked without a lock. They must therefore
+ * be defined at namespace scope, never on the stack or the heap.
+ *
+ * Updating a metric is a relaxed atomic operation and never blocks, and
+ * rendering only loads the atomics, so scraping does not take cs_main or any
+ * other lock. Values that are rendered together may be a moment apart from
+ * each other.
+ */
+class CMetric
+{
+private:
+    const CMetric* pnext;
+
+public:
+    const char* pszName;
+    const char* pszHelp;
+
+    CMetric(const char* pszNameIn, const char* pszHelpIn);
+    virtual ~CMetric() {}
+
+    const CMetric* Next() const { return pnext; }
+    /** Append the sample lines of this metric */
+    virtual void Render(std::string& strOut) const = 0;
+    virtual const char* GetType() const = 0;
+};
+
+/** A value that only goes up, such as a number of events or bytes */
+class CMetricCounter : public CMetric
+{
+private:
+    boost::atomic<uint64_t> nValue;
+
+public:
+    CMetricCounter(const char* pszNameIn, const char* pszHelpIn) : CMetric(pszNameIn, pszHelpIn), nValue(0) {}
+
+    void Inc(uint64_t n = 1) { nValue.fetch_add(n, boost::memory_order_relaxed); }
+    uint64_t Get() const { return nValue.load(boost::memory_order_relaxed); }
+
+    void Render(std::string& strOut) const;
+    const char* GetType() const { return "counter"; }
+};
+
+/** A value that is set to the current state of something, such as a size */
+class CMetricGauge : public CMetric
+{
+private:
+    boost::atomic<int64_t> nValue;
+
+public:
+    CMetricGauge(const char* pszNameIn, const char* pszHelpIn) : CMetric(pszNameIn, pszHelpIn), nValue(0) {}
+
+    void Set(int64_t n) { nValue.store(n, boost::memory_order_relaxed); }
+    void Add(int64_t n) { nValue.fetch_add(n, boost::memory_order_relaxed); }
+    int64_t Get() const { return nValue.load(boost::memory_order_relaxed); }
+
+    void Render(std::string& strOut) const;
+    const char* GetType() const { return "gauge"; }
+};
+
+/**
+ * Distribution of observed values over fixed buckets. Values are observed
+ * as integers (e.g. microseconds) and multiplied by dScale when rendered
+ * (e.g. 0.000001 to export seconds, as Prometheus expects).
+ */
+class CMetricHistogram : public CMetric
+{
+private:
+    const int64_t* pBounds; //! Upper bounds of the buckets, ascending
+    unsigned int nBounds;
+    double dScale;
+    boost::atomic<uint64_t> nBucketCount[MAX_METRIC_BUCKETS + 1]; //! Not cumulative; the last is +Inf
+    boost::atomic<int64_t> nSum;
+
+public:
+    CMetricHistogram(const char* pszNameIn, const char* pszHelpIn, const int64_t* pBoundsIn, unsigned int nBoundsIn, double dScaleIn = 1.0);
+
+    void Observe(int64_t n);
+    /** Number of observations, and number of observations of at most pBounds[nBucket] (or all, for nBucket >= nBounds) */
+    uint64_t GetCount(unsigned int nBucket = MAX_METRIC_BUCKETS) const;
+    int64_t GetSum() const { return nSum.load(boost::memory_order_relaxed); }
+
+    void Render(std::string& strOut) const;
+    const char* GetType() const { return "histogram"; }
+};
+
+/** Render every registered metric in the Prometheus text exposition format (version 0.0.4) */
+std::string GetMetricsText();
+
+/** Bucket bounds, in microseconds, for timing histograms: 100us to 30s */
+extern const int64_t METRIC_TIME_BUCKETS[];
+extern const unsigned int METRIC_TIME_BUCKETS_COUNT;
+
+// Chain
+extern CMetricCounter metricBlocksConnected;
+extern CMetricCounter metricBlockTransactions;
+extern CMetricHistogram metricBlockConnectTime;
+extern CMetricGauge metricChainHeight;
+extern CMetricGauge metricChainTipTime;
+// Mempool
+extern CMetricCounter metricMempoolAccepted;
+extern CMetricCounter metricMempoolRejected;
+extern CMetricHistogram metricMempoolAcceptTime;
+extern CMetricGauge metricMempoolTransactions;
+extern CMetricGauge metricMempoolBytes;
+// Coins cache
+extern CMetricCounter metricCoinsCacheHits;
+extern CMetricCounter metricCoinsCacheMisses;
+// Script verification
+extern CMetricCounter metricScriptChecks;
+extern CMetricHistogram metricScriptCheckWaitTime;
+// Network
+extern CMetricCounter metricNetBytesRecv;
+extern CMetricCounter metricNetBytesSent;
+extern CMetricCounter metricNetMessagesRecv;
+extern CMetricCounter metricNetMessagesSent;
+extern CMetricGauge metricNetPeers;
+// Mining
+extern CMetricGauge metricHashesPerSec;
+
+#endif // BITCOIN_METRICS_H
@@ -11,6 +11,7 @@
 #include "hash.h"
 #include "crypto/scrypt.h"
 #include "main.h"
+#include "metrics.h"
 #include "net.h"
 #include "pow.h"
 #include "timedata.h"
@@ -21,7 +22,6 @@
 #endif
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 
@@ -32,53 +32,449 @@ using namespace std;
 
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. Block assembly therefore works on
+// packages: a transaction is considered together with all of its
+// not-yet-included ancestors, scored by the fee rate of the whole package,
+// so that a high-fee child can pay for a low-fee parent.
 //
-class COrphan
+
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+
+/** A mempool entry whose ancestor state has been adjusted for ancestors
+ *  that are already in the block under construction. */
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+};
+
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
+
+/** Same ordering as CompareTxMemPoolEntryByAncestorFee, on the adjusted state. */
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2)
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        return f1 > f2;
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            // Reuse same tag from CTxMemPool's similar index
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion
 {
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+    void operator() (CTxMemPoolModifiedEntry &e)
     {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
     }
+
+    CTxMemPool::txiter iter;
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
+// Parents must come before children: sort a package by ancestor count.
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+// Priority queue entries for the high-priority area of the block
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+
+struct TxCoinAgePriorityCompare
+{
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b) const
+    {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByScore()(*(b.second), *(a.second)); //Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+/**
+ * Collects mempool transactions into a block template. Callers must hold
+ * cs_main and mempool.cs for the lifetime of the object.
+ */
+class BlockAssembler
 {
-    bool byFee;
+private:
+    CBlockTemplate* pblocktemplate;
+    CCoinsViewCache view;
+    const int nHeight;
+
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+    bool fPrintPriority;
+
+    // Information on the current status of the block
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    CTxMemPool::setEntries inBlock;
 
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
+    BlockAssembler(CBlockTemplate* pblocktemplateIn, int nHeightIn,
+                   unsigned int nBlockMaxSizeIn, unsigned int nBlockPrioritySizeIn, unsigned int nBlockMinSizeIn)
+        : pblocktemplate(pblocktemplateIn), view(pcoinsTip), nHeight(nHeightIn),
+          nBlockMaxSize(nBlockMaxSizeIn), nBlockPrioritySize(nBlockPrioritySizeIn), nBlockMinSize(nBlockMinSizeIn),
+          nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0)
+    {
+        fPrintPriority = GetBoolArg("-printpriority", false);
+    }
+
+    /** Fill the priority area of the block, regardless of fees. */
+    void addPriorityTxs();
+    /** Fill the rest of the block with packages by ancestor fee rate. */
+    void addPackageTxs();
+
+    uint64_t GetBlockSize() const { return nBlockSize; }
+    uint64_t GetBlockTx() const { return nBlockTx; }
+    CAmount GetFees() const { return nFees; }
+
+private:
+    /** Validate the transactions of a package in order and, if all of them
+     *  fit and are valid, add them to the block. */
+    bool TestAndAddPackage(const std::vector<CTxMemPool::txiter>& package, double dPriority);
+    /** Does any in-mempool parent of this entry still lack a place in the block? */
+    bool isStillDependent(CTxMemPool::txiter iter) const;
+    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set& mapModifiedTx, const CTxMemPool::setEntries& failedTx) const;
+    /** Subtract newly included transactions from their descendants' package state. */
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx) const;
+};
+
+bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter) const
+{
+    BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
+    {
+        if (!inBlock.count(parent))
+            return true;
+    }
+    return false;
+}
+
+bool BlockAssembler::TestAndAddPackage(const std::vector<CTxMemPool::txiter>& package, double dPriority)
+{
+    // Validate against a child view so that a package that fails half way
+    // leaves no trace in the block's view.
+    CCoinsViewCache viewPackage(&view);
+    uint64_t nPackageSize = 0;
+    unsigned int nPackageSigOps = 0;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+
+    BOOST_FOREACH(CTxMemPool::txiter it, package)
+    {
+        const CTransaction& tx = it->GetTx();
+        if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight))
+            return false;
+
+        // Size limits
+        nPackageSize += it->GetTxSize();
+        if (nBlockSize + nPackageSize >= nBlockMaxSize)
+            return false;
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+        // Legacy limits on sigOps:
+        unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+        if (nBlockSigOps + nPackageSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            return false;
+
+        if (!viewPackage.HaveInputs(tx))
+        {
+            // This should never happen; all transactions in the memory
+            // pool should connect to either transactions in the chain
+            // or other transactions in the memory pool.
+            LogPrintf("ERROR: mempool transaction missing input\n");
+            if (fDebug) assert("mempool transaction missing input" == 0);
+            return false;
+        }
+
+        nTxSigOps += GetP2SHSigOpCount(tx, viewPackage);
+        if (nBlockSigOps + nPackageSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            return false;
+
+        // Note that flags: we don't want to set mempool/IsStandard()
+        // policy here, but we still have to ensure that the block we
+        // create only contains transactions that are valid in new blocks.
+        CValidationState state;
+        if (!CheckInputs(tx, state, viewPackage, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+            return false;
+
+        CTxUndo txundo;
+        UpdateCoins(tx, state, viewPackage, txundo, nHeight);
+
+        nPackageSigOps += nTxSigOps;
+        vTxFees.push_back(it->GetFee());
+        vTxSigOps.push_back(nTxSigOps);
+    }
+
+    // Flushing writes the child view's best block into the parent view,
+    // so make sure it is populated from there first.
+    viewPackage.GetBestBlock();
+    viewPackage.Flush();
+
+    for (unsigned int i = 0; i < package.size(); i++)
     {
-        if (byFee)
+        CTxMemPool::txiter it = package[i];
+        pblocktemplate->block.vtx.push_back(it->GetTx());
+        pblocktemplate->vTxFees.push_back(vTxFees[i]);
+        pblocktemplate->vTxSigOps.push_back(vTxSigOps[i]);
+        nBlockSize += it->GetTxSize();
+        ++nBlockTx;
+        nBlockSigOps += vTxSigOps[i];
+        nFees += vTxFees[i];
+        inBlock.insert(it);
+
+        if (fPrintPriority)
         {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
+            LogPrintf("priority %.1f fee %s txid %s\n",
+                dPriority, CFeeRate(it->GetModifiedFee(), it->GetTxSize()).ToString(), it->GetTx().GetHash().ToString());
+        }
+    }
+    return true;
+}
+
+void BlockAssembler::addPriorityTxs()
+{
+    if (nBlockPrioritySize == 0)
+        return;
+
+    // This vector will be sorted into a priority queue:
+    std::vector<TxCoinAgePriority> vecPriority;
+    TxCoinAgePriorityCompare pricomparer;
+    // Transactions waiting for an in-mempool parent to be included first
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
+
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi)
+    {
+        double dPriority = mi->GetPriority(nHeight);
+        CAmount dummy = 0;
+        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+    while (!vecPriority.empty())
+    {
+        // Take highest priority transaction off the priority queue:
+        double dPriority = vecPriority.front().first;
+        CTxMemPool::txiter iter = vecPriority.front().second;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        vecPriority.pop_back();
+
+        if (isStillDependent(iter))
+        {
+            waitPriMap.insert(std::make_pair(iter, dPriority));
+            continue;
+        }
+
+        std::vector<CTxMemPool::txiter> package(1, iter);
+        if (!TestAndAddPackage(package, dPriority))
+            continue;
+
+        // Stop once past the priority size or we run out of high-priority
+        // transactions; the rest of the block is filled by fee rate.
+        if (nBlockSize >= nBlockPrioritySize || !AllowFree(dPriority))
+            break;
+
+        // Add transactions that depend on this one to the priority queue
+        BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
+        {
+            waitPriIter wpiter = waitPriMap.find(child);
+            if (wpiter != waitPriMap.end())
+            {
+                vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                waitPriMap.erase(wpiter);
+            }
+        }
+    }
+}
+
+bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set& mapModifiedTx, const CTxMemPool::setEntries& failedTx) const
+{
+    assert(it != mempool.mapTx.end());
+    return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
+}
+
+void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx) const
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded)
+    {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH(CTxMemPool::txiter desc, descendants)
+        {
+            if (alreadyAdded.count(desc) || inBlock.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end())
+            {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                mapModifiedTx.insert(modEntry);
+            }
+            else
+            {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+}
+
+void BlockAssembler::addPackageTxs()
+{
+    // mapModifiedTx stores the mempool entries whose ancestors have been
+    // partly included in the block; their package state is adjusted
+    // accordingly. mapTx is walked in ancestor-score order alongside it,
+    // always taking the better of the two next candidates.
+    indexed_modified_transaction_set mapModifiedTx;
+    // Entries of mapModifiedTx that failed inclusion, so that they are not
+    // picked up again from mapTx.
+    CTxMemPool::setEntries failedTx;
+
+    // Account for transactions already added by the priority pass
+    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+    CTxMemPool::txiter iter;
+    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+    {
+        // Skip entries in mapTx that are already in the block or are
+        // represented (with adjusted state) in mapModifiedTx
+        if (mi != mempool.mapTx.get<ancestor_score>().end() &&
+            SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx))
+        {
+            ++mi;
+            continue;
+        }
+
+        // Pick the next transaction to evaluate: the next entry from mapTx
+        // or the best one from mapModifiedTx
+        bool fUsingModified = false;
+        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+        if (mi == mempool.mapTx.get<ancestor_score>().end())
+        {
+            iter = modit->iter;
+            fUsingModified = true;
         }
         else
         {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter)))
+            {
+                iter = modit->iter;
+                fUsingModified = true;
+            }
+            else
+            {
+                ++mi;
+            }
+        }
+
+        assert(!inBlock.count(iter));
+
+        uint64_t nPackageSize = iter->GetSizeWithAncestors();
+        CAmount nPackageFees = iter->GetModFeesWithAncestors();
+        if (fUsingModified)
+        {
+            nPackageSize = modit->nSizeWithAncestors;
+            nPackageFees = modit->nModFeesWithAncestors;
         }
+
+        // Everything else we might consider has a lower fee rate; only keep
+        // going with free transactions until the minimum block size.
+        if (nPackageFees < ::minRelayTxFee.GetFee(nPackageSize) && nBlockSize >= nBlockMinSize)
+            break;
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        std::vector<CTxMemPool::txiter> package;
+        package.reserve(ancestors.size() + 1);
+        BOOST_FOREACH(CTxMemPool::txiter it, ancestors)
+        {
+            if (!inBlock.count(it))
+                package.push_back(it);
+        }
+        package.push_back(iter);
+        std::sort(package.begin(), package.end(), CompareTxIterByAncestorCount());
+
+        if (!TestAndAddPackage(package, iter->GetPriority(nHeight)))
+        {
+            if (fUsingModified)
+            {
+                // We always look at the best entry in mapModifiedTx, so it
+                // must be erased to make progress.
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+                failedTx.insert(iter);
+            }
+            continue;
+        }
+
+        CTxMemPool::setEntries added(package.begin(), package.end());
+        BOOST_FOREACH(CTxMemPool::txiter it, package)
+            mapModifiedTx.erase(it);
+        UpdatePackagesForAdded(added, mapModifiedTx);
     }
-};
+}
 
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
@@ -157,187 +553,14 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         LOCK2(cs_main, mempool.cs);
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
-        {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
 
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
-
-            if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            }
-            else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority)
-            {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
-            {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        BlockAssembler assembler(pblocktemplate.get(), nHeight, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+        assembler.addPriorityTxs();
+        assembler.addPackageTxs();
 
-        nLastBlockTx = nBlockTx;
+        uint64_t nBlockSize = assembler.GetBlockSize();
+        nFees = assembler.GetFees();
+        nLastBlockTx = assembler.GetBlockTx();
         nLastBlockSize = nBlockSize;
         LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
 
@@ -773,6 +996,7 @@ void static BitcoinMiner(CWallet *pwallet)
                         if (GetTimeMillis() - nHPSTimerStart > 4000)
                         {
                             dHashesPerSec = 1000.0 * nHashCounter / (GetTimeMillis() - nHPSTimerStart);
+                            metricHashesPerSec.Set((int64_t)dHashesPerSec);
                             nHPSTimerStart = GetTimeMillis();
                             nHashCounter = 0;
                             static int64_t nLogTime;
@@ -12,6 +12,7 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "metrics.h"
 #include "primitives/transaction.h"
 #include "ui_interface.h"
 
@@ -82,7 +83,7 @@ bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CNetDataStream> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -349,6 +350,8 @@ uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+CCriticalSection CNode::cs_totalMsgStats;
+mapMsgTypeStats_t CNode::mapTotalMsgStats;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -555,6 +558,11 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    {
+        LOCK(cs_msgStats);
+        X(mapMsgStats);
+    }
 }
 #undef X
 
@@ -588,8 +596,10 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         pch += handled;
         nBytes -= handled;
 
-        if (msg.complete())
+        if (msg.complete()) {
             msg.nTime = GetTimeMicros();
+            RecordMsgRecv(msg.hdr.GetCommand(), CMessageHeader::HEADER_SIZE + msg.hdr.nMessageSize);
+        }
     }
 
     return true;
@@ -653,10 +663,10 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CNetSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        const CNetSerializeData &data = *it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -762,6 +772,7 @@ void ThreadSocketHandler()
         if(vNodes.size() != nPrevNodeCount) {
             nPrevNodeCount = vNodes.size();
             uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+            metricNetPeers.Set(nPrevNodeCount);
         }
 
         //
@@ -1467,7 +1478,7 @@ void ThreadMessageHandler()
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if (!pnode->vRecvGetData.empty() || pnode->fOrphanWork || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
                             fSleep = false;
                         }
@@ -1765,13 +1776,13 @@ instance_of_cnetcleanup;
 
 void RelayTransaction(const CTransaction& tx)
 {
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    CNetDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss.reserve(10000);
     ss << tx;
     RelayTransaction(tx, ss);
 }
 
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
+void RelayTransaction(const CTransaction& tx, const CNetDataStream& ss)
 {
     CInv inv(MSG_TX, tx.GetHash());
     {
@@ -1804,12 +1815,14 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 
 void CNode::RecordBytesRecv(uint64_t bytes)
 {
+    metricNetBytesRecv.Inc(bytes);
     LOCK(cs_totalBytesRecv);
     nTotalBytesRecv += bytes;
 }
 
 void CNode::RecordBytesSent(uint64_t bytes)
 {
+    metricNetBytesSent.Inc(bytes);
     LOCK(cs_totalBytesSent);
     nTotalBytesSent += bytes;
 }
@@ -1826,6 +1839,79 @@ uint64_t CNode::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+/** Commands we send or process; anything else is accounted as NET_MESSAGE_TYPE_OTHER */
+static const char* const ppszKnownMsgTypes[] = {
+    "version", "verack", "addr", "inv", "getdata", "merkleblock", "getblocks", "getheaders", "tx",
+    "headers", "block", "getaddr", "mempool", "ping", "pong", "alert", "notfound", "filterload",
+    "filteradd", "filterclear", "reject",
+};
+
+static std::string GetMsgStatsType(const std::string& strCommand)
+{
+    for (unsigned int i = 0; i < ARRAYLEN(ppszKnownMsgTypes); i++)
+        if (strCommand == ppszKnownMsgTypes[i])
+            return strCommand;
+    return NET_MESSAGE_TYPE_OTHER;
+}
+
+void CNode::RecordMsgRecv(const std::string& strCommand, uint64_t nBytes)
+{
+    metricNetMessagesRecv.Inc();
+    std::string strType = GetMsgStatsType(strCommand);
+    {
+        LOCK(cs_msgStats);
+        CNetMsgTypeStats& stats = mapMsgStats[strType];
+        stats.nMsgsRecv++;
+        stats.nBytesRecv += nBytes;
+    }
+    LOCK(cs_totalMsgStats);
+    CNetMsgTypeStats& stats = mapTotalMsgStats[strType];
+    stats.nMsgsRecv++;
+    stats.nBytesRecv += nBytes;
+}
+
+void CNode::RecordMsgSent(const std::string& strCommand, uint64_t nBytes)
+{
+    metricNetMessagesSent.Inc();
+    std::string strType = GetMsgStatsType(strCommand);
+    {
+        LOCK(cs_msgStats);
+        CNetMsgTypeStats& stats = mapMsgStats[strType];
+        stats.nMsgsSent++;
+        stats.nBytesSent += nBytes;
+    }
+    LOCK(cs_totalMsgStats);
+    CNetMsgTypeStats& stats = mapTotalMsgStats[strType];
+    stats.nMsgsSent++;
+    stats.nBytesSent += nBytes;
+}
+
+static void AddMsgProcessed(CNetMsgTypeStats& stats, int64_t nQueueTime, int64_t nProcessTime)
+{
+    stats.nMsgsProcessed++;
+    stats.nQueueTime += nQueueTime;
+    stats.nQueueTimeMax = std::max(stats.nQueueTimeMax, nQueueTime);
+    stats.nProcessTime += nProcessTime;
+    stats.nProcessTimeMax = std::max(stats.nProcessTimeMax, nProcessTime);
+}
+
+void CNode::RecordMsgProcessed(const std::string& strCommand, int64_t nQueueTime, int64_t nProcessTime)
+{
+    std::string strType = GetMsgStatsType(strCommand);
+    {
+        LOCK(cs_msgStats);
+        AddMsgProcessed(mapMsgStats[strType], nQueueTime, nProcessTime);
+    }
+    LOCK(cs_totalMsgStats);
+    AddMsgProcessed(mapTotalMsgStats[strType], nQueueTime, nProcessTime);
+}
+
+mapMsgTypeStats_t CNode::GetTotalMsgStats()
+{
+    LOCK(cs_totalMsgStats);
+    return mapTotalMsgStats;
+}
+
 void CNode::Fuzz(int nChance)
 {
     if (!fSuccessfullyConnected) return; // Don't fuzz initial handshake
@@ -1836,21 +1922,21 @@ void CNode::Fuzz(int nChance)
     case 0:
         // xor a random byte with a random value:
         if (!ssSend.empty()) {
-            CDataStream::size_type pos = GetRand(ssSend.size());
+            CNetDataStream::size_type pos = GetRand(ssSend.size());
             ssSend[pos] ^= (unsigned char)(GetRand(256));
         }
         break;
     case 1:
         // delete a random byte:
         if (!ssSend.empty()) {
-            CDataStream::size_type pos = GetRand(ssSend.size());
+            CNetDataStream::size_type pos = GetRand(ssSend.size());
             ssSend.erase(ssSend.begin()+pos);
         }
         break;
     case 2:
         // insert a random byte at a random position
         {
-            CDataStream::size_type pos = GetRand(ssSend.size());
+            CNetDataStream::size_type pos = GetRand(ssSend.size());
             char ch = (char)GetRand(256);
             ssSend.insert(ssSend.begin()+pos, ch);
         }
@@ -1986,6 +2072,7 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fOrphanWork = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2104,7 +2191,10 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
+    const char* pszCommand = &ssSend[MESSAGE_START_SIZE];
+    RecordMsgSent(std::string(pszCommand, pszCommand + strnlen_int(pszCommand, CMessageHeader::COMMAND_SIZE)), ssSend.size());
+
+    std::deque<CNetSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CNetSerializeData());
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
 
@@ -20,6 +20,7 @@
 #include "utilstrencodings.h"
 
 #include <deque>
+#include <map>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -129,7 +130,7 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CNetDataStream> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -148,6 +149,29 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** Message statistics key for commands we don't know, so that peers cannot grow the maps at will */
+static const char* const NET_MESSAGE_TYPE_OTHER = "*other*";
+
+/** Traffic and processing time of one message type, with one peer or with all peers */
+class CNetMsgTypeStats
+{
+public:
+    uint64_t nMsgsRecv;
+    uint64_t nBytesRecv; //! Received bytes, headers included
+    uint64_t nMsgsSent;
+    uint64_t nBytesSent; //! Bytes queued for sending, headers included
+    uint64_t nMsgsProcessed; //! Received messages handed to ProcessMessage
+    int64_t nProcessTime; //! Time (in microseconds) spent in ProcessMessage
+    int64_t nProcessTimeMax;
+    int64_t nQueueTime; //! Time (in microseconds) messages waited between being received and processed
+    int64_t nQueueTimeMax;
+
+    CNetMsgTypeStats() : nMsgsRecv(0), nBytesRecv(0), nMsgsSent(0), nBytesSent(0), nMsgsProcessed(0),
+        nProcessTime(0), nProcessTimeMax(0), nQueueTime(0), nQueueTimeMax(0) {}
+};
+
+typedef std::map<std::string, CNetMsgTypeStats> mapMsgTypeStats_t;
+
 class CNodeStats
 {
 public:
@@ -167,6 +191,7 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    mapMsgTypeStats_t mapMsgStats;
 };
 
 
@@ -176,11 +201,11 @@ class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    CNetDataStream hdrbuf;          // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CNetDataStream vRecv;           // received message data
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
@@ -221,16 +246,17 @@ public:
     // socket
     uint64_t nServices;
     SOCKET hSocket;
-    CDataStream ssSend;
+    CNetDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CNetSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    bool fOrphanWork; // orphans this peer sent are waiting to be reconsidered; protected by cs_vRecvMsg
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -304,6 +330,12 @@ public:
     // Whether a ping is requested.
     bool fPingQueued;
 
+    // Traffic and processing time per message type; cs_msgStats is only
+    // ever held briefly, so that reading the statistics never waits on
+    // message processing.
+    CCriticalSection cs_msgStats;
+    mapMsgTypeStats_t mapMsgStats;
+
     CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false);
     ~CNode();
 
@@ -313,6 +345,8 @@ private:
     static CCriticalSection cs_totalBytesSent;
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
+    static CCriticalSection cs_totalMsgStats;
+    static mapMsgTypeStats_t mapTotalMsgStats;
 
     CNode(const CNode&);
     void operator=(const CNode&);
@@ -604,13 +638,21 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    // Message type stats, accounted to this peer and to the totals
+    void RecordMsgRecv(const std::string& strCommand, uint64_t nBytes);
+    void RecordMsgSent(const std::string& strCommand, uint64_t nBytes);
+    void RecordMsgProcessed(const std::string& strCommand, int64_t nQueueTime, int64_t nProcessTime);
+
+    /** Statistics per message type of all peers since startup */
+    static mapMsgTypeStats_t GetTotalMsgStats();
 };
 
 
 
 class CTransaction;
 void RelayTransaction(const CTransaction& tx);
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
+void RelayTransaction(const CTransaction& tx, const CNetDataStream& ss);
 
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
@@ -13,6 +13,10 @@
 
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock)
 {
+    // Cached by CBlockIndex::BuildCaches when it doesn't depend on pblock
+    if (pindexLast && pindexLast->nBitsNext && !Params().AllowMinDifficultyBlocks())
+        return pindexLast->nBitsNext;
+
     // Standard retargeting for the first blocks
     if (pindexLast->nHeight+1 < 100) // Briliantcoin: block < 36000
     {
@@ -81,7 +85,7 @@ unsigned int GetNextWorkRequiredn(const CBlockIndex* pindexLast, const CBlockHea
 
     // Limit adjustment step
     int64_t nActualTimespan = pindexLast->GetBlockTime() - pindexFirst->GetBlockTime();
-    LogPrintf("  nActualTimespan = %d  before bounds\n", nActualTimespan);
+    LogPrint("pow", "  nActualTimespan = %d  before bounds\n", nActualTimespan);
     if (nActualTimespan < Params().TargetTimespan()/4)
         nActualTimespan = Params().TargetTimespan()/4;
     if (nActualTimespan > Params().TargetTimespan()*4)
@@ -105,10 +109,10 @@ unsigned int GetNextWorkRequiredn(const CBlockIndex* pindexLast, const CBlockHea
         bnNew = Params().ProofOfWorkLimit();
 
     /// debug print
-    LogPrintf("GetNextWorkRequired RETARGET\n");
-    LogPrintf("Params().TargetTimespan() = %d    nActualTimespan = %d\n", Params().TargetTimespan(), nActualTimespan);
-    LogPrintf("Before: %08x  %s\n", pindexLast->nBits, bnOld.ToString());
-    LogPrintf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString());
+    LogPrint("pow", "GetNextWorkRequired RETARGET\n");
+    LogPrint("pow", "Params().TargetTimespan() = %d    nActualTimespan = %d\n", Params().TargetTimespan(), nActualTimespan);
+    LogPrint("pow", "Before: %08x  %s\n", pindexLast->nBits, bnOld.ToString());
+    LogPrint("pow", "After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString());
 
     return bnNew.GetCompact();
 }
@@ -157,7 +161,7 @@ unsigned int GetNextWorkRequiredx(const CBlockIndex* pindexLast, const CBlockHea
 
     // Limit adjustment step
     int64_t nActualTimespan = pindexLast->GetBlockTime() - pindexFirst->GetBlockTime();
-    LogPrintf("  nActualTimespan = %d  before bounds\n", nActualTimespan);
+    LogPrint("pow", "  nActualTimespan = %d  before bounds\n", nActualTimespan);
     if (nActualTimespan < Params().TargetTimespanx()/4)
         nActualTimespan = Params().TargetTimespanx()/4;
     if (nActualTimespan > Params().TargetTimespanx()*4)
@@ -181,10 +185,10 @@ unsigned int GetNextWorkRequiredx(const CBlockIndex* pindexLast, const CBlockHea
         bnNew = Params().ProofOfWorkLimit();
 
     /// debug print
-    LogPrintf("GetNextWorkRequired eX RETARGET\n");
-    LogPrintf("Params().TargetTimespanx() = %d    nActualTimespan = %d\n", Params().TargetTimespanx(), nActualTimespan);
-    LogPrintf("Before: %08x  %s\n", pindexLast->nBits, bnOld.ToString());
-    LogPrintf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString());
+    LogPrint("pow", "GetNextWorkRequired eX RETARGET\n");
+    LogPrint("pow", "Params().TargetTimespanx() = %d    nActualTimespan = %d\n", Params().TargetTimespanx(), nActualTimespan);
+    LogPrint("pow", "Before: %08x  %s\n", pindexLast->nBits, bnOld.ToString());
+    LogPrint("pow", "After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString());
 
     return bnNew.GetCompact();
 }
@@ -233,7 +237,7 @@ unsigned int GetNextWorkRequireds(const CBlockIndex* pindexLast, const CBlockHea
 
     // Limit adjustment step
     int64_t nActualTimespan = pindexLast->GetBlockTime() - pindexFirst->GetBlockTime();
-    LogPrintf("  nActualTimespan = %d  before bounds\n", nActualTimespan);
+    LogPrint("pow", "  nActualTimespan = %d  before bounds\n", nActualTimespan);
     if (nActualTimespan < Params().TargetTimespans()/4)
         nActualTimespan = Params().TargetTimespans()/4;
     if (nActualTimespan > Params().TargetTimespans()*4)
@@ -257,10 +261,10 @@ unsigned int GetNextWorkRequireds(const CBlockIndex* pindexLast, const CBlockHea
         bnNew = Params().ProofOfWorkLimit();
 
     /// debug print
-    LogPrintf("GetNextWorkRequired eXs RETARGET\n");
-    LogPrintf("Params().TargetTimespans() = %d    nActualTimespan = %d\n", Params().TargetTimespans(), nActualTimespan);
-    LogPrintf("Before: %08x  %s\n", pindexLast->nBits, bnOld.ToString());
-    LogPrintf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString());
+    LogPrint("pow", "GetNextWorkRequired eXs RETARGET\n");
+    LogPrint("pow", "Params().TargetTimespans() = %d    nActualTimespan = %d\n", Params().TargetTimespans(), nActualTimespan);
+    LogPrint("pow", "Before: %08x  %s\n", pindexLast->nBits, bnOld.ToString());
+    LogPrint("pow", "After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString());
 
     return bnNew.GetCompact();
 }
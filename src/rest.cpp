@@ -3,12 +3,14 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
+#include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
@@ -17,6 +19,9 @@
 using namespace std;
 using namespace json_spirit;
 
+static const int MAX_REST_HEADERS_RESULTS = 2000;
+static const size_t MAX_GETUTXOS_OUTPOINTS = 100; //allow a max of 100 outpoints to be queried at once
+
 enum RetFormat {
     RF_UNDEF,
     RF_BINARY,
@@ -41,8 +46,28 @@ public:
     string message;
 };
 
+/** Unspent output as returned by /rest/getutxos */
+struct CCoin {
+    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
+    uint32_t nHeight;
+    CTxOut out;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nTxVer);
+        READWRITE(nHeight);
+        READWRITE(out);
+    }
+};
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
-extern Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSONStream(JSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails);
+extern Object blockheaderToJSON(const CBlockIndex* blockindex);
+extern Value getblockchaininfo(const Array& params, bool fHelp);
+extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeHex);
 
 static RestErr RESTERR(enum HTTPStatusCode status, string message)
 {
@@ -89,8 +114,76 @@ static bool ParseHashStr(const string& strReq, uint256& v)
     return true;
 }
 
+static bool rest_headers(AcceptedConnection* conn,
+                         string& strReq,
+                         string& strRequest,
+                         map<string, string>& mapHeaders,
+                         bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+
+    int32_t count;
+    if (!ParseInt32(path[0], &count) || count < 1 || count > MAX_REST_HEADERS_RESULTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Header count out of range: %s", path[0]));
+
+    string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    // Headers are serialized straight from the index, no block data is touched
+    CNetDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    Array jsonHeaders;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        for (int i = 0; pindex != NULL && chainActive.Contains(pindex) && i < count; i++) {
+            if (rf == RF_JSON)
+                jsonHeaders.push_back(blockheaderToJSON(pindex));
+            else
+                ssHeader << pindex->GetBlockHeader();
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        string binaryHeader = ssHeader.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryHeader.size(), "application/octet-stream") << binaryHeader << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ssHeader.begin(), ssHeader.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        string strJSON = write_string(Value(jsonHeaders), false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_block(AcceptedConnection* conn,
                        string& strReq,
+                       string& strRequest,
                        map<string, string>& mapHeaders,
                        bool fRun,
                        bool showTxDetails)
@@ -111,11 +204,14 @@ static bool rest_block(AcceptedConnection* conn,
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
 
         pblockindex = mapBlockIndex[hash];
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw RESTERR(HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
+
         if (!ReadBlockFromDisk(block, pblockindex))
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    CNetDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
     ssBlock << block;
 
     switch (rf) {
@@ -132,9 +228,21 @@ static bool rest_block(AcceptedConnection* conn,
     }
 
     case RF_JSON: {
-        Object objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = write_string(Value(objBlock), false) + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        // Stream the block so that full transaction details are never held as one document
+        if (conn->chunked_allowed()) {
+            HTTPChunkedStreamBuf buf(conn->stream(), HTTPReplyHeaderChunked(HTTP_OK, fRun));
+            std::ostream stream(&buf);
+            JSONStreamWriter writer(stream);
+            blockToJSONStream(writer, block, pblockindex, showTxDetails);
+            stream << "\n";
+            buf.Finish();
+            return true;
+        }
+        std::ostringstream ssJSON;
+        JSONStreamWriter writer(ssJSON);
+        blockToJSONStream(writer, block, pblockindex, showTxDetails);
+        ssJSON << "\n";
+        conn->stream() << HTTPReply(HTTP_OK, ssJSON.str(), fRun) << std::flush;
         return true;
     }
 
@@ -149,22 +257,25 @@ static bool rest_block(AcceptedConnection* conn,
 
 static bool rest_block_extended(AcceptedConnection* conn,
                        string& strReq,
+                       string& strRequest,
                        map<string, string>& mapHeaders,
                        bool fRun)
 {
-    return rest_block(conn, strReq, mapHeaders, fRun, true);
+    return rest_block(conn, strReq, strRequest, mapHeaders, fRun, true);
 }
 
 static bool rest_block_notxdetails(AcceptedConnection* conn,
                        string& strReq,
+                       string& strRequest,
                        map<string, string>& mapHeaders,
                        bool fRun)
 {
-    return rest_block(conn, strReq, mapHeaders, fRun, false);
+    return rest_block(conn, strReq, strRequest, mapHeaders, fRun, false);
 }
 
 static bool rest_tx(AcceptedConnection* conn,
                     string& strReq,
+                    string& strRequest,
                     map<string, string>& mapHeaders,
                     bool fRun)
 {
@@ -181,7 +292,7 @@ static bool rest_tx(AcceptedConnection* conn,
     if (!GetTransaction(hash, tx, hashBlock, true))
         throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
 
-    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    CNetDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
     ssTx << tx;
 
     switch (rf) {
@@ -214,20 +325,266 @@ static bool rest_tx(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_chaininfo(AcceptedConnection* conn,
+                           string& strReq,
+                           string& strRequest,
+                           map<string, string>& mapHeaders,
+                           bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        CDataStream ssChainInfo(SER_NETWORK, PROTOCOL_VERSION);
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexTip = chainActive.Tip();
+            ssChainInfo << Params().NetworkIDString();
+            ssChainInfo << (int32_t)chainActive.Height();
+            ssChainInfo << (int32_t)(pindexBestHeader ? pindexBestHeader->nHeight : -1);
+            ssChainInfo << pindexTip->GetBlockHash();
+            ssChainInfo << pindexTip->nChainWork;
+            ssChainInfo << pindexTip->GetMedianTimePast();
+        }
+        if (rf == RF_HEX) {
+            string strHex = HexStr(ssChainInfo.begin(), ssChainInfo.end()) + "\n";
+            conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        } else {
+            string binaryChainInfo = ssChainInfo.str();
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryChainInfo.size(), "application/octet-stream") << binaryChainInfo << std::flush;
+        }
+        return true;
+    }
+
+    case RF_JSON: {
+        Array rpcParams;
+        Value chainInfoObject;
+        {
+            LOCK(cs_main);
+            chainInfoObject = getblockchaininfo(rpcParams, false);
+        }
+        string strJSON = write_string(chainInfoObject, false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+/**
+ * Outpoints are given either in the URI
+ * (/rest/getutxos/checkmempool/<txid>-<n>/<txid>-<n>.<ext>) or, for .bin and
+ * .hex, as a serialized (bool fCheckMemPool, vector<COutPoint>) request body.
+ */
+static bool rest_getutxos(AcceptedConnection* conn,
+                          string& strReq,
+                          string& strRequest,
+                          map<string, string>& mapHeaders,
+                          bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    vector<string> uriParts;
+    if (params.size() > 0 && params[0].length() > 1) {
+        std::string strUriParams = params[0].substr(1);
+        boost::split(uriParts, strUriParams, boost::is_any_of("/"));
+    }
+
+    // throw exception in case of an empty request
+    if (strRequest.length() == 0 && uriParts.size() == 0)
+        throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+
+    bool fInputParsed = false;
+    bool fCheckMemPool = false;
+    vector<COutPoint> vOutPoints;
+
+    if (uriParts.size() > 0) {
+        if (uriParts[0] == "checkmempool")
+            fCheckMemPool = true;
+
+        for (size_t i = (fCheckMemPool) ? 1 : 0; i < uriParts.size(); i++) {
+            size_t nSep = uriParts[i].find("-");
+            if (nSep == string::npos)
+                throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+
+            uint256 txid;
+            int32_t nOutput;
+            if (!ParseHashStr(uriParts[i].substr(0, nSep), txid) || !ParseInt32(uriParts[i].substr(nSep + 1), &nOutput) || nOutput < 0)
+                throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+
+            vOutPoints.push_back(COutPoint(txid, (uint32_t)nOutput));
+        }
+
+        if (vOutPoints.size() == 0)
+            throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+        fInputParsed = true;
+    }
+
+    // input format = output format: .bin takes a binary body, .hex a hex encoded one
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        if (strRequest.size() > 0) {
+            // don't allow sending input over URI and HTTP raw data
+            if (fInputParsed)
+                throw RESTERR(HTTP_BAD_REQUEST, "Combination of URI scheme inputs and raw post data is not allowed");
+
+            vector<unsigned char> vRequest;
+            if (rf == RF_HEX)
+                vRequest = ParseHex(strRequest);
+            else
+                vRequest.assign(strRequest.begin(), strRequest.end());
+
+            try {
+                CDataStream ssRequest(vRequest, SER_NETWORK, PROTOCOL_VERSION);
+                ssRequest >> fCheckMemPool;
+                ssRequest >> vOutPoints;
+            } catch (const std::ios_base::failure& e) {
+                throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+            }
+        }
+        break;
+    }
+
+    case RF_JSON: {
+        if (!fInputParsed)
+            throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+        break;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // limit max outpoints
+    if (vOutPoints.size() > MAX_GETUTXOS_OUTPOINTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", MAX_GETUTXOS_OUTPOINTS, vOutPoints.size()));
+
+    // check spentness and form a bitmap (as well as a JSON capable human-readable string representation)
+    vector<unsigned char> bitmap((vOutPoints.size() + 7) / 8);
+    string bitmapStringRepresentation;
+    vector<CCoin> outs;
+    int32_t nChainHeight;
+    uint256 hashChainTip;
+    {
+        LOCK2(cs_main, mempool.cs);
+
+        CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
+        CCoinsView& view = fCheckMemPool ? (CCoinsView&)viewMempool : (CCoinsView&)*pcoinsTip;
+
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            CCoins coins;
+            uint256 hash = vOutPoints[i].hash;
+            bool hit = false;
+            if (view.GetCoins(hash, coins)) {
+                if (fCheckMemPool)
+                    mempool.pruneSpent(hash, coins);
+                if (coins.IsAvailable(vOutPoints[i].n)) {
+                    hit = true;
+                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
+                    // n is valid but points to an already spent output (IsNull).
+                    CCoin coin;
+                    coin.nTxVer = coins.nVersion;
+                    coin.nHeight = coins.nHeight;
+                    coin.out = coins.vout.at(vOutPoints[i].n);
+                    assert(!coin.out.IsNull());
+                    outs.push_back(coin);
+                }
+            }
+
+            bitmapStringRepresentation.append(hit ? "1" : "0"); // form a binary string representation (human-readable for json output)
+            bitmap[i / 8] |= ((uint8_t)hit) << (i % 8);
+        }
+
+        nChainHeight = chainActive.Height();
+        hashChainTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        // serialize data
+        // use exact same output as mentioned in Bip64
+        CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
+        ssGetUTXOResponse << nChainHeight << hashChainTip << bitmap << outs;
+        if (rf == RF_HEX) {
+            string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
+            conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        } else {
+            string ssGetUTXOResponseString = ssGetUTXOResponse.str();
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, ssGetUTXOResponseString.size(), "application/octet-stream") << ssGetUTXOResponseString << std::flush;
+        }
+        return true;
+    }
+
+    case RF_JSON: {
+        Object objGetUTXOResponse;
+
+        // pack in some essentials
+        // use more or less the same output as mentioned in Bip64
+        objGetUTXOResponse.push_back(Pair("chainHeight", nChainHeight));
+        objGetUTXOResponse.push_back(Pair("chaintipHash", hashChainTip.GetHex()));
+        objGetUTXOResponse.push_back(Pair("bitmap", bitmapStringRepresentation));
+
+        Array utxos;
+        BOOST_FOREACH (const CCoin& coin, outs) {
+            Object utxo;
+            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
+            utxo.push_back(Pair("height", (int32_t)coin.nHeight));
+            utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
+
+            // include the script in a json output
+            Object o;
+            ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
+            utxo.push_back(Pair("scriptPubKey", o));
+            utxos.push_back(utxo);
+        }
+        objGetUTXOResponse.push_back(Pair("utxos", utxos));
+
+        // return json string
+        string strJSON = write_string(Value(objGetUTXOResponse), false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
                     string& strURI,
+                    string& strRequest,
                     map<string, string>& mapHeaders,
                     bool fRun);
 } uri_prefixes[] = {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/chaininfo", rest_chaininfo},
+      {"/rest/headers/", rest_headers},
+      {"/rest/getutxos", rest_getutxos},
 };
 
 bool HTTPReq_REST(AcceptedConnection* conn,
                   string& strURI,
+                  string& strRequest,
                   map<string, string>& mapHeaders,
                   bool fRun)
 {
@@ -240,7 +597,7 @@ bool HTTPReq_REST(AcceptedConnection* conn,
             unsigned int plen = strlen(uri_prefixes[i].prefix);
             if (strURI.substr(0, plen) == uri_prefixes[i].prefix) {
                 string strReq = strURI.substr(plen);
-                return uri_prefixes[i].handler(conn, strReq, mapHeaders, fRun);
+                return uri_prefixes[i].handler(conn, strReq, strRequest, mapHeaders, fRun);
             }
         }
     } catch (RestErr& re) {
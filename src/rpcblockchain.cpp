@@ -3,10 +3,15 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "base58.h"
+#include "blocktimings.h"
+#include "bloom.h"
 #include "checkpoints.h"
+#include "core_io.h"
 #include "main.h"
 #include "rpcserver.h"
 #include "sync.h"
+#include "univalue/univalue.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -91,6 +96,112 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDe
     return result;
 }
 
+Object blockheaderToJSON(const CBlockIndex* blockindex)
+{
+    Object result;
+    result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
+    int confirmations = -1;
+    // Only report confirmations if the block is on the main chain
+    if (chainActive.Contains(blockindex))
+        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    result.push_back(Pair("confirmations", confirmations));
+    result.push_back(Pair("height", blockindex->nHeight));
+    result.push_back(Pair("version", blockindex->nVersion));
+    result.push_back(Pair("merkleroot", blockindex->hashMerkleRoot.GetHex()));
+    result.push_back(Pair("time", (int64_t)blockindex->nTime));
+    result.push_back(Pair("nonce", (uint64_t)blockindex->nNonce));
+    result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
+    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+
+    if (blockindex->pprev)
+        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+    return result;
+}
+
+//! Format a number the way json_spirit writes reals, so streamed replies match
+static UniValue UniValueReal(double d)
+{
+    return UniValue(UniValue::VNUM, strprintf("%.8f", d));
+}
+
+/**
+ * Write a transaction as TxToJSON does. TxToUniv formats amounts with
+ * FormatMoney, so the output values are written here like ValueFromAmount.
+ */
+static void TxToJSONStream(JSONStreamWriter& writer, const CTransaction& tx)
+{
+    UniValue objTx(UniValue::VOBJ);
+    TxToUniv(tx, uint256(0), objTx, false);
+
+    writer.BeginObject();
+    writer.Write("txid", objTx["txid"]);
+    writer.Write("version", objTx["version"]);
+    writer.Write("locktime", objTx["locktime"]);
+    writer.Write("vin", objTx["vin"]);
+    writer.Key("vout");
+    writer.BeginArray();
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        const UniValue& out = objTx["vout"][i];
+        writer.BeginObject();
+        writer.Write("value", UniValueReal((double)tx.vout[i].nValue / (double)COIN));
+        writer.Write("n", out["n"]);
+        writer.Write("scriptPubKey", out["scriptPubKey"]);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+}
+
+/**
+ * Streaming counterpart of blockToJSON: transactions are converted and
+ * written one at a time instead of being collected in one Object.
+ */
+void blockToJSONStream(JSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    int confirmations = -1;
+    const CBlockIndex* pnext = NULL;
+    {
+        LOCK(cs_main);
+        // Only report confirmations if the block is on the main chain
+        if (chainActive.Contains(blockindex))
+            confirmations = chainActive.Height() - blockindex->nHeight + 1;
+        pnext = chainActive.Next(blockindex);
+    }
+
+    writer.BeginObject();
+    writer.Write("hash", block.GetHash().GetHex());
+    writer.Write("confirmations", confirmations);
+    writer.Write("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.Write("height", blockindex->nHeight);
+    writer.Write("version", block.nVersion);
+    writer.Write("merkleroot", block.hashMerkleRoot.GetHex());
+    writer.Key("tx");
+    writer.BeginArray();
+    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+    {
+        if(txDetails)
+            TxToJSONStream(writer, tx);
+        else
+            writer.Write(tx.GetHash().GetHex());
+    }
+    writer.EndArray();
+    writer.Write("time", block.GetBlockTime());
+    writer.Write("nonce", (uint64_t)block.nNonce);
+    writer.Write("bits", strprintf("%08x", block.nBits));
+    writer.Write("difficulty", UniValueReal(GetDifficulty(blockindex)));
+    writer.Write("chainwork", blockindex->nChainWork.GetHex());
+
+    if (blockindex->pprev)
+        writer.Write("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+    if (pnext)
+        writer.Write("nextblockhash", pnext->GetBlockHash().GetHex());
+    writer.EndObject();
+}
 
 Value getblockcount(const Array& params, bool fHelp)
 {
@@ -105,6 +216,7 @@ Value getblockcount(const Array& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
+    LOCK(cs_main);
     return chainActive.Height();
 }
 
@@ -121,6 +233,7 @@ Value getbestblockhash(const Array& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
+    LOCK(cs_main);
     return chainActive.Tip()->GetBlockHash().GetHex();
 }
 
@@ -163,6 +276,12 @@ Value getrawmempool(const Array& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) modified fees of in-mempool descendants (including this one) in satoshis\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees of in-mempool ancestors (including this one) in satoshis\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -181,10 +300,9 @@ Value getrawmempool(const Array& params, bool fHelp)
     {
         LOCK(mempool.cs);
         Object o;
-        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
         {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+            const uint256& hash = e.GetTx().GetHash();
             Object info;
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -192,6 +310,12 @@ Value getrawmempool(const Array& params, bool fHelp)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
@@ -218,6 +342,87 @@ Value getrawmempool(const Array& params, bool fHelp)
     }
 }
 
+bool getrawmempool_stream(const Array& params, JSONStreamWriter& writer)
+{
+    if (params.size() != 1 || !params[0].get_bool())
+        return false;
+
+    // Take a compact copy of what is reported, so the locks are not held
+    // while the reply is written to a possibly slow client.
+    struct MempoolEntryInfo
+    {
+        uint256 hash;
+        unsigned int nSize;
+        CAmount nFee;
+        int64_t nTime;
+        unsigned int nHeight;
+        double dStartingPriority;
+        double dCurrentPriority;
+        uint64_t nCountWithDescendants;
+        uint64_t nSizeWithDescendants;
+        CAmount nModFeesWithDescendants;
+        uint64_t nCountWithAncestors;
+        uint64_t nSizeWithAncestors;
+        CAmount nModFeesWithAncestors;
+        std::set<uint256> setDepends;
+    };
+    std::vector<MempoolEntryInfo> vInfo;
+    {
+        LOCK2(cs_main, mempool.cs);
+        vInfo.reserve(mempool.mapTx.size());
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+        {
+            vInfo.push_back(MempoolEntryInfo());
+            MempoolEntryInfo& info = vInfo.back();
+            info.hash = e.GetTx().GetHash();
+            info.nSize = e.GetTxSize();
+            info.nFee = e.GetFee();
+            info.nTime = e.GetTime();
+            info.nHeight = e.GetHeight();
+            info.dStartingPriority = e.GetPriority(e.GetHeight());
+            info.dCurrentPriority = e.GetPriority(chainActive.Height());
+            info.nCountWithDescendants = e.GetCountWithDescendants();
+            info.nSizeWithDescendants = e.GetSizeWithDescendants();
+            info.nModFeesWithDescendants = e.GetModFeesWithDescendants();
+            info.nCountWithAncestors = e.GetCountWithAncestors();
+            info.nSizeWithAncestors = e.GetSizeWithAncestors();
+            info.nModFeesWithAncestors = e.GetModFeesWithAncestors();
+            BOOST_FOREACH(const CTxIn& txin, e.GetTx().vin)
+            {
+                if (mempool.exists(txin.prevout.hash))
+                    info.setDepends.insert(txin.prevout.hash);
+            }
+        }
+    }
+
+    writer.BeginObject();
+    BOOST_FOREACH(const MempoolEntryInfo& info, vInfo)
+    {
+        writer.Key(info.hash.ToString());
+        writer.BeginObject();
+        writer.Write("size", (int)info.nSize);
+        writer.Write("fee", UniValueReal((double)info.nFee / (double)COIN));
+        writer.Write("time", info.nTime);
+        writer.Write("height", (int)info.nHeight);
+        writer.Write("startingpriority", UniValueReal(info.dStartingPriority));
+        writer.Write("currentpriority", UniValueReal(info.dCurrentPriority));
+        writer.Write("descendantcount", info.nCountWithDescendants);
+        writer.Write("descendantsize", info.nSizeWithDescendants);
+        writer.Write("descendantfees", info.nModFeesWithDescendants);
+        writer.Write("ancestorcount", info.nCountWithAncestors);
+        writer.Write("ancestorsize", info.nSizeWithAncestors);
+        writer.Write("ancestorfees", info.nModFeesWithAncestors);
+        writer.Key("depends");
+        writer.BeginArray();
+        BOOST_FOREACH(const uint256& hash, info.setDepends)
+            writer.Write(hash.ToString());
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndObject();
+    return true;
+}
+
 Value getblockhash(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -233,6 +438,8 @@ Value getblockhash(const Array& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
+    LOCK(cs_main);
+
     int nHeight = params[0].get_int();
     if (nHeight < 0 || nHeight > chainActive.Height())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
@@ -284,26 +491,69 @@ Value getblock(const Array& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    CBlockIndex* pblockindex = NULL;
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+        if (!(pblockindex->nStatus & BLOCK_HAVE_DATA))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        pos = pblockindex->GetBlockPos();
+    }
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if(!ReadBlockFromDisk(block, pblockindex))
+    if (!ReadBlockFromDisk(block, pos) || block.GetHash() != hash)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     if (!fVerbose)
     {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        CNetDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
 
+    LOCK(cs_main);
     return blockToJSON(block, pblockindex);
 }
 
+bool getblock_stream(const Array& params, JSONStreamWriter& writer)
+{
+    // Usage errors and the hex format are left to getblock
+    if (params.size() < 1 || params.size() > 2)
+        return false;
+    if (params.size() > 1 && !params[1].get_bool())
+        return false;
+
+    uint256 hash(params[0].get_str());
+    CBlockIndex* pblockindex = NULL;
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+        if (!(pblockindex->nStatus & BLOCK_HAVE_DATA))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        pos = pblockindex->GetBlockPos();
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pos) || block.GetHash() != hash)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    blockToJSONStream(writer, block, pblockindex, false);
+    return true;
+}
+
 Value gettxoutsetinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -389,6 +639,8 @@ Value gettxout(const Array& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
+    LOCK(cs_main);
+
     CCoins coins;
     if (fMempool) {
         LOCK(mempool.cs);
@@ -460,7 +712,9 @@ Value getblockchaininfo(const Array& params, bool fHelp)
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
-            "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"chainwork\": \"xxxx\",    (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
+            "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getblockchaininfo", "")
@@ -475,6 +729,15 @@ Value getblockchaininfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty",            (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("pruned",                fPruneMode));
+    if (fPruneMode)
+    {
+        CBlockIndex *block = chainActive.Tip();
+        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+            block = block->pprev;
+
+        obj.push_back(Pair("pruneheight",       block->nHeight));
+    }
     return obj;
 }
 
@@ -581,6 +844,84 @@ Value getchaintips(const Array& params, bool fHelp)
     return res;
 }
 
+Value getblocktimings(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getblocktimings ( count )\n"
+            "\nReturns how long connecting the recently connected blocks took, per validation phase.\n"
+            "\nArguments:\n"
+            "1. count        (numeric, optional, default=10) Number of most recent blocks to list individually\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": n,              (numeric) Number of blocks the percentiles are computed over (at most "
+            + strprintf("%u", BLOCK_TIMINGS_BUFFER_SIZE) + ")\n"
+            "  \"phases\": {               (json object) Percentiles of the time spent in each phase, in milliseconds\n"
+            "    \"phase\": {\n"
+            "      \"p50\": n.nnn,\n"
+            "      \"p90\": n.nnn,\n"
+            "      \"p99\": n.nnn,\n"
+            "      \"max\": n.nnn\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"recent\": [               (json array) The most recent blocks, newest first\n"
+            "    {\n"
+            "      \"hash\": \"hash\",       (string) The block hash\n"
+            "      \"height\": n,          (numeric) The block height\n"
+            "      \"tx\": n,              (numeric) Number of transactions\n"
+            "      \"inputs\": n,          (numeric) Number of inputs spent, not counting the coinbase\n"
+            "      \"time\": n,            (numeric) When the block was connected, in seconds since epoch\n"
+            "      \"phase\": n.nnn, ...   (numeric) Time spent in each phase, in milliseconds\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nPhases: read, check, utxo, scripts, updatecoins, undo, flushview, flushstate, mempool, wallet, total.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblocktimings", "")
+            + HelpExampleCli("getblocktimings", "100")
+            + HelpExampleRpc("getblocktimings", "100")
+        );
+
+    int nCount = 10;
+    if (params.size() > 0)
+        nCount = params[0].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    static const double percentiles[] = { 50, 90, 99, 100 };
+    static const char* const percentileNames[] = { "p50", "p90", "p99", "max" };
+    std::vector<double> vPercentiles(percentiles, percentiles + ARRAYLEN(percentiles));
+
+    Object ret;
+    ret.push_back(Pair("blocks", (int)blockTimings.Size()));
+
+    Object phases;
+    for (int nPhase = 0; nPhase < BLOCK_PHASE_COUNT; nPhase++) {
+        std::vector<int64_t> vTimes = blockTimings.GetPercentiles(nPhase, vPercentiles);
+        Object phase;
+        for (unsigned int i = 0; i < vTimes.size(); i++)
+            phase.push_back(Pair(percentileNames[i], vTimes[i] * 0.001));
+        phases.push_back(Pair(GetBlockTimingPhaseName(nPhase), phase));
+    }
+    ret.push_back(Pair("phases", phases));
+
+    Array recent;
+    BOOST_FOREACH(const CBlockTimings& timings, blockTimings.GetRecent(nCount)) {
+        Object obj;
+        obj.push_back(Pair("hash", timings.hashBlock.GetHex()));
+        obj.push_back(Pair("height", timings.nHeight));
+        obj.push_back(Pair("tx", (int)timings.nTx));
+        obj.push_back(Pair("inputs", (int)timings.nInputs));
+        obj.push_back(Pair("time", timings.nTimeConnected));
+        for (int nPhase = 0; nPhase < BLOCK_PHASE_COUNT; nPhase++)
+            obj.push_back(Pair(GetBlockTimingPhaseName(nPhase), timings.nPhaseTime[nPhase] * 0.001));
+        recent.push_back(obj);
+    }
+    ret.push_back(Pair("recent", recent));
+
+    return ret;
+}
+
 Value getmempoolinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -591,6 +932,10 @@ Value getmempoolinfo(const Array& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
+            "  \"loaded\": true|false         (boolean) True if the mempool is fully loaded from mempool.dat\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -600,10 +945,36 @@ Value getmempoolinfo(const Array& params, bool fHelp)
     Object ret;
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
+    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+    ret.push_back(Pair("loaded", mempool.IsLoaded()));
 
     return ret;
 }
 
+Value savemempool(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "savemempool\n"
+            "\nDumps the mempool to disk (mempool.dat in the data directory).\n"
+            "It will fail until the previous dump is fully loaded.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("savemempool", "")
+            + HelpExampleRpc("savemempool", "")
+        );
+
+    if (!mempool.IsLoaded())
+        throw JSONRPCError(RPC_MISC_ERROR, "The mempool was not loaded yet");
+
+    if (!DumpMempool())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to dump mempool to disk");
+
+    return Value::null;
+}
+
 Value invalidateblock(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -680,3 +1051,94 @@ Value reconsiderblock(const Array& params, bool fHelp)
 
     return Value::null;
 }
+
+Value scanblockfilters(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "scanblockfilters [\"address\",...] ( startheight )\n"
+            "\nLists the blocks in the main chain that may contain outputs to the given addresses or scripts,\n"
+            "using the filters kept by -blockfilterindex. Blocks connected before the index was enabled have no\n"
+            "filter and are only counted.\n"
+            "\nArguments:\n"
+            "1. \"addresses\"   (string, required) A json array of briliantcoin addresses or hex-encoded scripts\n"
+            "2. startheight     (numeric, optional, default=0) The block height to start at\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"matches\": [           (array of json objects) Blocks whose filter matches, in chain order\n"
+            "    {\n"
+            "      \"height\": n,       (numeric) The block height\n"
+            "      \"hash\": \"hash\"     (string) The block hash\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"unfiltered\": n       (numeric) The number of blocks that have no filter\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("scanblockfilters", "\"[\\\"myaddress\\\"]\" 100000")
+            + HelpExampleRpc("scanblockfilters", "[\"myaddress\"], 100000")
+        );
+
+    if (!fBlockFilterIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Block filter index is not enabled, use -blockfilterindex");
+
+    std::vector<std::vector<unsigned char> > vElements;
+    Array addresses = params[0].get_array();
+    BOOST_FOREACH(const Value& address, addresses)
+    {
+        CBitcoinAddress addr(address.get_str());
+        CScript script;
+        if (addr.IsValid())
+            script = GetScriptForDestination(addr.Get());
+        else if (IsHex(address.get_str()))
+        {
+            std::vector<unsigned char> data(ParseHex(address.get_str()));
+            script = CScript(data.begin(), data.end());
+        }
+        else
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Briliantcoin address or script: " + address.get_str());
+        vElements.push_back(std::vector<unsigned char>(script.begin(), script.end()));
+    }
+
+    int nStartHeight = 0;
+    if (params.size() > 1)
+        nStartHeight = params[1].get_int();
+
+    // Only hold cs_main while collecting the blocks, not while reading filters
+    std::vector<CBlockIndex*> vBlocks;
+    {
+        LOCK(cs_main);
+        if (nStartHeight < 0 || nStartHeight > chainActive.Height())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        for (CBlockIndex* pindex = chainActive[nStartHeight]; pindex; pindex = chainActive.Next(pindex))
+            vBlocks.push_back(pindex);
+    }
+
+    Array matches;
+    int nUnfiltered = 0;
+    BOOST_FOREACH(CBlockIndex* pindex, vBlocks)
+    {
+        CBloomFilter filter;
+        if (!ReadBlockFilter(pindex, filter))
+        {
+            nUnfiltered++;
+            continue;
+        }
+        BOOST_FOREACH(const std::vector<unsigned char>& vElement, vElements)
+        {
+            if (filter.contains(vElement))
+            {
+                Object match;
+                match.push_back(Pair("height", pindex->nHeight));
+                match.push_back(Pair("hash", pindex->GetBlockHash().GetHex()));
+                matches.push_back(match);
+                break;
+            }
+        }
+    }
+
+    Object ret;
+    ret.push_back(Pair("matches", matches));
+    ret.push_back(Pair("unfiltered", nUnfiltered));
+    return ret;
+}
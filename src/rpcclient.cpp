@@ -26,6 +26,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
 {
     { "stop", 0 },
     { "setmocktime", 0 },
+    { "getlockstats", 0 },
     { "getaddednodeinfo", 0 },
     { "setgenerate", 0 },
     { "setgenerate", 1 },
@@ -67,6 +68,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listunspent", 1 },
     { "listunspent", 2 },
     { "getblock", 1 },
+    { "getblocktimings", 0 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
     { "createrawtransaction", 0 },
@@ -88,6 +90,14 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "estimatepriority", 0 },
     { "prioritisetransaction", 1 },
     { "prioritisetransaction", 2 },
+    { "scanblockfilters", 0 },
+    { "scanblockfilters", 1 },
+    { "getaddresstxids", 0 },
+    { "getaddresstxids", 1 },
+    { "getaddresstxids", 2 },
+    { "getaddressbalance", 0 },
+    { "getaddressutxos", 0 },
+    { "getaddressmempool", 0 },
 };
 
 class CRPCConvertTable
@@ -52,15 +52,15 @@ Value GetNetworkHashPS(int lookup, int height) {
     if (lookup > pb->nHeight)
         lookup = pb->nHeight;
 
-    CBlockIndex *pb0 = pb;
-    int64_t minTime = pb0->GetBlockTime();
+    // Scan the timestamps from the chain array rather than walking pprev
+    int64_t minTime = pb->GetBlockTime();
     int64_t maxTime = minTime;
-    for (int i = 0; i < lookup; i++) {
-        pb0 = pb0->pprev;
-        int64_t time = pb0->GetBlockTime();
+    for (int nHeight = pb->nHeight - lookup; nHeight < pb->nHeight; nHeight++) {
+        int64_t time = chainActive.GetBlockTime(nHeight);
         minTime = std::min(time, minTime);
         maxTime = std::max(time, maxTime);
     }
+    CBlockIndex *pb0 = chainActive[pb->nHeight - lookup];
 
     // In case there's a situation where minTime == maxTime, we don't want a divide by zero exception.
     if (minTime == maxTime)
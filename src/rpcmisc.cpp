@@ -184,15 +184,19 @@ Value validateaddress(const Array& params, bool fHelp)
         string currentAddress = address.ToString();
         ret.push_back(Pair("address", currentAddress));
 #ifdef ENABLE_WALLET
-        isminetype mine = pwalletMain ? IsMine(*pwalletMain, dest) : ISMINE_NO;
-        ret.push_back(Pair("ismine", (mine & ISMINE_SPENDABLE) ? true : false));
-        if (mine != ISMINE_NO) {
-            ret.push_back(Pair("iswatchonly", (mine & ISMINE_WATCH_ONLY) ? true: false));
-            Object detail = boost::apply_visitor(DescribeAddressVisitor(mine), dest);
-            ret.insert(ret.end(), detail.begin(), detail.end());
-        }
-        if (pwalletMain && pwalletMain->mapAddressBook.count(dest))
-            ret.push_back(Pair("account", pwalletMain->mapAddressBook[dest].name));
+        if (pwalletMain) {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            isminetype mine = IsMine(*pwalletMain, dest);
+            ret.push_back(Pair("ismine", (mine & ISMINE_SPENDABLE) ? true : false));
+            if (mine != ISMINE_NO) {
+                ret.push_back(Pair("iswatchonly", (mine & ISMINE_WATCH_ONLY) ? true: false));
+                Object detail = boost::apply_visitor(DescribeAddressVisitor(mine), dest);
+                ret.insert(ret.end(), detail.begin(), detail.end());
+            }
+            if (pwalletMain->mapAddressBook.count(dest))
+                ret.push_back(Pair("account", pwalletMain->mapAddressBook[dest].name));
+        } else
+            ret.push_back(Pair("ismine", false));
 #endif
     }
     return ret;
@@ -376,3 +380,327 @@ Value setmocktime(const Array& params, bool fHelp)
 
     return Value::null;
 }
+
+static Array LockStatsHistogram(const uint64_t* pnHistogram)
+{
+    // Trailing empty buckets are left out
+    int nBuckets = LOCKSTATS_HISTOGRAM_BUCKETS;
+    while (nBuckets > 0 && pnHistogram[nBuckets - 1] == 0)
+        nBuckets--;
+    Array histogram;
+    for (int i = 0; i < nBuckets; i++)
+        histogram.push_back((uint64_t)pnHistogram[i]);
+    return histogram;
+}
+
+Value getlockstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockstats ( reset )\n"
+            "\nReturns lock acquisition statistics per LOCK site, most waited on first (requires -lockstats).\n"
+            "\nArguments:\n"
+            "1. reset    (boolean, optional, default=false) Clear the statistics after returning them\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"lock\": \"name\",          (string) The locked expression, e.g. cs_main\n"
+            "    \"location\": \"file:line\", (string) Where it is locked\n"
+            "    \"count\": n,              (numeric) Number of acquisitions\n"
+            "    \"contended\": n,          (numeric) Acquisitions that had to wait for another thread\n"
+            "    \"tryfailed\": n,          (numeric) TRY_LOCKs that did not get the lock\n"
+            "    \"waittotal\": n,          (numeric) Total time spent waiting, in microseconds\n"
+            "    \"waitmax\": n,            (numeric) Longest wait, in microseconds\n"
+            "    \"holdtotal\": n,          (numeric) Total time the lock was held from here, in microseconds\n"
+            "    \"holdmax\": n,            (numeric) Longest hold, in microseconds\n"
+            "    \"waithistogram\": [n,...] (array) Number of waits under 1us, then in [2^(i-1), 2^i) us for bucket i\n"
+            "    \"holdhistogram\": [n,...] (array) Number of holds, bucketed like waithistogram\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleRpc("getlockstats", "true")
+        );
+
+    if (!fLockStats)
+        throw JSONRPCError(RPC_MISC_ERROR, "Lock statistics are not enabled, use -lockstats");
+
+    std::vector<CLockSiteStats> vStats = GetLockStats();
+    if (params.size() > 0 && params[0].get_bool())
+        ResetLockStats();
+
+    Array ret;
+    BOOST_FOREACH(const CLockSiteStats& site, vStats)
+    {
+        Object obj;
+        obj.push_back(Pair("lock", site.pszName));
+        obj.push_back(Pair("location", strprintf("%s:%d", site.pszFile, site.nLine)));
+        obj.push_back(Pair("count", (uint64_t)site.nCount));
+        obj.push_back(Pair("contended", (uint64_t)site.nContended));
+        obj.push_back(Pair("tryfailed", (uint64_t)site.nTryFailed));
+        obj.push_back(Pair("waittotal", 0.001 * site.nWaitTotal));
+        obj.push_back(Pair("waitmax", 0.001 * site.nWaitMax));
+        obj.push_back(Pair("holdtotal", 0.001 * site.nHoldTotal));
+        obj.push_back(Pair("holdmax", 0.001 * site.nHoldMax));
+        obj.push_back(Pair("waithistogram", LockStatsHistogram(site.nWaitHistogram)));
+        obj.push_back(Pair("holdhistogram", LockStatsHistogram(site.nHoldHistogram)));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
+static void ParseAddressIndexAddresses(const Value& param, std::vector<std::pair<uint160, unsigned char> >& addresses)
+{
+    BOOST_FOREACH(const Value& address, param.get_array())
+    {
+        CBitcoinAddress addr(address.get_str());
+        unsigned char type;
+        uint160 hashBytes;
+        if (!addr.IsValid() || !GetAddressIndexKey(GetScriptForDestination(addr.Get()), type, hashBytes))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Briliantcoin address: " + address.get_str());
+        addresses.push_back(std::make_pair(hashBytes, type));
+    }
+}
+
+static std::string AddressFromIndexKey(unsigned char type, const uint160& hashBytes)
+{
+    if (type == ADDRESS_INDEX_SCRIPTHASH)
+        return CBitcoinAddress(CScriptID(hashBytes)).ToString();
+    return CBitcoinAddress(CKeyID(hashBytes)).ToString();
+}
+
+static void EnsureAddressIndex()
+{
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is not enabled, use -addressindex");
+}
+
+Value getaddresstxids(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddresstxids [\"address\",...] ( startheight endheight )\n"
+            "\nReturns the txids of the confirmed transactions paying to or spending from the given addresses\n"
+            "(requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"addresses\"   (string, required) A json array of briliantcoin addresses\n"
+            "2. startheight     (numeric, optional, default=0) The block height to start at\n"
+            "3. endheight       (numeric, optional, default=0) The block height to end at, 0 for the chain tip\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"transactionid\"  (string) The transaction id, in chain order\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresstxids", "\"[\\\"myaddress\\\"]\"")
+            + HelpExampleRpc("getaddresstxids", "[\"myaddress\"], 100000, 200000")
+        );
+
+    EnsureAddressIndex();
+
+    std::vector<std::pair<uint160, unsigned char> > addresses;
+    ParseAddressIndexAddresses(params[0], addresses);
+
+    int nStart = 0, nEnd = 0;
+    if (params.size() > 1)
+        nStart = params[1].get_int();
+    if (params.size() > 2)
+        nEnd = params[2].get_int();
+    if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid height range");
+
+    // Ordered by (height, position in block); a txid shows up once even if it
+    // touches several of the addresses
+    std::set<std::pair<std::pair<int, unsigned int>, uint256> > setTxids;
+    {
+        // Blocks are indexed under cs_main, so all addresses are read at the same tip
+        LOCK(cs_main);
+        for (std::vector<std::pair<uint160, unsigned char> >::const_iterator it = addresses.begin(); it != addresses.end(); it++)
+        {
+            std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+            if (!GetAddressIndex(it->second, it->first, addressIndex, nStart, nEnd))
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+            for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator ait = addressIndex.begin(); ait != addressIndex.end(); ait++)
+                setTxids.insert(std::make_pair(std::make_pair(ait->first.blockHeight, ait->first.txindex), ait->first.txhash));
+        }
+    }
+
+    Array result;
+    std::set<uint256> setSeen;
+    for (std::set<std::pair<std::pair<int, unsigned int>, uint256> >::const_iterator it = setTxids.begin(); it != setTxids.end(); it++)
+        if (setSeen.insert(it->second).second)
+            result.push_back(it->second.GetHex());
+
+    return result;
+}
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance [\"address\",...]\n"
+            "\nReturns the confirmed balance of the given addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"addresses\"   (string, required) A json array of briliantcoin addresses\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\": n,    (numeric) The current balance in satoshis\n"
+            "  \"received\": n    (numeric) The total number of satoshis received, including change\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"[\\\"myaddress\\\"]\"")
+            + HelpExampleRpc("getaddressbalance", "[\"myaddress\"]")
+        );
+
+    EnsureAddressIndex();
+
+    std::vector<std::pair<uint160, unsigned char> > addresses;
+    ParseAddressIndexAddresses(params[0], addresses);
+
+    CAmount nBalance = 0;
+    CAmount nReceived = 0;
+    {
+        LOCK(cs_main);
+        for (std::vector<std::pair<uint160, unsigned char> >::const_iterator it = addresses.begin(); it != addresses.end(); it++)
+        {
+            std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+            if (!GetAddressIndex(it->second, it->first, addressIndex))
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+            for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator ait = addressIndex.begin(); ait != addressIndex.end(); ait++)
+            {
+                if (ait->second > 0)
+                    nReceived += ait->second;
+                nBalance += ait->second;
+            }
+        }
+    }
+
+    Object result;
+    result.push_back(Pair("balance", nBalance));
+    result.push_back(Pair("received", nReceived));
+    return result;
+}
+
+static bool CompareUnspentByHeight(const std::pair<CAddressUnspentKey, CAddressUnspentValue>& a,
+                                   const std::pair<CAddressUnspentKey, CAddressUnspentValue>& b)
+{
+    return a.second.blockHeight < b.second.blockHeight;
+}
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos [\"address\",...]\n"
+            "\nReturns the confirmed unspent outputs paying to the given addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"addresses\"   (string, required) A json array of briliantcoin addresses\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\": \"address\",   (string) The address\n"
+            "    \"txid\": \"transactionid\", (string) The transaction id\n"
+            "    \"outputIndex\": n,        (numeric) The output index\n"
+            "    \"script\": \"hex\",         (string) The hex-encoded output script\n"
+            "    \"satoshis\": n,           (numeric) The output value in satoshis\n"
+            "    \"height\": n              (numeric) The height of the block containing the transaction\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "\"[\\\"myaddress\\\"]\"")
+            + HelpExampleRpc("getaddressutxos", "[\"myaddress\"]")
+        );
+
+    EnsureAddressIndex();
+
+    std::vector<std::pair<uint160, unsigned char> > addresses;
+    ParseAddressIndexAddresses(params[0], addresses);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    {
+        LOCK(cs_main);
+        for (std::vector<std::pair<uint160, unsigned char> >::const_iterator it = addresses.begin(); it != addresses.end(); it++)
+            if (!GetAddressUnspent(it->second, it->first, unspentOutputs))
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+    }
+
+    std::stable_sort(unspentOutputs.begin(), unspentOutputs.end(), CompareUnspentByHeight);
+
+    Array result;
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = unspentOutputs.begin(); it != unspentOutputs.end(); it++)
+    {
+        Object output;
+        output.push_back(Pair("address", AddressFromIndexKey(it->first.type, it->first.hashBytes)));
+        output.push_back(Pair("txid", it->first.txhash.GetHex()));
+        output.push_back(Pair("outputIndex", (int)it->first.index));
+        output.push_back(Pair("script", HexStr(it->second.script.begin(), it->second.script.end())));
+        output.push_back(Pair("satoshis", it->second.satoshis));
+        output.push_back(Pair("height", it->second.blockHeight));
+        result.push_back(output);
+    }
+
+    return result;
+}
+
+static bool CompareMempoolDeltaByTime(const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& a,
+                                      const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& b)
+{
+    return a.second.time < b.second.time;
+}
+
+Value getaddressmempool(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressmempool [\"address\",...]\n"
+            "\nReturns the outputs paid to and spent from the given addresses by mempool transactions\n"
+            "(requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"addresses\"   (string, required) A json array of briliantcoin addresses\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\": \"address\",     (string) The address\n"
+            "    \"txid\": \"transactionid\",   (string) The mempool transaction id\n"
+            "    \"index\": n,                (numeric) The output index, or the input index for spends\n"
+            "    \"satoshis\": n,             (numeric) The amount in satoshis, negative for spends\n"
+            "    \"timestamp\": n,            (numeric) The time the transaction entered the mempool\n"
+            "    \"prevtxid\": \"transactionid\", (string, spends only) The transaction id of the spent output\n"
+            "    \"prevout\": n               (numeric, spends only) The index of the spent output\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressmempool", "\"[\\\"myaddress\\\"]\"")
+            + HelpExampleRpc("getaddressmempool", "[\"myaddress\"]")
+        );
+
+    EnsureAddressIndex();
+
+    std::vector<std::pair<uint160, unsigned char> > addresses;
+    ParseAddressIndexAddresses(params[0], addresses);
+
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > indexes;
+    mempool.getAddressIndex(addresses, indexes);
+    std::stable_sort(indexes.begin(), indexes.end(), CompareMempoolDeltaByTime);
+
+    Array result;
+    for (std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> >::const_iterator it = indexes.begin(); it != indexes.end(); it++)
+    {
+        Object delta;
+        delta.push_back(Pair("address", AddressFromIndexKey(it->first.type, it->first.hashBytes)));
+        delta.push_back(Pair("txid", it->first.txhash.GetHex()));
+        delta.push_back(Pair("index", (int)it->first.index));
+        delta.push_back(Pair("satoshis", it->second.amount));
+        delta.push_back(Pair("timestamp", it->second.time));
+        if (it->first.fSpending) {
+            delta.push_back(Pair("prevtxid", it->second.prevhash.GetHex()));
+            delta.push_back(Pair("prevout", (int)it->second.prevout));
+        }
+        result.push_back(delta);
+    }
+
+    return result;
+}
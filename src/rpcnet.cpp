@@ -73,6 +73,27 @@ static void CopyNodeStats(std::vector<CNodeStats>& vstats)
     }
 }
 
+static Object MsgTypeStatsToJSON(const mapMsgTypeStats_t& mapMsgStats)
+{
+    Object ret;
+    for (mapMsgTypeStats_t::const_iterator it = mapMsgStats.begin(); it != mapMsgStats.end(); ++it)
+    {
+        const CNetMsgTypeStats& stats = it->second;
+        Object obj;
+        obj.push_back(Pair("msgsrecv", stats.nMsgsRecv));
+        obj.push_back(Pair("bytesrecv", stats.nBytesRecv));
+        obj.push_back(Pair("msgssent", stats.nMsgsSent));
+        obj.push_back(Pair("bytessent", stats.nBytesSent));
+        obj.push_back(Pair("msgsprocessed", stats.nMsgsProcessed));
+        obj.push_back(Pair("processtime", stats.nProcessTime / 1e6));
+        obj.push_back(Pair("processtimemax", stats.nProcessTimeMax / 1e6));
+        obj.push_back(Pair("queuetime", stats.nQueueTime / 1e6));
+        obj.push_back(Pair("queuetimemax", stats.nQueueTimeMax / 1e6));
+        ret.push_back(Pair(it->first, obj));
+    }
+    return ret;
+}
+
 Value getpeerinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -103,7 +124,9 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"msgstats\": { ... }        (object) Traffic and processing time per message type, see getnetmsgstats\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -152,6 +175,7 @@ Value getpeerinfo(const Array& params, bool fHelp)
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("msgstats", MsgTypeStatsToJSON(stats.mapMsgStats)));
 
         ret.push_back(obj);
     }
@@ -351,6 +375,36 @@ Value getnettotals(const Array& params, bool fHelp)
     return obj;
 }
 
+Value getnetmsgstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getnetmsgstats\n"
+            "\nReturns traffic and processing time per P2P message type, summed over all peers since startup.\n"
+            "Commands we do not know are counted as \"" + std::string(NET_MESSAGE_TYPE_OTHER) + "\".\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"command\": {            (object) The message type, e.g. inv or block\n"
+            "    \"msgsrecv\": n,        (numeric) Messages received\n"
+            "    \"bytesrecv\": n,       (numeric) Bytes received, including message headers\n"
+            "    \"msgssent\": n,        (numeric) Messages sent\n"
+            "    \"bytessent\": n,       (numeric) Bytes sent, including message headers\n"
+            "    \"msgsprocessed\": n,   (numeric) Received messages that were processed\n"
+            "    \"processtime\": n,     (numeric) Total time spent processing them, in seconds\n"
+            "    \"processtimemax\": n,  (numeric) Longest time spent processing one, in seconds\n"
+            "    \"queuetime\": n,       (numeric) Total time they waited between being received and processed, in seconds\n"
+            "    \"queuetimemax\": n     (numeric) Longest time one waited, in seconds\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnetmsgstats", "")
+            + HelpExampleRpc("getnetmsgstats", "")
+       );
+
+    return MsgTypeStatsToJSON(CNode::GetTotalMsgStats());
+}
+
 static Array GetNetworksInfo()
 {
     Array networks;
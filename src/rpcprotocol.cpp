@@ -70,6 +70,7 @@ static const char *httpStatusDescription(int nStatus)
         case HTTP_FORBIDDEN: return "Forbidden";
         case HTTP_NOT_FOUND: return "Not Found";
         case HTTP_INTERNAL_SERVER_ERROR: return "Internal Server Error";
+        case HTTP_SERVICE_UNAVAILABLE: return "Service Unavailable";
         default: return "";
     }
 }
@@ -117,6 +118,24 @@ string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const
         FormatFullVersion());
 }
 
+string HTTPReplyHeaderChunked(int nStatus, bool keepalive, const char *contentType)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: %s\r\n"
+            "Server: briliantcoin-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        httpStatusDescription(nStatus),
+        rfc1123Time(),
+        keepalive ? "keep-alive" : "close",
+        contentType,
+        FormatFullVersion());
+}
+
 string HTTPReply(int nStatus, const string& strMsg, bool keepalive,
                  bool headersOnly, const char *contentType)
 {
@@ -204,6 +223,19 @@ int ReadHTTPHeaders(std::basic_istream<char>& stream, map<string, string>& mapHe
 }
 
 
+static void SetDefaultConnectionHeader(map<string, string>& mapHeaders, int nProto)
+{
+    string sConHdr = mapHeaders["connection"];
+
+    if ((sConHdr != "close") && (sConHdr != "keep-alive"))
+    {
+        if (nProto >= 1)
+            mapHeaders["connection"] = "keep-alive";
+        else
+            mapHeaders["connection"] = "close";
+    }
+}
+
 int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
                     string>& mapHeadersRet, string& strMessageRet,
                     int nProto, size_t max_size)
@@ -217,7 +249,31 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0)
+    if (mapHeadersRet["transfer-encoding"] == "chunked")
+    {
+        while (true)
+        {
+            string str;
+            std::getline(stream, str);
+            if (!stream)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t nChunk = strtoul(str.c_str(), NULL, 16);
+            if (nChunk == 0)
+                break;
+            if (nChunk > max_size - strMessageRet.size())
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t ptr = strMessageRet.size();
+            strMessageRet.resize(ptr + nChunk);
+            stream.read(&strMessageRet[ptr], nChunk);
+            std::getline(stream, str); // CRLF after the chunk data
+            if (!stream)
+                return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        // Skip trailer headers
+        map<string, string> mapTrailers;
+        ReadHTTPHeaders(stream, mapTrailers);
+    }
+    else if (nLen > 0)
     {
         vector<char> vch;
         size_t ptr = 0;
@@ -233,17 +289,103 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         strMessageRet = string(vch.begin(), vch.end());
     }
 
-    string sConHdr = mapHeadersRet["connection"];
+    SetDefaultConnectionHeader(mapHeadersRet, nProto);
 
-    if ((sConHdr != "close") && (sConHdr != "keep-alive"))
+    return HTTP_OK;
+}
+
+void HTTPRequestParser::Feed(const char* pch, size_t nSize)
+{
+    // Drop already consumed requests before the buffer grows
+    if (nOffset > 0 && nOffset >= strBuffer.size() / 2)
     {
-        if (nProto >= 1)
-            mapHeadersRet["connection"] = "keep-alive";
-        else
-            mapHeadersRet["connection"] = "close";
+        strBuffer.erase(0, nOffset);
+        nOffset = 0;
     }
+    strBuffer.append(pch, nSize);
+}
 
-    return HTTP_OK;
+void HTTPChunkedStreamBuf::WriteChunk()
+{
+    if (!fStarted)
+    {
+        stream << strHeader;
+        fStarted = true;
+    }
+    if (!strChunk.empty())
+    {
+        stream << strprintf("%x\r\n", strChunk.size()) << strChunk << "\r\n";
+        strChunk.clear();
+    }
+    stream.flush();
+}
+
+void HTTPChunkedStreamBuf::Finish()
+{
+    WriteChunk();
+    stream << "0\r\n\r\n" << std::flush;
+}
+
+int HTTPChunkedStreamBuf::overflow(int c)
+{
+    if (c != EOF)
+    {
+        strChunk.push_back((char)c);
+        if (strChunk.size() >= HTTP_CHUNK_SIZE)
+            WriteChunk();
+    }
+    return c;
+}
+
+std::streamsize HTTPChunkedStreamBuf::xsputn(const char* pch, std::streamsize n)
+{
+    strChunk.append(pch, n);
+    if (strChunk.size() >= HTTP_CHUNK_SIZE)
+        WriteChunk();
+    return n;
+}
+
+HTTPRequestParser::State HTTPRequestParser::Next(int& nProto, string& strMethod, string& strURI,
+                                                 map<string, string>& mapHeaders, string& strBody)
+{
+    // Skip blank lines between requests, some clients send a stray CRLF after a body
+    while (nOffset < strBuffer.size() && (strBuffer[nOffset] == '\r' || strBuffer[nOffset] == '\n'))
+        nOffset++;
+
+    // The header block ends at the first empty line
+    size_t nHeaderEnd = string::npos;
+    size_t nLineStart = nOffset;
+    while (true)
+    {
+        size_t nLineEnd = strBuffer.find('\n', nLineStart);
+        if (nLineEnd == string::npos)
+            break;
+        if (nLineEnd == nLineStart || (nLineEnd == nLineStart + 1 && strBuffer[nLineStart] == '\r'))
+        {
+            nHeaderEnd = nLineEnd + 1;
+            break;
+        }
+        nLineStart = nLineEnd + 1;
+    }
+    if (nHeaderEnd == string::npos)
+        return BufferedSize() > MAX_HTTP_HEADERS_SIZE ? INVALID : NEED_MORE;
+    if (nHeaderEnd - nOffset > MAX_HTTP_HEADERS_SIZE)
+        return INVALID;
+
+    std::istringstream ssHeaders(strBuffer.substr(nOffset, nHeaderEnd - nOffset));
+    if (!ReadHTTPRequestLine(ssHeaders, nProto, strMethod, strURI))
+        return INVALID;
+    mapHeaders.clear();
+    int nLen = ReadHTTPHeaders(ssHeaders, mapHeaders);
+    if (nLen < 0 || (size_t)nLen > nMaxBody)
+        return INVALID;
+    if (strBuffer.size() - nHeaderEnd < (size_t)nLen)
+        return NEED_MORE;
+
+    strBody = strBuffer.substr(nHeaderEnd, nLen);
+    nOffset = nHeaderEnd + nLen;
+    SetDefaultConnectionHeader(mapHeaders, nProto);
+    return COMPLETE;
 }
 
 /**
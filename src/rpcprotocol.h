@@ -155,12 +155,80 @@ std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength,
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive,
                       bool headerOnly = false,
                       const char *contentType = "application/json");
+std::string HTTPReplyHeaderChunked(int nStatus, bool keepalive,
+                      const char *contentType = "application/json");
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
 int ReadHTTPHeaders(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet);
 int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet,
                     std::string& strMessageRet, int nProto, size_t max_size);
+
+//! Amount of streamed reply data collected before it is sent as one chunk
+static const size_t HTTP_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Output stream buffer that frames everything written through it as HTTP/1.1
+ * chunks on the underlying stream. The reply header is only written together
+ * with the first chunk, so a handler that fails before producing any output
+ * can still send an ordinary error reply instead.
+ */
+class HTTPChunkedStreamBuf : public std::streambuf
+{
+public:
+    HTTPChunkedStreamBuf(std::ostream& streamIn, const std::string& strHeaderIn) :
+        stream(streamIn), strHeader(strHeaderIn), fStarted(false) {}
+
+    //! Whether any part of the reply has been passed on
+    bool Started() const { return fStarted; }
+    //! Send what is buffered followed by the terminating chunk
+    void Finish();
+
+protected:
+    int overflow(int c);
+    std::streamsize xsputn(const char* pch, std::streamsize n);
+
+private:
+    void WriteChunk();
+
+    std::ostream& stream;
+    std::string strHeader;
+    std::string strChunk;
+    bool fStarted;
+};
+
+//! Maximum size of the request line plus headers of an HTTP request
+static const size_t MAX_HTTP_HEADERS_SIZE = 8192;
+
+/**
+ * Incremental HTTP request parser for the non-blocking RPC server.
+ * Bytes are fed as they arrive from the socket and complete requests are
+ * taken off the front of the buffer one at a time, so pipelined requests
+ * are returned in the order they were sent.
+ */
+class HTTPRequestParser
+{
+public:
+    enum State
+    {
+        NEED_MORE, //!< no complete request buffered yet
+        COMPLETE,  //!< a request was returned and removed from the buffer
+        INVALID,   //!< malformed or oversized request; drop the connection
+    };
+
+    HTTPRequestParser(size_t nMaxBodyIn) : nOffset(0), nMaxBody(nMaxBodyIn) {}
+
+    void Feed(const char* pch, size_t nSize);
+    State Next(int& nProto, std::string& strMethod, std::string& strURI,
+               std::map<std::string, std::string>& mapHeaders, std::string& strBody);
+    //! Bytes received but not yet returned as part of a request
+    size_t BufferedSize() const { return strBuffer.size() - nOffset; }
+
+private:
+    std::string strBuffer;
+    size_t nOffset;
+    size_t nMaxBody;
+};
 std::string JSONRPCRequest(const std::string& strMethod, const json_spirit::Array& params, const json_spirit::Value& id);
 json_spirit::Object JSONRPCReplyObj(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 std::string JSONRPCReply(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
@@ -189,6 +189,7 @@ Value getrawtransaction(const Array& params, bool fHelp)
 
     Object result;
     result.push_back(Pair("hex", strHex));
+    LOCK(cs_main);
     TxToJSON(tx, hashBlock, result);
     return result;
 }
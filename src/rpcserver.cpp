@@ -8,7 +8,9 @@
 #include "base58.h"
 #include "init.h"
 #include "main.h"
+#include "metrics.h"
 #include "ui_interface.h"
+#include "univalue/univalue.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet.h"
@@ -18,6 +20,7 @@
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/iostreams/concepts.hpp>
@@ -240,113 +243,124 @@ Value stop(const Array& params, bool fHelp)
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode threadSafe reqWallet
-  //  --------------------- ------------------------  -----------------------  ---------- ---------- ---------
+{ //  category              name                      actor (function)         okSafeMode threadSafe reqWallet  parallelSafe
+  //  --------------------- ------------------------  -----------------------  ---------- ---------- ---------- ------------
     /* Overall control/query calls */
-    { "control",            "getinfo",                &getinfo,                true,      false,      false }, /* uses wallet if enabled */
-    { "control",            "help",                   &help,                   true,      true,       false },
-    { "control",            "stop",                   &stop,                   true,      true,       false },
+    { "control",            "getinfo",                &getinfo,                true,      false,      false,     false }, /* uses wallet if enabled */
+    { "control",            "getlockstats",           &getlockstats,           true,      true,       false,     false },
+    { "control",            "help",                   &help,                   true,      true,       false,     false },
+    { "control",            "stop",                   &stop,                   true,      true,       false,     false },
 
     /* P2P networking */
-    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      false,      false },
-    { "network",            "addnode",                &addnode,                true,      true,       false },
-    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      true,       false },
-    { "network",            "getconnectioncount",     &getconnectioncount,     true,      false,      false },
-    { "network",            "getnettotals",           &getnettotals,           true,      true,       false },
-    { "network",            "getpeerinfo",            &getpeerinfo,            true,      false,      false },
-    { "network",            "ping",                   &ping,                   true,      false,      false },
+    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      false,      false,     false },
+    { "network",            "addnode",                &addnode,                true,      true,       false,     false },
+    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      true,       false,     false },
+    { "network",            "getconnectioncount",     &getconnectioncount,     true,      false,      false,     false },
+    { "network",            "getnettotals",           &getnettotals,           true,      true,       false,     false },
+    { "network",            "getnetmsgstats",         &getnetmsgstats,         true,      true,       false,     false },
+    { "network",            "getpeerinfo",            &getpeerinfo,            true,      false,      false,     false },
+    { "network",            "ping",                   &ping,                   true,      false,      false,     false },
 
     /* Block chain and UTXO */
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      false,      false },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      false,      false },
-    { "blockchain",         "getblockcount",          &getblockcount,          true,      false,      false },
-    { "blockchain",         "getblock",               &getblock,               true,      false,      false },
-    { "blockchain",         "getblockhash",           &getblockhash,           true,      false,      false },
-    { "blockchain",         "getchaintips",           &getchaintips,           true,      false,      false },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      false,      false },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false },
-    { "blockchain",         "gettxout",               &gettxout,               true,      false,      false },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
-    { "blockchain",         "verifychain",            &verifychain,            true,      false,      false },
-    { "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false },
-    { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      false,      false,     false },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      true,       false,     true },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,      true,       false,     true },
+    { "blockchain",         "getblock",               &getblock,               true,      true,       false,     true },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,      true,       false,     true },
+    { "blockchain",         "getblocktimings",        &getblocktimings,        true,      true,       false,     false },
+    { "blockchain",         "getchaintips",           &getchaintips,           true,      false,      false,     false },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      false,      false,     false },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false,     false },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false,     false },
+    { "blockchain",         "gettxout",               &gettxout,               true,      true,       false,     true },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false,     false },
+    { "blockchain",         "savemempool",            &savemempool,            true,      true,       false,     false },
+    { "blockchain",         "verifychain",            &verifychain,            true,      false,      false,     false },
+    { "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false,     false },
+    { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false,     false },
+    { "blockchain",         "scanblockfilters",       &scanblockfilters,       true,      true,       false,     false },
+
+    /* Address index */
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      true,      true,       false,     true },
+    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true,      true,       false,     true },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        true,      true,       false,     true },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        true,      true,       false,     true },
 
     /* Mining */
-    { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false,      false },
-    { "mining",             "getmininginfo",          &getmininginfo,          true,      false,      false },
-    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      false,      false },
-    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      false,      false },
-    { "mining",             "submitblock",            &submitblock,            true,      true,       false },
+    { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false,      false,     false },
+    { "mining",             "getmininginfo",          &getmininginfo,          true,      false,      false,     false },
+    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      false,      false,     false },
+    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      false,      false,     false },
+    { "mining",             "submitblock",            &submitblock,            true,      true,       false,     false },
 
 #ifdef ENABLE_WALLET
     /* Coin generation */
-    { "generating",         "getgenerate",            &getgenerate,            true,      false,      false },
-    { "generating",         "gethashespersec",        &gethashespersec,        true,      false,      false },
-    { "generating",         "setgenerate",            &setgenerate,            true,      true,       false },
+    { "generating",         "getgenerate",            &getgenerate,            true,      false,      false,     false },
+    { "generating",         "gethashespersec",        &gethashespersec,        true,      false,      false,     false },
+    { "generating",         "setgenerate",            &setgenerate,            true,      true,       false,     false },
 #endif
 
     /* Raw transactions */
-    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      false,      false },
-    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      false,      false },
-    { "rawtransactions",    "decodescript",           &decodescript,           true,      false,      false },
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      false,      false },
-    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false,     false,      false },
-    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     false,      false }, /* uses wallet if enabled */
+    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      false,      false,     false },
+    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      true,       false,     true },
+    { "rawtransactions",    "decodescript",           &decodescript,           true,      false,      false,     false },
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      true,       false,     true },
+    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false,     false,      false,     false },
+    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     false,      false,     false }, /* uses wallet if enabled */
 
     /* Utility functions */
-    { "util",               "createmultisig",         &createmultisig,         true,      true ,      false },
-    { "util",               "validateaddress",        &validateaddress,        true,      false,      false }, /* uses wallet if enabled */
-    { "util",               "verifymessage",          &verifymessage,          true,      false,      false },
-    { "util",               "estimatefee",            &estimatefee,            true,      true,       false },
-    { "util",               "estimatepriority",       &estimatepriority,       true,      true,       false },
+    { "util",               "createmultisig",         &createmultisig,         true,      true ,      false,     false },
+    { "util",               "validateaddress",        &validateaddress,        true,      true,       false,     true }, /* uses wallet if enabled */
+    { "util",               "verifymessage",          &verifymessage,          true,      false,      false,     false },
+    { "util",               "estimatefee",            &estimatefee,            true,      true,       false,     false },
+    { "util",               "estimatepriority",       &estimatepriority,       true,      true,       false,     false },
 
     /* Not shown in help */
-    { "hidden",             "invalidateblock",        &invalidateblock,        true,      true,       false },
-    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,      true,       false },
-    { "hidden",             "setmocktime",            &setmocktime,            true,      false,      false },
+    { "hidden",             "invalidateblock",        &invalidateblock,        true,      true,       false,     false },
+    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,      true,       false,     false },
+    { "hidden",             "setmocktime",            &setmocktime,            true,      false,      false,     false },
 
 #ifdef ENABLE_WALLET
     /* Wallet */
-    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true,      false,      true },
-    { "wallet",             "backupwallet",           &backupwallet,           true,      false,      true },
-    { "wallet",             "dumpprivkey",            &dumpprivkey,            true,      false,      true },
-    { "wallet",             "dumpwallet",             &dumpwallet,             true,      false,      true },
-    { "wallet",             "encryptwallet",          &encryptwallet,          true,      false,      true },
-    { "wallet",             "getaccountaddress",      &getaccountaddress,      true,      false,      true },
-    { "wallet",             "getaccount",             &getaccount,             true,      false,      true },
-    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,      true },
-    { "wallet",             "getbalance",             &getbalance,             false,     false,      true },
-    { "wallet",             "getnewaddress",          &getnewaddress,          true,      false,      true },
-    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true,      false,      true },
-    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,      true },
-    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,      true },
-    { "wallet",             "gettransaction",         &gettransaction,         false,     false,      true },
-    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false,     false,      true },
-    { "wallet",             "getwalletinfo",          &getwalletinfo,          false,     false,      true },
-    { "wallet",             "importprivkey",          &importprivkey,          true,      false,      true },
-    { "wallet",             "importwallet",           &importwallet,           true,      false,      true },
-    { "wallet",             "importaddress",          &importaddress,          true,      false,      true },
-    { "wallet",             "keypoolrefill",          &keypoolrefill,          true,      false,      true },
-    { "wallet",             "listaccounts",           &listaccounts,           false,     false,      true },
-    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false,     false,      true },
-    { "wallet",             "listlockunspent",        &listlockunspent,        false,     false,      true },
-    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,      true },
-    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,      true },
-    { "wallet",             "listsinceblock",         &listsinceblock,         false,     false,      true },
-    { "wallet",             "listtransactions",       &listtransactions,       false,     false,      true },
-    { "wallet",             "listunspent",            &listunspent,            false,     false,      true },
-    { "wallet",             "lockunspent",            &lockunspent,            true,      false,      true },
-    { "wallet",             "move",                   &movecmd,                false,     false,      true },
-    { "wallet",             "sendfrom",               &sendfrom,               false,     false,      true },
-    { "wallet",             "sendmany",               &sendmany,               false,     false,      true },
-    { "wallet",             "sendtoaddress",          &sendtoaddress,          false,     false,      true },
-    { "wallet",             "setaccount",             &setaccount,             true,      false,      true },
-    { "wallet",             "settxfee",               &settxfee,               true,      false,      true },
-    { "wallet",             "signmessage",            &signmessage,            true,      false,      true },
-    { "wallet",             "walletlock",             &walletlock,             true,      false,      true },
-    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true,      false,      true },
-    { "wallet",             "walletpassphrase",       &walletpassphrase,       true,      false,      true },
+    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true,      false,      true,      false },
+    { "wallet",             "backupwallet",           &backupwallet,           true,      false,      true,      false },
+    { "wallet",             "dumpprivkey",            &dumpprivkey,            true,      false,      true,      false },
+    { "wallet",             "dumpwallet",             &dumpwallet,             true,      false,      true,      false },
+    { "wallet",             "encryptwallet",          &encryptwallet,          true,      false,      true,      false },
+    { "wallet",             "getaccountaddress",      &getaccountaddress,      true,      false,      true,      false },
+    { "wallet",             "getaccount",             &getaccount,             true,      false,      true,      false },
+    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,      true,      false },
+    { "wallet",             "getbalance",             &getbalance,             false,     false,      true,      false },
+    { "wallet",             "getnewaddress",          &getnewaddress,          true,      false,      true,      false },
+    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true,      false,      true,      false },
+    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,      true,      false },
+    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,      true,      false },
+    { "wallet",             "gettransaction",         &gettransaction,         false,     false,      true,      false },
+    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false,     false,      true,      false },
+    { "wallet",             "getwalletinfo",          &getwalletinfo,          false,     false,      true,      false },
+    { "wallet",             "importprivkey",          &importprivkey,          true,      true,       true,      false },
+    { "wallet",             "importwallet",           &importwallet,           true,      true,       true,      false },
+    { "wallet",             "importaddress",          &importaddress,          true,      true,       true,      false },
+    { "wallet",             "keypoolrefill",          &keypoolrefill,          true,      false,      true,      false },
+    { "wallet",             "listaccounts",           &listaccounts,           false,     false,      true,      false },
+    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false,     false,      true,      false },
+    { "wallet",             "listlockunspent",        &listlockunspent,        false,     false,      true,      false },
+    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,      true,      false },
+    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,      true,      false },
+    { "wallet",             "listsinceblock",         &listsinceblock,         false,     false,      true,      false },
+    { "wallet",             "listtransactions",       &listtransactions,       false,     false,      true,      false },
+    { "wallet",             "listunspent",            &listunspent,            false,     false,      true,      false },
+    { "wallet",             "lockunspent",            &lockunspent,            true,      false,      true,      false },
+    { "wallet",             "move",                   &movecmd,                false,     false,      true,      false },
+    { "wallet",             "sendfrom",               &sendfrom,               false,     false,      true,      false },
+    { "wallet",             "sendmany",               &sendmany,               false,     false,      true,      false },
+    { "wallet",             "sendtoaddress",          &sendtoaddress,          false,     false,      true,      false },
+    { "wallet",             "setaccount",             &setaccount,             true,      false,      true,      false },
+    { "wallet",             "settxfee",               &settxfee,               true,      false,      true,      false },
+    { "wallet",             "signmessage",            &signmessage,            true,      false,      true,      false },
+    { "wallet",             "walletlock",             &walletlock,             true,      false,      true,      false },
+    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true,      false,      true,      false },
+    { "wallet",             "walletpassphrase",       &walletpassphrase,       true,      false,      true,      false },
 #endif // ENABLE_WALLET
 };
 
@@ -423,17 +437,18 @@ bool ClientAllowed(const boost::asio::ip::address& address)
     return false;
 }
 
-template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+/**
+ * Reply stream handed to the request handlers in place of the socket. The
+ * handlers run on the -rpcthreads pool and never touch the connection;
+ * whatever they flush is queued for an asynchronous write on its strand.
+ */
+class HTTPReplyBuffer : public AcceptedConnection
 {
 public:
-    AcceptedConnectionImpl(
-            asio::io_service& io_service,
-            ssl::context &context,
-            bool fUseSSL) :
-        sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+    typedef boost::function<void(const std::string&)> SendFunc;
+
+    HTTPReplyBuffer(const std::string& strPeerIn, int nProtoIn, const SendFunc& send) :
+        strPeer(strPeerIn), nProto(nProtoIn), fClose(false), buf(send), _stream(&buf)
     {
     }
 
@@ -444,30 +459,428 @@ public:
 
     virtual std::string peer_address_to_string() const
     {
-        return peer.address().to_string();
+        return strPeer;
     }
 
     virtual void close()
     {
-        _stream.close();
+        fClose = true;
+    }
+
+    virtual bool chunked_allowed() const
+    {
+        return nProto >= 1;
+    }
+
+    std::string strPeer;
+    int nProto;
+    bool fClose;
+
+private:
+    class SendBuf : public std::stringbuf
+    {
+    public:
+        SendBuf(const SendFunc& sendIn) : send(sendIn) {}
+    protected:
+        int sync()
+        {
+            std::string str = this->str();
+            if (!str.empty())
+            {
+                send(str);
+                this->str("");
+            }
+            return 0;
+        }
+    private:
+        SendFunc send;
+    };
+
+    SendBuf buf;
+    std::iostream _stream;
+};
+
+/**
+ * Bounded queue of parsed requests, drained by the -rpcthreads handler pool.
+ * A connection only occupies a handler thread while one of its requests is
+ * executing, so idle keep-alive connections cost nothing but a socket.
+ */
+class RPCWorkQueue
+{
+public:
+    RPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fRunning(true) {}
+
+    //! Returns false if the queue is full or shutting down
+    bool Enqueue(const boost::function<void(void)>& func)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fRunning || queue.size() >= nMaxDepth)
+            return false;
+        queue.push_back(func);
+        cond.notify_one();
+        return true;
+    }
+
+    void Run()
+    {
+        while (true)
+        {
+            boost::function<void(void)> func;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (fRunning && queue.empty())
+                    cond.wait(lock);
+                if (!fRunning)
+                    return;
+                func = queue.front();
+                queue.pop_front();
+            }
+            func();
+        }
+    }
+
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = false;
+        cond.notify_all();
+    }
+
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque< boost::function<void(void)> > queue;
+    size_t nMaxDepth;
+    bool fRunning;
+};
+
+static RPCWorkQueue* rpc_work_queue = NULL;
+//! Helper threads for executing batch requests in parallel, see JSONRPCExecBatch
+static RPCWorkQueue* rpc_batch_queue = NULL;
+static int nRPCBatchHelpers = 0;
+
+//! Number of open RPC connections per client address, see -rpcmaxconnsperip
+static std::map<CNetAddr, int> mapRPCClientConnections;
+static CCriticalSection cs_rpcClients;
+
+static bool ServiceRequest(AcceptedConnection* conn, string& strURI, map<string, string>& mapHeaders,
+                           string& strRequest, bool fRun);
+
+/**
+ * A client connection serviced entirely by asynchronous reads and writes on
+ * the RPC io_service. Requests are parsed as bytes arrive, executed one at a
+ * time on the handler pool and answered in order, so pipelined requests work
+ * without holding a thread between them. All callbacks run on the strand.
+ */
+template <typename Protocol>
+class HTTPConnection : public boost::enable_shared_from_this< HTTPConnection<Protocol> >
+{
+public:
+    HTTPConnection(asio::io_service& io_service, ssl::context &context, bool fUseSSLIn) :
+        sslStream(io_service, context),
+        strand(io_service),
+        parser(MAX_SIZE),
+        fUseSSL(fUseSSLIn),
+        fCounted(false),
+        fReading(false),
+        fBusy(false),
+        fEOF(false),
+        fClosed(false),
+        fWriting(false),
+        fReplyDone(false),
+        fCloseAfterWrite(false),
+        nPendingBytes(0),
+        fAborted(false)
+    {
+        vchRead.resize(RPC_READ_BUFFER_SIZE);
+    }
+
+    ~HTTPConnection()
+    {
+        if (fCounted)
+        {
+            LOCK(cs_rpcClients);
+            if (--mapRPCClientConnections[addrClient] <= 0)
+                mapRPCClientConnections.erase(addrClient);
+        }
+    }
+
+    //! Count this connection against its client's limit; false if over the limit
+    bool Register(int nMaxPerClient)
+    {
+        addrClient = BoostAsioToCNetAddr(peer.address());
+        LOCK(cs_rpcClients);
+        int& nConnections = mapRPCClientConnections[addrClient];
+        if (nConnections >= nMaxPerClient)
+        {
+            if (nConnections == 0)
+                mapRPCClientConnections.erase(addrClient);
+            return false;
+        }
+        nConnections++;
+        fCounted = true;
+        return true;
+    }
+
+    void Start()
+    {
+        if (fUseSSL)
+            sslStream.async_handshake(ssl::stream_base::server,
+                strand.wrap(boost::bind(&HTTPConnection::HandleHandshake, this->shared_from_this(), _1)));
+        else
+            strand.post(boost::bind(&HTTPConnection::ContinueRead, this->shared_from_this()));
+    }
+
+    //! Send a final reply without reading anything from the client
+    void Refuse(const std::string& strReply)
+    {
+        strand.post(boost::bind(&HTTPConnection::Reply, this->shared_from_this(), strReply));
     }
 
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
-};
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            LogPrint("rpc", "%s: SSL handshake with %s failed: %s\n", __func__, peer.address().to_string(), error.message());
+            Close();
+            return;
+        }
+        ContinueRead();
+    }
+
+    /**
+     * Keep a read outstanding unless the peer is done sending. While a
+     * request is executing, reading stops once enough pipelined data is
+     * buffered so a client cannot queue unbounded work.
+     */
+    void ContinueRead()
+    {
+        if (fReading || fEOF || fClosed)
+            return;
+        if (fBusy && parser.BufferedSize() >= MAX_RPC_PIPELINE_BUFFER)
+            return;
+        fReading = true;
+        if (fUseSSL)
+            sslStream.async_read_some(asio::buffer(vchRead),
+                strand.wrap(boost::bind(&HTTPConnection::HandleRead, this->shared_from_this(), _1, _2)));
+        else
+            sslStream.next_layer().async_read_some(asio::buffer(vchRead),
+                strand.wrap(boost::bind(&HTTPConnection::HandleRead, this->shared_from_this(), _1, _2)));
+    }
+
+    void HandleRead(const boost::system::error_code& error, size_t nBytes)
+    {
+        fReading = false;
+        if (fClosed)
+            return;
+        if (error)
+        {
+            // A client may shut down its side after sending; still answer what it sent
+            if (error != asio::error::eof)
+            {
+                Close();
+                return;
+            }
+            fEOF = true;
+        }
+        else
+            parser.Feed(&vchRead[0], nBytes);
+        ProcessNext();
+        ContinueRead();
+    }
 
-void ServiceConnection(AcceptedConnection *conn);
+    //! Hand the next buffered request to the handler pool, if none is executing
+    void ProcessNext()
+    {
+        if (fBusy || fClosed)
+            return;
+        if (ShutdownRequested())
+        {
+            Close();
+            return;
+        }
+
+        int nProto = 0;
+        string strMethod, strURI, strRequest;
+        map<string, string> mapHeaders;
+        HTTPRequestParser::State state = parser.Next(nProto, strMethod, strURI, mapHeaders, strRequest);
+        if (state == HTTPRequestParser::INVALID)
+        {
+            Reply(HTTPError(HTTP_BAD_REQUEST, false));
+            return;
+        }
+        if (state == HTTPRequestParser::NEED_MORE)
+        {
+            if (fEOF)
+                Close();
+            return;
+        }
+
+        // HTTP Keep-Alive is false; close connection after replying
+        bool fRun = (mapHeaders["connection"] != "close") && GetBoolArg("-rpckeepalive", true);
+
+        fBusy = true;
+        boost::shared_ptr<HTTPReplyBuffer> reply(new HTTPReplyBuffer(peer.address().to_string(), nProto,
+            boost::bind(&HTTPConnection::SendPartial, this->shared_from_this(), _1)));
+        if (!rpc_work_queue->Enqueue(boost::bind(&HTTPConnection::Execute, this->shared_from_this(),
+                                                 reply, strURI, mapHeaders, strRequest, fRun)))
+        {
+            LogPrint("rpc", "%s: work queue full, rejecting request from %s\n", __func__, reply->strPeer);
+            Reply(HTTPError(HTTP_SERVICE_UNAVAILABLE, false));
+        }
+    }
+
+    //! Runs on a handler thread
+    void Execute(boost::shared_ptr<HTTPReplyBuffer> reply, string strURI, map<string, string> mapHeaders,
+                 string strRequest, bool fRun)
+    {
+        if (!ServiceRequest(reply.get(), strURI, mapHeaders, strRequest, fRun) || !fRun)
+            reply->close();
+        reply->stream().flush();
+        strand.post(boost::bind(&HTTPConnection::FinishReply, this->shared_from_this(), reply->fClose));
+    }
+
+    /**
+     * Pass reply data flushed by a handler on to the strand. Blocks the
+     * handler while too much of its output is still waiting to be written,
+     * so a slow client cannot make a streamed reply pile up in memory.
+     */
+    void SendPartial(const std::string& str)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(csPending);
+            while (nPendingBytes > MAX_RPC_REPLY_BUFFER && !fAborted && IsRPCRunning())
+                condPending.timed_wait(lock, posix_time::milliseconds(100));
+            if (fAborted)
+                return;
+            nPendingBytes += str.size();
+        }
+        strand.post(boost::bind(&HTTPConnection::QueueWrite, this->shared_from_this(), str));
+    }
+
+    //! Send a complete reply generated on the strand itself, then close
+    void Reply(const std::string& strReply)
+    {
+        fBusy = true;
+        {
+            boost::unique_lock<boost::mutex> lock(csPending);
+            nPendingBytes += strReply.size();
+        }
+        QueueWrite(strReply);
+        FinishReply(true);
+    }
+
+    void QueueWrite(const std::string& str)
+    {
+        if (fClosed)
+            return;
+        vWriteQueue.push_back(str);
+        if (!fWriting)
+            WriteNext();
+    }
+
+    void WriteNext()
+    {
+        fWriting = true;
+        const std::string& str = vWriteQueue.front();
+        if (fUseSSL)
+            asio::async_write(sslStream, asio::buffer(str),
+                strand.wrap(boost::bind(&HTTPConnection::HandleWrite, this->shared_from_this(), _1)));
+        else
+            asio::async_write(sslStream.next_layer(), asio::buffer(str),
+                strand.wrap(boost::bind(&HTTPConnection::HandleWrite, this->shared_from_this(), _1)));
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        fWriting = false;
+        {
+            boost::unique_lock<boost::mutex> lock(csPending);
+            nPendingBytes -= vWriteQueue.front().size();
+            condPending.notify_all();
+        }
+        vWriteQueue.pop_front();
+        if (error)
+        {
+            Close();
+            return;
+        }
+        if (!vWriteQueue.empty())
+            WriteNext();
+        else if (fReplyDone)
+            CompleteReply();
+    }
+
+    //! The handler is done; complete the request once its output is written
+    void FinishReply(bool fCloseAfter)
+    {
+        fReplyDone = true;
+        fCloseAfterWrite = fCloseAfter;
+        if (!fWriting)
+            CompleteReply();
+    }
+
+    void CompleteReply()
+    {
+        fReplyDone = false;
+        fBusy = false;
+        if (fCloseAfterWrite || fClosed)
+        {
+            Close();
+            return;
+        }
+        ProcessNext();
+        ContinueRead();
+    }
+
+    void Close()
+    {
+        {
+            // Wake up a handler waiting to stream more output
+            boost::unique_lock<boost::mutex> lock(csPending);
+            fAborted = true;
+            condPending.notify_all();
+        }
+        if (fClosed)
+            return;
+        fClosed = true;
+        boost::system::error_code ec;
+        sslStream.lowest_layer().shutdown(Protocol::socket::shutdown_both, ec);
+        sslStream.lowest_layer().close(ec);
+    }
+
+    asio::io_service::strand strand;
+    HTTPRequestParser parser;
+    std::vector<char> vchRead;
+    std::deque<std::string> vWriteQueue;
+    CNetAddr addrClient;
+    const bool fUseSSL;
+    bool fCounted;
+    bool fReading;
+    bool fBusy;
+    bool fEOF;
+    bool fClosed;
+    bool fWriting;
+    bool fReplyDone;
+    bool fCloseAfterWrite;
+
+    //! Reply bytes handed over by the handler thread but not yet written
+    boost::mutex csPending;
+    boost::condition_variable condPending;
+    size_t nPendingBytes;
+    bool fAborted;
+};
 
 //! Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< HTTPConnection<Protocol> > conn,
                              const boost::system::error_code& error);
 
 /**
@@ -479,7 +892,7 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
                    const bool fUseSSL)
 {
     // Accept connection
-    boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn(new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL));
+    boost::shared_ptr< HTTPConnection<Protocol> > conn(new HTTPConnection<Protocol>(*rpc_io_service, context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -494,20 +907,21 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
 
 
 /**
- * Accept and handle incoming connection.
+ * Accept an incoming connection and start servicing it asynchronously.
  */
 template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< HTTPConnection<Protocol> > conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<ip::tcp>* >(conn.get());
+    // Unlimited by default; the cap is opt-in for nodes exposed to untrusted clients
+    const int nMaxConnsPerIP = GetArg("-rpcmaxconnsperip", DEFAULT_RPC_MAX_CONNS_PER_IP);
 
     if (error)
     {
@@ -515,19 +929,22 @@ static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol,
         LogPrintf("%s: Error: %s\n", __func__, error.message());
     }
     // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
+    // do this before reading anything, to filter out
     // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
+    else if (!ClientAllowed(conn->peer.address()))
     {
         // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
         if (!fUseSSL)
-            conn->stream() << HTTPError(HTTP_FORBIDDEN, false) << std::flush;
-        conn->close();
+            conn->Refuse(HTTPError(HTTP_FORBIDDEN, false));
     }
-    else {
-        ServiceConnection(conn.get());
-        conn->close();
+    else if (nMaxConnsPerIP > 0 && !conn->Register(nMaxConnsPerIP))
+    {
+        LogPrint("rpc", "%s: too many connections from %s\n", __func__, conn->peer.address().to_string());
+        if (!fUseSSL)
+            conn->Refuse(HTTPError(HTTP_SERVICE_UNAVAILABLE, false));
     }
+    else
+        conn->Start();
 }
 
 static ip::tcp::endpoint ParseEndpoint(const std::string &strEndpoint, int defaultPort)
@@ -691,9 +1108,24 @@ void StartRPCThreads()
         return;
     }
 
+    // One thread drives all socket I/O; requests are executed on the handler pool
+    rpc_work_queue = new RPCWorkQueue(std::max((int)GetArg("-rpcworkqueue", DEFAULT_RPC_WORK_QUEUE), 1));
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    for (int i = 0; i < std::max((int)GetArg("-rpcthreads", DEFAULT_RPC_THREADS), 1); i++)
+        rpc_worker_group->create_thread(boost::bind(&RPCWorkQueue::Run, rpc_work_queue));
+
+    // The thread handling a batch works on it too, so one fewer helper is needed
+    int nBatchThreads = GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS);
+    if (nBatchThreads <= 0)
+        nBatchThreads = boost::thread::hardware_concurrency();
+    nRPCBatchHelpers = nBatchThreads - 1;
+    if (nRPCBatchHelpers > 0)
+    {
+        rpc_batch_queue = new RPCWorkQueue(nRPCBatchHelpers * 4);
+        for (int i = 0; i < nRPCBatchHelpers; i++)
+            rpc_worker_group->create_thread(boost::bind(&RPCWorkQueue::Run, rpc_batch_queue));
+    }
     fRPCRunning = true;
 }
 
@@ -737,11 +1169,18 @@ void StopRPCThreads()
     deadlineTimers.clear();
 
     rpc_io_service->stop();
+    if (rpc_work_queue != NULL)
+        rpc_work_queue->Interrupt();
+    if (rpc_batch_queue != NULL)
+        rpc_batch_queue->Interrupt();
     cvBlockChange.notify_all();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
     delete rpc_dummy_work; rpc_dummy_work = NULL;
     delete rpc_worker_group; rpc_worker_group = NULL;
+    // Queued requests hold connections, which must go before the io_service
+    delete rpc_work_queue; rpc_work_queue = NULL;
+    delete rpc_batch_queue; rpc_batch_queue = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
     delete rpc_io_service; rpc_io_service = NULL;
 }
@@ -833,6 +1272,113 @@ void JSONRequest::parse(const Value& valRequest)
 }
 
 
+void JSONStreamWriter::Separator()
+{
+    if (fAfterKey)
+    {
+        fAfterKey = false;
+        return;
+    }
+    if (!vEmpty.empty())
+    {
+        if (!vEmpty.back())
+            stream << ',';
+        vEmpty.back() = false;
+    }
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separator();
+    stream << '{';
+    vEmpty.push_back(true);
+}
+
+void JSONStreamWriter::EndObject()
+{
+    stream << '}';
+    vEmpty.pop_back();
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separator();
+    stream << '[';
+    vEmpty.push_back(true);
+}
+
+void JSONStreamWriter::EndArray()
+{
+    stream << ']';
+    vEmpty.pop_back();
+}
+
+void JSONStreamWriter::Key(const std::string& strKey)
+{
+    Separator();
+    stream << UniValue(strKey).write() << ':';
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Write(const UniValue& value)
+{
+    Separator();
+    stream << value.write();
+}
+
+//! Methods whose result can be streamed to HTTP/1.1 clients; all of them are safe mode proof
+static const struct {
+    const char* name;
+    rpcstreamfn_type actor;
+} vRPCStreamCommands[] = {
+    { "getblock",      &getblock_stream },
+    { "getrawmempool", &getrawmempool_stream },
+};
+
+/**
+ * Answer a singleton request by streaming its result as a chunked reply.
+ * Returns false, having written nothing, if the method cannot be streamed.
+ */
+static bool JSONRPCExecStreaming(AcceptedConnection* conn, const JSONRequest& jreq, bool fRun, bool& fKeepRet)
+{
+    rpcstreamfn_type actor = NULL;
+    for (unsigned int i = 0; i < ARRAYLEN(vRPCStreamCommands); i++)
+        if (jreq.strMethod == vRPCStreamCommands[i].name)
+            actor = vRPCStreamCommands[i].actor;
+    if (actor == NULL)
+        return false;
+
+    HTTPChunkedStreamBuf buf(conn->stream(), HTTPReplyHeaderChunked(HTTP_OK, fRun));
+    std::ostream stream(&buf);
+    stream << "{\"result\":";
+    try
+    {
+        JSONStreamWriter writer(stream);
+        if (!actor(jreq.params, writer))
+            return false;
+    }
+    catch (Object& objError)
+    {
+        if (!buf.Started())
+            throw;
+        LogPrintf("%s: %s failed after part of the reply was sent\n", __func__, SanitizeString(jreq.strMethod));
+        fKeepRet = false;
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        if (!buf.Started())
+            throw JSONRPCError(RPC_MISC_ERROR, e.what());
+        LogPrintf("%s: %s failed after part of the reply was sent: %s\n", __func__, SanitizeString(jreq.strMethod), e.what());
+        fKeepRet = false;
+        return true;
+    }
+    stream << ",\"error\":null,\"id\":" << write_string(jreq.id, false) << "}\n";
+    buf.Finish();
+    fKeepRet = true;
+    return true;
+}
+
 static Object JSONRPCExecOne(const Value& req)
 {
     Object rpc_result;
@@ -857,11 +1403,107 @@ static Object JSONRPCExecOne(const Value& req)
     return rpc_result;
 }
 
+/**
+ * A run of consecutive parallel-safe requests from one batch. Every
+ * participating thread claims the next unprocessed request until none are
+ * left, and results are stored in request order.
+ */
+class RPCBatchRun
+{
+public:
+    RPCBatchRun(const Array& vReqIn, size_t nBeginIn, size_t nEndIn) :
+        vReq(vReqIn), nBegin(nBeginIn), nEnd(nEndIn), nNext(nBeginIn), nDone(0)
+    {
+        vResults.resize(nEnd - nBegin);
+    }
+
+    void Work()
+    {
+        while (true)
+        {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (nNext == nEnd)
+                    return;
+                i = nNext++;
+            }
+            Object result = JSONRPCExecOne(vReq[i]);
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                vResults[i - nBegin].swap(result);
+                if (++nDone == nEnd - nBegin)
+                    cond.notify_all();
+            }
+        }
+    }
+
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nDone < nEnd - nBegin)
+            cond.wait(lock);
+    }
+
+    std::vector<Object> vResults;
+
+private:
+    //! Only dereferenced for claimed indices, which the batch thread waits for
+    const Array& vReq;
+    const size_t nBegin;
+    const size_t nEnd;
+    size_t nNext;
+    size_t nDone;
+    boost::mutex cs;
+    boost::condition_variable cond;
+};
+
+/**
+ * Whether a request may run concurrently, in any order, with others of one
+ * batch. Being threadSafe only means a method takes its own locks; those
+ * marked parallelSafe are in addition pure queries, so their results cannot
+ * depend on each other.
+ */
+static bool IsParallelSafeRequest(const Value& req)
+{
+    if (req.type() != obj_type)
+        return false;
+    const Value& valMethod = find_value(req.get_obj(), "method");
+    if (valMethod.type() != str_type)
+        return false;
+    const CRPCCommand *pcmd = tableRPC[valMethod.get_str()];
+    return pcmd && pcmd->threadSafe && pcmd->parallelSafe;
+}
+
 static string JSONRPCExecBatch(const Array& vReq)
 {
     Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    unsigned int reqIdx = 0;
+    while (reqIdx < vReq.size())
+    {
+        // Runs of parallel-safe queries are shared with the batch helpers. The
+        // handler thread takes part itself, so a busy pool only costs speed.
+        // Other requests execute here, in order, between those runs.
+        unsigned int nEnd = reqIdx;
+        while (rpc_batch_queue != NULL && nEnd < vReq.size() && IsParallelSafeRequest(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - reqIdx < 2)
+        {
+            ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+            reqIdx++;
+            continue;
+        }
+
+        boost::shared_ptr<RPCBatchRun> run(new RPCBatchRun(vReq, reqIdx, nEnd));
+        for (unsigned int i = 0; i < (unsigned int)nRPCBatchHelpers && i < nEnd - reqIdx - 1; i++)
+            if (!rpc_batch_queue->Enqueue(boost::bind(&RPCBatchRun::Work, run)))
+                break;
+        run->Work();
+        run->Wait();
+        BOOST_FOREACH(const Object& result, run->vResults)
+            ret.push_back(result);
+        reqIdx = nEnd;
+    }
 
     return write_string(Value(ret), false) + "\n";
 }
@@ -911,6 +1553,10 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
         if (valRequest.type() == obj_type) {
             jreq.parse(valRequest);
 
+            bool fKeep = true;
+            if (conn->chunked_allowed() && JSONRPCExecStreaming(conn, jreq, fRun, fKeep))
+                return fKeep;
+
             Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -937,41 +1583,34 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
     return true;
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+/** Serve /metrics; only reads the lock-free metrics registry, never cs_main */
+static bool HTTPReq_Metrics(AcceptedConnection* conn, bool fRun)
 {
-    bool fRun = true;
-    while (fRun && !ShutdownRequested())
-    {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
-
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
-
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
+    conn->stream() << HTTPReply(HTTP_OK, GetMetricsText(), fRun, false, "text/plain; version=0.0.4") << std::flush;
+    return true;
+}
 
-        // HTTP Keep-Alive is false; close connection immediately
-        if ((mapHeaders["connection"] == "close") || (!GetBoolArg("-rpckeepalive", true)))
-            fRun = false;
+/**
+ * Route one parsed request to the JSON-RPC, REST or metrics handler. Returns
+ * false if the connection must be closed after the reply.
+ */
+static bool ServiceRequest(AcceptedConnection* conn, string& strURI, map<string, string>& mapHeaders,
+                           string& strRequest, bool fRun)
+{
+    // Process via JSON-RPC API
+    if (strURI == "/")
+        return HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun);
 
-        // Process via JSON-RPC API
-        if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
-                break;
+    // Process via HTTP REST API
+    if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false))
+        return HTTPReq_REST(conn, strURI, strRequest, mapHeaders, fRun);
 
-        // Process via HTTP REST API
-        } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
-            if (!HTTPReq_REST(conn, strURI, mapHeaders, fRun))
-                break;
+    // Node metrics for monitoring
+    if (strURI == "/metrics" && GetBoolArg("-metrics", false))
+        return HTTPReq_Metrics(conn, fRun);
 
-        } else {
-            conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
-            break;
-        }
-    }
+    conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
+    return false;
 }
 
 json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
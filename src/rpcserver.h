@@ -14,6 +14,7 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "json/json_spirit_reader_template.h"
 #include "json/json_spirit_utils.h"
@@ -21,6 +22,7 @@
 
 class CBlockIndex;
 class CNetAddr;
+class UniValue;
 
 class AcceptedConnection
 {
@@ -30,8 +32,52 @@ public:
     virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
     virtual void close() = 0;
+    //! Whether the client accepts a chunked reply (HTTP/1.1)
+    virtual bool chunked_allowed() const { return false; }
 };
 
+/**
+ * Writes a JSON document to a stream piece by piece, so large results are
+ * sent while they are generated instead of being built as one value first.
+ * Only the values handed to Write() are held in memory at any time.
+ */
+class JSONStreamWriter
+{
+public:
+    JSONStreamWriter(std::ostream& streamIn) : stream(streamIn), fAfterKey(false) {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    //! Start a member of the current object, its value is written next
+    void Key(const std::string& strKey);
+    void Write(const UniValue& value);
+    void Write(const std::string& strKey, const UniValue& value) { Key(strKey); Write(value); }
+
+private:
+    void Separator();
+
+    std::ostream& stream;
+    std::vector<bool> vEmpty; //!< per open object or array: nothing written to it yet
+    bool fAfterKey;
+};
+
+/** Default number of threads executing RPC requests */
+static const int DEFAULT_RPC_THREADS = 4;
+/** Default number of parsed RPC requests that may wait for a handler thread */
+static const int DEFAULT_RPC_WORK_QUEUE = 16;
+/** Default number of threads executing one JSON-RPC batch, 0 means one per core */
+static const int DEFAULT_RPC_BATCH_THREADS = 0;
+/** Default maximum number of simultaneous RPC connections from one address, 0 means unlimited */
+static const int DEFAULT_RPC_MAX_CONNS_PER_IP = 0;
+/** Size of the per-connection socket read buffer */
+static const size_t RPC_READ_BUFFER_SIZE = 16 * 1024;
+/** Stop reading pipelined requests from a client once this much is buffered */
+static const size_t MAX_RPC_PIPELINE_BUFFER = 1024 * 1024;
+/** Block a handler streaming its reply while this much output awaits the socket */
+static const size_t MAX_RPC_REPLY_BUFFER = 1024 * 1024;
+
 /** Start RPC threads */
 void StartRPCThreads();
 /**
@@ -81,6 +127,14 @@ extern CNetAddr BoostAsioToCNetAddr(boost::asio::ip::address address);
 
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
 
+/**
+ * Streaming variant of an RPC method, writing the result to a chunked reply.
+ * Returns false without writing anything if the regular actor should answer
+ * the request instead. Errors may be thrown as long as no output has been
+ * flushed to the client yet.
+ */
+typedef bool(*rpcstreamfn_type)(const json_spirit::Array& params, JSONStreamWriter& writer);
+
 class CRPCCommand
 {
 public:
@@ -90,6 +144,8 @@ public:
     bool okSafeMode;
     bool threadSafe;
     bool reqWallet;
+    //! A pure query that may run concurrently with others within one batch
+    bool parallelSafe;
 };
 
 /**
@@ -144,6 +200,7 @@ extern json_spirit::Value ping(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value addnode(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getaddednodeinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getnettotals(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getnetmsgstats(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value dumpprivkey(const json_spirit::Array& params, bool fHelp); // in rpcdump.cpp
 extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp);
@@ -199,6 +256,11 @@ extern json_spirit::Value getwalletinfo(const json_spirit::Array& params, bool f
 extern json_spirit::Value getblockchaininfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getnetworkinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value setmocktime(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getlockstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddresstxids(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressbalance(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressutxos(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressmempool(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
@@ -216,18 +278,24 @@ extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool f
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getmempoolinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value savemempool(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
+extern bool getrawmempool_stream(const json_spirit::Array& params, JSONStreamWriter& writer);
+extern bool getblock_stream(const json_spirit::Array& params, JSONStreamWriter& writer);
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value verifychain(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getchaintips(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getblocktimings(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value invalidateblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value reconsiderblock(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value scanblockfilters(const json_spirit::Array& params, bool fHelp);
 
 // in rest.cpp
 extern bool HTTPReq_REST(AcceptedConnection *conn,
                   std::string& strURI,
+                  std::string& strRequest,
                   std::map<std::string, std::string>& mapHeaders,
                   bool fRun);
 
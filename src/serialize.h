@@ -116,6 +116,19 @@ enum
 #define WRITEDATA(s, obj)   s.write((char*)&(obj), sizeof(obj))
 #define READDATA(s, obj)    s.read((char*)&(obj), sizeof(obj))
 
+/** Big-endian 32-bit integers, for database keys that have to sort numerically */
+template<typename Stream> inline void ser_writedata32be(Stream& s, uint32_t n)
+{
+    unsigned char buf[4] = { (unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n };
+    s.write((char*)buf, sizeof(buf));
+}
+template<typename Stream> inline uint32_t ser_readdata32be(Stream& s)
+{
+    unsigned char buf[4];
+    s.read((char*)buf, sizeof(buf));
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
 inline unsigned int GetSerializeSize(char a,               int, int=0) { return sizeof(a); }
 inline unsigned int GetSerializeSize(signed char a,        int, int=0) { return sizeof(a); }
 inline unsigned int GetSerializeSize(unsigned char a,      int, int=0) { return sizeof(a); }
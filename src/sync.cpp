@@ -7,8 +7,13 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <map>
+#include <set>
 #include <stdio.h>
+#include <string.h>
 
+#include <boost/chrono/chrono.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
@@ -20,6 +25,229 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+//
+// Lock statistics (-lockstats).
+// Every thread accumulates the counters of the lock sites it uses in its own
+// map, guarded by a mutex only ever contended by GetLockStats and
+// ResetLockStats. The counters of exited threads are folded into mapRetired.
+//
+
+bool fLockStats = false;
+
+CLockSiteStats::CLockSiteStats(const char* pszNameIn, const char* pszFileIn, int nLineIn) :
+    pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn), nCount(0), nContended(0), nTryFailed(0),
+    nWaitTotal(0), nWaitMax(0), nHoldTotal(0), nHoldMax(0)
+{
+    memset(nWaitHistogram, 0, sizeof(nWaitHistogram));
+    memset(nHoldHistogram, 0, sizeof(nHoldHistogram));
+}
+
+void CLockSiteStats::Add(const CLockSiteStats& other)
+{
+    nCount += other.nCount;
+    nContended += other.nContended;
+    nTryFailed += other.nTryFailed;
+    nWaitTotal += other.nWaitTotal;
+    nWaitMax = std::max(nWaitMax, other.nWaitMax);
+    nHoldTotal += other.nHoldTotal;
+    nHoldMax = std::max(nHoldMax, other.nHoldMax);
+    for (int i = 0; i < LOCKSTATS_HISTOGRAM_BUCKETS; i++) {
+        nWaitHistogram[i] += other.nWaitHistogram[i];
+        nHoldHistogram[i] += other.nHoldHistogram[i];
+    }
+}
+
+namespace {
+
+/** A lock site as seen by one thread: the string literals of the LOCK expansion */
+struct CLockSiteKey
+{
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+
+    CLockSiteKey(const char* pszNameIn, const char* pszFileIn, int nLineIn) : pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn) {}
+
+    bool operator<(const CLockSiteKey& other) const
+    {
+        if (pszFile != other.pszFile)
+            return pszFile < other.pszFile;
+        if (nLine != other.nLine)
+            return nLine < other.nLine;
+        return pszName < other.pszName;
+    }
+};
+
+typedef std::map<CLockSiteKey, CLockSiteStats> LockSiteMap;
+/** A lock site by content: ((file, line), name) */
+typedef std::pair<std::pair<std::string, int>, std::string> MergedLockSiteKey;
+
+struct CThreadLockStats
+{
+    boost::mutex mutex;
+    LockSiteMap mapSites;
+};
+
+void ReleaseThreadLockStats(CThreadLockStats* pstats);
+
+/** The per thread statistics; allocated once and never destroyed, as threads may exit during shutdown */
+class CLockStatsRegistry
+{
+public:
+    boost::mutex mutex;
+    std::set<CThreadLockStats*> setThreads;
+    LockSiteMap mapRetired;
+    boost::thread_specific_ptr<CThreadLockStats> threadStats;
+
+    CLockStatsRegistry() : threadStats(&ReleaseThreadLockStats) {}
+};
+
+boost::once_flag lockStatsInitFlag = BOOST_ONCE_INIT;
+CLockStatsRegistry* pLockStatsRegistry = NULL;
+
+void InitLockStatsRegistry()
+{
+    pLockStatsRegistry = new CLockStatsRegistry();
+}
+
+CLockStatsRegistry& GetLockStatsRegistry()
+{
+    boost::call_once(&InitLockStatsRegistry, lockStatsInitFlag);
+    return *pLockStatsRegistry;
+}
+
+void AddLockSites(LockSiteMap& mapTo, const LockSiteMap& mapFrom)
+{
+    for (LockSiteMap::const_iterator it = mapFrom.begin(); it != mapFrom.end(); ++it) {
+        LockSiteMap::iterator itTo = mapTo.find(it->first);
+        if (itTo == mapTo.end())
+            mapTo.insert(*it);
+        else
+            itTo->second.Add(it->second);
+    }
+}
+
+void ReleaseThreadLockStats(CThreadLockStats* pstats)
+{
+    CLockStatsRegistry& registry = GetLockStatsRegistry();
+    boost::unique_lock<boost::mutex> lock(registry.mutex);
+    registry.setThreads.erase(pstats);
+    AddLockSites(registry.mapRetired, pstats->mapSites);
+    delete pstats;
+}
+
+int LockStatsBucket(int64_t nTime)
+{
+    int64_t nMicros = nTime / 1000;
+    int nBucket = 0;
+    while (nMicros > 0 && nBucket < LOCKSTATS_HISTOGRAM_BUCKETS - 1) {
+        nMicros >>= 1;
+        nBucket++;
+    }
+    return nBucket;
+}
+
+bool CompareLockSiteByWait(const CLockSiteStats& a, const CLockSiteStats& b)
+{
+    return a.nWaitTotal > b.nWaitTotal;
+}
+
+} // anon namespace
+
+int64_t GetLockStatsTime()
+{
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RecordLockStats(const char* pszName, const char* pszFile, int nLine, bool fAcquired, bool fContended, int64_t nWait, int64_t nHold)
+{
+    CLockStatsRegistry& registry = GetLockStatsRegistry();
+    CThreadLockStats* pstats = registry.threadStats.get();
+    if (pstats == NULL) {
+        pstats = new CThreadLockStats();
+        registry.threadStats.reset(pstats);
+        boost::unique_lock<boost::mutex> lock(registry.mutex);
+        registry.setThreads.insert(pstats);
+    }
+
+    boost::unique_lock<boost::mutex> lock(pstats->mutex);
+    CLockSiteKey key(pszName, pszFile, nLine);
+    LockSiteMap::iterator it = pstats->mapSites.find(key);
+    if (it == pstats->mapSites.end())
+        it = pstats->mapSites.insert(std::make_pair(key, CLockSiteStats(pszName, pszFile, nLine))).first;
+    CLockSiteStats& site = it->second;
+    if (!fAcquired) {
+        site.nTryFailed++;
+        return;
+    }
+    site.nCount++;
+    if (fContended)
+        site.nContended++;
+    site.nWaitTotal += nWait;
+    site.nWaitMax = std::max(site.nWaitMax, nWait);
+    site.nWaitHistogram[LockStatsBucket(nWait)]++;
+    site.nHoldTotal += nHold;
+    site.nHoldMax = std::max(site.nHoldMax, nHold);
+    site.nHoldHistogram[LockStatsBucket(nHold)]++;
+}
+
+std::vector<CLockSiteStats> GetLockStats()
+{
+    CLockStatsRegistry& registry = GetLockStatsRegistry();
+    LockSiteMap mapSites;
+    {
+        boost::unique_lock<boost::mutex> lock(registry.mutex);
+        mapSites = registry.mapRetired;
+        BOOST_FOREACH (CThreadLockStats* pstats, registry.setThreads) {
+            boost::unique_lock<boost::mutex> lockThread(pstats->mutex);
+            AddLockSites(mapSites, pstats->mapSites);
+        }
+    }
+
+    // The same source line may appear under several copies of a string
+    // literal (one per translation unit including a header), so merge by
+    // content rather than by address.
+    std::map<MergedLockSiteKey, CLockSiteStats> mapMerged;
+    for (LockSiteMap::const_iterator it = mapSites.begin(); it != mapSites.end(); ++it) {
+        MergedLockSiteKey key(std::make_pair(std::string(it->first.pszFile), it->first.nLine), std::string(it->first.pszName));
+        std::map<MergedLockSiteKey, CLockSiteStats>::iterator itMerged = mapMerged.find(key);
+        if (itMerged == mapMerged.end())
+            mapMerged.insert(std::make_pair(key, it->second));
+        else
+            itMerged->second.Add(it->second);
+    }
+
+    std::vector<CLockSiteStats> vStats;
+    vStats.reserve(mapMerged.size());
+    for (std::map<MergedLockSiteKey, CLockSiteStats>::const_iterator it = mapMerged.begin(); it != mapMerged.end(); ++it)
+        vStats.push_back(it->second);
+    std::stable_sort(vStats.begin(), vStats.end(), CompareLockSiteByWait);
+    return vStats;
+}
+
+void ResetLockStats()
+{
+    CLockStatsRegistry& registry = GetLockStatsRegistry();
+    boost::unique_lock<boost::mutex> lock(registry.mutex);
+    registry.mapRetired.clear();
+    BOOST_FOREACH (CThreadLockStats* pstats, registry.setThreads) {
+        boost::unique_lock<boost::mutex> lockThread(pstats->mutex);
+        pstats->mapSites.clear();
+    }
+}
+
+void DumpLockStats()
+{
+    std::vector<CLockSiteStats> vStats = GetLockStats();
+    LogPrintf("Lock statistics (%u sites, most waited on first):\n", vStats.size());
+    for (unsigned int i = 0; i < vStats.size() && i < 20; i++) {
+        const CLockSiteStats& site = vStats[i];
+        LogPrintf("  %s %s:%d count=%u contended=%u tryfailed=%u wait=%.3fms (max %.3fms) hold=%.3fms (max %.3fms)\n",
+            site.pszName, site.pszFile, site.nLine, site.nCount, site.nContended, site.nTryFailed,
+            0.000001 * site.nWaitTotal, 0.000001 * site.nWaitMax, 0.000001 * site.nHoldTotal, 0.000001 * site.nHoldMax);
+    }
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
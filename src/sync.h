@@ -8,6 +8,10 @@
 
 #include "threadsafety.h"
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -104,6 +108,48 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/** Whether LOCK and TRY_LOCK record acquisition statistics per lock site (-lockstats) */
+extern bool fLockStats;
+/** Default for -lockstatsinterval, the number of seconds between two dumps of the statistics to debug.log */
+static const int64_t DEFAULT_LOCKSTATS_INTERVAL = 600;
+
+/**
+ * Number of buckets in the wait and hold time histograms. Bucket 0 counts
+ * durations under 1us, bucket n those in [2^(n-1), 2^n) us, and the last
+ * bucket everything longer.
+ */
+static const int LOCKSTATS_HISTOGRAM_BUCKETS = 24;
+
+/** Statistics of one LOCK or TRY_LOCK in the source. Times are in nanoseconds. */
+struct CLockSiteStats
+{
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+    uint64_t nCount; //! Successful acquisitions
+    uint64_t nContended; //! Acquisitions that found the lock held by another thread
+    uint64_t nTryFailed; //! TRY_LOCKs that did not get the lock
+    int64_t nWaitTotal;
+    int64_t nWaitMax;
+    int64_t nHoldTotal;
+    int64_t nHoldMax;
+    uint64_t nWaitHistogram[LOCKSTATS_HISTOGRAM_BUCKETS];
+    uint64_t nHoldHistogram[LOCKSTATS_HISTOGRAM_BUCKETS];
+
+    CLockSiteStats(const char* pszNameIn, const char* pszFileIn, int nLineIn);
+    void Add(const CLockSiteStats& other);
+};
+
+/** Monotonic clock used to time lock waits and holds, in nanoseconds */
+int64_t GetLockStatsTime();
+/** Account one acquisition attempt at a lock site to the calling thread's statistics */
+void RecordLockStats(const char* pszName, const char* pszFile, int nLine, bool fAcquired, bool fContended, int64_t nWait, int64_t nHold);
+/** Statistics of all lock sites, summed over all threads, in decreasing order of total wait time */
+std::vector<CLockSiteStats> GetLockStats();
+void ResetLockStats();
+/** Write the lock sites with the most wait time to debug.log */
+void DumpLockStats();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class CMutexLock
@@ -111,9 +157,38 @@ class CMutexLock
 private:
     boost::unique_lock<Mutex> lock;
 
+    //! Lock site and timing of a tracked acquisition; pszStatsName is NULL if untracked
+    const char* pszStatsName;
+    const char* pszStatsFile;
+    int nStatsLine;
+    bool fStatsContended;
+    int64_t nStatsWait;
+    int64_t nStatsLocked;
+
+    void EnterTracked(const char* pszName, const char* pszFile, int nLine)
+    {
+        pszStatsName = pszName;
+        pszStatsFile = pszFile;
+        nStatsLine = nLine;
+        fStatsContended = !lock.try_lock();
+        if (fStatsContended) {
+            int64_t nWaitStart = GetLockStatsTime();
+            lock.lock();
+            nStatsLocked = GetLockStatsTime();
+            nStatsWait = nStatsLocked - nWaitStart;
+        } else {
+            nStatsLocked = GetLockStatsTime();
+            nStatsWait = 0;
+        }
+    }
+
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (fLockStats) {
+            EnterTracked(pszName, pszFile, nLine);
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -130,11 +205,23 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        if (fLockStats) {
+            if (lock.owns_lock()) {
+                pszStatsName = pszName;
+                pszStatsFile = pszFile;
+                nStatsLine = nLine;
+                fStatsContended = false;
+                nStatsWait = 0;
+                nStatsLocked = GetLockStatsTime();
+            } else {
+                RecordLockStats(pszName, pszFile, nLine, false, true, 0, 0);
+            }
+        }
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock), pszStatsName(NULL), pszStatsFile(NULL), nStatsLine(0), fStatsContended(false), nStatsWait(0), nStatsLocked(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -144,8 +231,11 @@ public:
 
     ~CMutexLock()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (pszStatsName != NULL)
+                RecordLockStats(pszStatsName, pszStatsFile, nStatsLine, true, fStatsContended, nStatsWait, GetLockStatsTime() - nStatsLocked);
             LeaveCritical();
+        }
     }
 
     operator bool()
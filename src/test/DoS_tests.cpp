@@ -14,6 +14,7 @@
 #include "pow.h"
 #include "script/sign.h"
 #include "serialize.h"
+#include "txorphanpool.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -23,17 +24,6 @@
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
-// Tests this internal-to-main.cpp method:
-extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
-extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-struct COrphanTx {
-    CTransaction tx;
-    NodeId fromPeer;
-};
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
-
 CService ip(uint32_t i)
 {
     struct in_addr s;
@@ -106,13 +96,9 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     BOOST_CHECK(!CNode::IsBanned(addr));
 }
 
-CTransaction RandomOrphan()
+CTransaction RandomOrphan(const std::vector<CTransaction>& vOrphans)
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    return vOrphans[GetRand(vOrphans.size())];
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -122,6 +108,9 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     CBasicKeyStore keystore;
     keystore.AddKey(key);
 
+    CTxOrphanPool orphans;
+    std::vector<CTransaction> vOrphans;
+
     // 50 orphan transactions:
     for (int i = 0; i < 50; i++)
     {
@@ -134,13 +123,14 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(tx, i);
+        BOOST_CHECK(orphans.AddTx(tx, i));
+        vOrphans.push_back(tx);
     }
 
     // ... and 50 that depend on other orphans:
     for (int i = 0; i < 50; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(vOrphans);
 
         CMutableTransaction tx;
         tx.vin.resize(1);
@@ -151,13 +141,14 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, txPrev, tx, 0);
 
-        AddOrphanTx(tx, i);
+        BOOST_CHECK(orphans.AddTx(tx, i));
+        vOrphans.push_back(tx);
     }
 
     // This really-big orphan should be ignored:
     for (int i = 0; i < 10; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(vOrphans);
 
         CMutableTransaction tx;
         tx.vout.resize(1);
@@ -175,25 +166,166 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(tx, i));
+        BOOST_CHECK(!orphans.AddTx(tx, i));
     }
+    BOOST_CHECK_EQUAL(orphans.size(), 100U);
 
-    // Test EraseOrphansFor:
+    // Test EraseForPeer:
     for (NodeId i = 0; i < 3; i++)
     {
-        size_t sizeBefore = mapOrphanTransactions.size();
-        EraseOrphansFor(i);
-        BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        size_t sizeBefore = orphans.size();
+        size_t bytesBefore = orphans.TotalBytes();
+        size_t peerBytes = orphans.PeerBytes(i);
+        BOOST_CHECK(peerBytes > 0);
+        orphans.EraseForPeer(i);
+        BOOST_CHECK(orphans.size() < sizeBefore);
+        BOOST_CHECK_EQUAL(orphans.TotalBytes(), bytesBefore - peerBytes);
+        BOOST_CHECK_EQUAL(orphans.PeerBytes(i), 0U);
     }
 
-    // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
-    BOOST_CHECK(mapOrphanTransactions.empty());
-    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    // Test LimitOrphans() function:
+    orphans.LimitOrphans(40, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(orphans.size() <= 40);
+    orphans.LimitOrphans(10, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(orphans.size() <= 10);
+    size_t nMaxBytes = orphans.TotalBytes() / 2;
+    orphans.LimitOrphans(1000, nMaxBytes);
+    BOOST_CHECK(orphans.TotalBytes() <= nMaxBytes);
+    orphans.LimitOrphans(0, std::numeric_limits<size_t>::max());
+    BOOST_CHECK_EQUAL(orphans.size(), 0U);
+    BOOST_CHECK_EQUAL(orphans.TotalBytes(), 0U);
+}
+
+static CTransaction OrphanSpending(const uint256& hashPrev, uint32_t n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(hashPrev, n);
+    tx.vin[0].scriptSig << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1*CENT;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanPeerQuota)
+{
+    CTxOrphanPool orphans;
+
+    // Peer 1 floods the pool while peer 2 sends a handful of orphans
+    std::vector<CTransaction> vHonest;
+    for (int i = 0; i < 5; i++) {
+        vHonest.push_back(OrphanSpending(GetRandHash(), 0));
+        BOOST_CHECK(orphans.AddTx(vHonest.back(), 2));
+    }
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(orphans.AddTx(OrphanSpending(GetRandHash(), 0), 1));
+
+    // Eviction only ever hits the peer using the most space
+    BOOST_CHECK_EQUAL(orphans.LimitOrphans(20, std::numeric_limits<size_t>::max()), 85U);
+    BOOST_CHECK_EQUAL(orphans.size(), 20U);
+    BOOST_FOREACH(const CTransaction& tx, vHonest)
+        BOOST_CHECK(orphans.HaveTx(tx.GetHash()));
+    BOOST_CHECK_EQUAL(orphans.PeerBytes(1), orphans.PeerBytes(2) * 3);
+
+    // Once both peers are even, both give up orphans
+    orphans.LimitOrphans(6, std::numeric_limits<size_t>::max());
+    BOOST_CHECK_EQUAL(orphans.PeerBytes(1), orphans.PeerBytes(2));
+    BOOST_CHECK_EQUAL(orphans.TotalBytes(), orphans.PeerBytes(1) + orphans.PeerBytes(2));
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanExpiry)
+{
+    CTxOrphanPool orphans;
+    int64_t nStartTime = GetTime();
+    SetMockTime(nStartTime);
+
+    CTransaction txOld = OrphanSpending(GetRandHash(), 0);
+    BOOST_CHECK(orphans.AddTx(txOld, 0));
+    orphans.LimitOrphans(100, std::numeric_limits<size_t>::max());
+
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_INTERVAL / 3);
+    CTransaction txNew = OrphanSpending(GetRandHash(), 0);
+    BOOST_CHECK(orphans.AddTx(txNew, 0));
+
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME);
+    BOOST_CHECK_EQUAL(orphans.LimitOrphans(100, std::numeric_limits<size_t>::max()), 0U);
+    BOOST_CHECK(!orphans.HaveTx(txOld.GetHash()));
+    BOOST_CHECK(orphans.HaveTx(txNew.GetHash()));
+
+    // Expired orphans are only swept once the sweep interval passed
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME + ORPHAN_TX_EXPIRE_INTERVAL / 3);
+    orphans.LimitOrphans(100, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(orphans.HaveTx(txNew.GetHash()));
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME + ORPHAN_TX_EXPIRE_INTERVAL);
+    orphans.LimitOrphans(100, std::numeric_limits<size_t>::max());
+    BOOST_CHECK_EQUAL(orphans.size(), 0U);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanWorkSet)
+{
+    CTxOrphanPool orphans;
+
+    CTransaction txParent = OrphanSpending(GetRandHash(), 0);
+    CTransaction txChild1 = OrphanSpending(txParent.GetHash(), 0);
+    CTransaction txChild2 = OrphanSpending(txParent.GetHash(), 1);
+    CTransaction txGrandChild = OrphanSpending(txChild1.GetHash(), 0);
+    BOOST_CHECK(orphans.AddTx(txChild1, 1));
+    BOOST_CHECK(orphans.AddTx(txChild2, 2));
+    BOOST_CHECK(orphans.AddTx(txGrandChild, 1));
+    BOOST_CHECK(!orphans.HaveTxToReconsider(1));
+
+    // Accepting the parent queues each child on the work set of its sender
+    orphans.AddChildrenToWorkSet(txParent);
+    BOOST_CHECK(orphans.HaveTxToReconsider(1));
+    BOOST_CHECK(orphans.HaveTxToReconsider(2));
+
+    CTransaction tx;
+    BOOST_CHECK(orphans.GetTxToReconsider(1, tx));
+    BOOST_CHECK(tx == txChild1);
+    BOOST_CHECK(orphans.HaveTx(txChild1.GetHash()));
+    BOOST_CHECK(!orphans.GetTxToReconsider(1, tx));
+
+    // Grandchildren are only queued once their own parent is accepted
+    orphans.AddChildrenToWorkSet(txChild1);
+    orphans.EraseTx(txChild1.GetHash());
+    BOOST_CHECK(orphans.GetTxToReconsider(1, tx));
+    BOOST_CHECK(tx == txGrandChild);
+
+    // Orphans erased while queued are skipped, and disconnecting drops the work set
+    orphans.EraseTx(txChild2.GetHash());
+    BOOST_CHECK(!orphans.GetTxToReconsider(2, tx));
+    orphans.AddChildrenToWorkSet(txChild1);
+    orphans.EraseForPeer(1);
+    BOOST_CHECK(!orphans.HaveTxToReconsider(1));
+    BOOST_CHECK_EQUAL(orphans.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanBlock)
+{
+    CTxOrphanPool orphans;
+
+    uint256 hashPrev = GetRandHash();
+    CTransaction txMined = OrphanSpending(hashPrev, 0);
+    CTransaction txConflict = OrphanSpending(hashPrev, 1);
+    CTransaction txOther = OrphanSpending(hashPrev, 2);
+    BOOST_CHECK(orphans.AddTx(txMined, 0));
+    BOOST_CHECK(orphans.AddTx(txConflict, 0));
+    BOOST_CHECK(orphans.AddTx(txOther, 0));
+
+    // A block spending output 1 another way, and including txMined
+    CMutableTransaction txSpend = OrphanSpending(hashPrev, 1);
+    txSpend.vout[0].nValue = 2*CENT;
+    CBlock block;
+    block.vtx.push_back(txMined);
+    block.vtx.push_back(txSpend);
+
+    BOOST_CHECK_EQUAL(orphans.EraseForBlock(block), 2);
+    BOOST_CHECK(!orphans.HaveTx(txMined.GetHash()));
+    BOOST_CHECK(!orphans.HaveTx(txConflict.GetHash()));
+    BOOST_CHECK(orphans.HaveTx(txOther.GetHash()));
 }
 
 BOOST_AUTO_TEST_SUITE_END()
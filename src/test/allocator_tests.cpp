@@ -116,4 +116,35 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+BOOST_AUTO_TEST_CASE(test_CStreamBufferPool)
+{
+    CStreamBufferPool& pool = CStreamBufferPool::Instance();
+
+    // A freed buffer is handed out again for any request of its size class
+    void* p = pool.Allocate(1000);
+    size_t nPooled = pool.GetPooledBytes();
+    pool.Deallocate(p, 1000);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), nPooled + 1024);
+    void* q = pool.Allocate(600);
+    BOOST_CHECK(q == p);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), nPooled);
+    pool.Deallocate(q, 600);
+
+    // Requests above the largest size class are not pooled
+    size_t nLarge = ((size_t)1 << CStreamBufferPool::MAX_CLASS_BITS) + 1;
+    nPooled = pool.GetPooledBytes();
+    pool.Deallocate(pool.Allocate(nLarge), nLarge);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), nPooled);
+
+    // Vectors using the pool keep their contents across reallocations
+    CNetSerializeData vch;
+    for (int i = 0; i < 100000; i++)
+        vch.push_back((char)i);
+    bool fSame = true;
+    for (int i = 0; i < 100000; i++)
+        fSame &= vch[i] == (char)i;
+    BOOST_CHECK(fSame);
+    BOOST_CHECK(pool.GetPooledBytes() <= CStreamBufferPool::MAX_POOLED_BYTES);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,85 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blocktimings.h"
+
+#include <boost/test/unit_test.hpp>
+
+static CBlockTimings MakeTimings(int nHeight, int64_t nTotal)
+{
+    CBlockTimings timings;
+    timings.nHeight = nHeight;
+    timings.nPhaseTime[BLOCK_PHASE_TOTAL] = nTotal;
+    return timings;
+}
+
+BOOST_AUTO_TEST_SUITE(blocktimings_tests)
+
+BOOST_AUTO_TEST_CASE(blocktimings_ringbuffer)
+{
+    CBlockTimingsBuffer buffer(4);
+    BOOST_CHECK_EQUAL(buffer.Size(), 0U);
+    BOOST_CHECK(buffer.GetRecent(10).empty());
+
+    for (int i = 0; i < 3; i++)
+        buffer.Add(MakeTimings(i, 0));
+    std::vector<CBlockTimings> vRecent = buffer.GetRecent(10);
+    BOOST_CHECK_EQUAL(vRecent.size(), 3U);
+    BOOST_CHECK_EQUAL(vRecent[0].nHeight, 2);
+    BOOST_CHECK_EQUAL(vRecent[2].nHeight, 0);
+
+    // Wrapping around drops the oldest entries
+    for (int i = 3; i < 10; i++)
+        buffer.Add(MakeTimings(i, 0));
+    BOOST_CHECK_EQUAL(buffer.Size(), 4U);
+    vRecent = buffer.GetRecent(10);
+    BOOST_CHECK_EQUAL(vRecent.size(), 4U);
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK_EQUAL(vRecent[i].nHeight, 9 - i);
+    vRecent = buffer.GetRecent(2);
+    BOOST_CHECK_EQUAL(vRecent.size(), 2U);
+    BOOST_CHECK_EQUAL(vRecent[0].nHeight, 9);
+    BOOST_CHECK_EQUAL(vRecent[1].nHeight, 8);
+
+    buffer.Clear();
+    BOOST_CHECK_EQUAL(buffer.Size(), 0U);
+    buffer.Add(MakeTimings(10, 0));
+    BOOST_CHECK_EQUAL(buffer.GetRecent(10)[0].nHeight, 10);
+}
+
+BOOST_AUTO_TEST_CASE(blocktimings_percentiles)
+{
+    CBlockTimingsBuffer buffer(100);
+    std::vector<double> vPercentiles;
+    vPercentiles.push_back(50);
+    vPercentiles.push_back(90);
+    vPercentiles.push_back(99);
+    vPercentiles.push_back(100);
+
+    std::vector<int64_t> vResult = buffer.GetPercentiles(BLOCK_PHASE_TOTAL, vPercentiles);
+    BOOST_CHECK_EQUAL(vResult.size(), 4U);
+    BOOST_CHECK_EQUAL(vResult[3], 0);
+
+    // Added out of order: 1..100 microseconds
+    for (int i = 0; i < 100; i++)
+        buffer.Add(MakeTimings(i, (i * 37) % 100 + 1));
+    vResult = buffer.GetPercentiles(BLOCK_PHASE_TOTAL, vPercentiles);
+    BOOST_CHECK_EQUAL(vResult[0], 50);
+    BOOST_CHECK_EQUAL(vResult[1], 90);
+    BOOST_CHECK_EQUAL(vResult[2], 99);
+    BOOST_CHECK_EQUAL(vResult[3], 100);
+
+    // Other phases are kept apart
+    vResult = buffer.GetPercentiles(BLOCK_PHASE_SCRIPTS, vPercentiles);
+    BOOST_CHECK_EQUAL(vResult[3], 0);
+
+    // Once full, only the newest entries count
+    for (int i = 0; i < 100; i++)
+        buffer.Add(MakeTimings(100 + i, 7));
+    vResult = buffer.GetPercentiles(BLOCK_PHASE_TOTAL, vPercentiles);
+    BOOST_CHECK_EQUAL(vResult[0], 7);
+    BOOST_CHECK_EQUAL(vResult[3], 7);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -459,4 +459,74 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_update_none)
     BOOST_CHECK(!filter.contains(COutPoint(uint256("0x02981fa052f0481dbc5868f4fc2166035a10f27a03cfd2de67326471df5bc041"), 0)));
 }
 
+BOOST_AUTO_TEST_CASE(block_filter)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CScript scriptPayToKeyHash = GetScriptForDestination(pubkey.GetID());
+    CScript scriptPayToKey = CScript() << ToByteVector(pubkey) << OP_CHECKSIG;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey = scriptPayToKey;
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(uint256(1), 7);
+    spend.vout.resize(1);
+    spend.vout[0].scriptPubKey = scriptPayToKeyHash;
+
+    CBlock block;
+    block.vtx.push_back(coinbase);
+    block.vtx.push_back(spend);
+    CBloomFilter filter = BuildBlockFilter(block);
+
+    // Whole scripts, the data they push and spent outpoints are all in the filter
+    BOOST_CHECK(filter.contains(ToByteVector(scriptPayToKeyHash)));
+    BOOST_CHECK(filter.contains(ToByteVector(scriptPayToKey)));
+    BOOST_CHECK(filter.contains(ToByteVector(pubkey.GetID())));
+    BOOST_CHECK(filter.contains(ToByteVector(pubkey)));
+    BOOST_CHECK(filter.contains(COutPoint(uint256(1), 7)));
+
+    // ... but not unrelated ones, nor the coinbase's null prevout
+    BOOST_CHECK(!filter.contains(COutPoint(uint256(1), 8)));
+    BOOST_CHECK(!filter.contains(COutPoint()));
+    BOOST_CHECK(!filter.contains(ToByteVector(CScript() << OP_TRUE)));
+
+    // Survives a round trip through the block tree database format
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    stream << filter;
+    CBloomFilter filter2;
+    stream >> filter2;
+    filter2.UpdateEmptyFull();
+    BOOST_CHECK(filter2.contains(ToByteVector(pubkey.GetID())));
+    BOOST_CHECK(!filter2.contains(COutPoint(uint256(1), 8)));
+}
+
+BOOST_AUTO_TEST_CASE(block_filter_size)
+{
+    // More elements than a relayable filter can hold at BLOCK_FILTER_FP_RATE
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(uint256(1), 0);
+    tx.vout.resize(20000);
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+        tx.vout[i].scriptPubKey = CScript() << OP_RETURN << (int64_t)i;
+
+    CBlock block;
+    block.vtx.push_back(tx);
+    CBloomFilter filter = BuildBlockFilter(block);
+    BOOST_CHECK(!filter.IsWithinSizeConstraints());
+    BOOST_CHECK(GetSerializeSize(filter, SER_DISK, CLIENT_VERSION) > MAX_BLOOM_FILTER_SIZE);
+
+    // ... and the false positive rate still holds
+    unsigned int nFalsePositives = 0;
+    for (unsigned int i = 0; i < 100000; i++)
+        if (filter.contains(COutPoint(uint256(2), i)))
+            nFalsePositives++;
+    BOOST_CHECK(nFalsePositives < 10);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,10 @@
 
 #include "primitives/transaction.h"
 #include "main.h"
+#include "pow.h"
+#include "random.h"
+
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
@@ -21,4 +25,25 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 8399999990760000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(block_index_caches_test)
+{
+    // A chain crossing the switch between the retarget rules at height 120000
+    std::vector<CBlockIndex> vIndex(400);
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        vIndex[i].nHeight = 119800 + i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : NULL;
+        vIndex[i].nTime = 1420000000 + 150 * i + insecure_rand() % 600;
+        vIndex[i].nBits = i > 20 ? GetNextWorkRequired(&vIndex[i - 1], NULL) : 0x1c0fffff;
+    }
+
+    for (unsigned int i = 20; i < vIndex.size(); i++) {
+        int64_t nTimeMedianPast = vIndex[i].GetMedianTimePast();
+        unsigned int nBitsNext = GetNextWorkRequired(&vIndex[i], NULL);
+        vIndex[i].BuildCaches();
+        BOOST_CHECK(vIndex[i].nTimeMedianPast != 0 && vIndex[i].nBitsNext != 0);
+        BOOST_CHECK_EQUAL(vIndex[i].GetMedianTimePast(), nTimeMedianPast);
+        BOOST_CHECK_EQUAL(GetNextWorkRequired(&vIndex[i], NULL), nBitsNext);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
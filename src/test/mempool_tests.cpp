@@ -99,4 +99,178 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorDescendantTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    std::list<CTransaction> removed;
+
+    // A chain of three transactions: parent -> child -> grandchild
+    CMutableTransaction txChain[3];
+    for (int i = 0; i < 3; i++)
+    {
+        txChain[i].vin.resize(1);
+        txChain[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0)
+            txChain[i].vin[0].prevout = COutPoint(txChain[i-1].GetHash(), 0);
+        txChain[i].vout.resize(1);
+        txChain[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChain[i].vout[0].nValue = 11000LL;
+    }
+    unsigned int nTxSize = ::GetSerializeSize(txChain[0], SER_NETWORK, PROTOCOL_VERSION);
+    for (int i = 1; i < 3; i++)
+        BOOST_CHECK_EQUAL(::GetSerializeSize(txChain[i], SER_NETWORK, PROTOCOL_VERSION), nTxSize);
+
+    for (int i = 0; i < 3; i++)
+        pool.addUnchecked(txChain[i].GetHash(), CTxMemPoolEntry(txChain[i], 1000LL * (i + 1), 0, 0.0, 1));
+
+    // Package state accumulates along the chain in both directions
+    for (int i = 0; i < 3; i++)
+    {
+        CTxMemPool::txiter it = pool.mapTx.find(txChain[i].GetHash());
+        BOOST_CHECK(it != pool.mapTx.end());
+        BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), i + 1);
+        BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), nTxSize * (i + 1));
+        BOOST_CHECK_EQUAL(it->GetModFeesWithAncestors(), 1000LL * (i + 1) * (i + 2) / 2);
+        BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), 3 - i);
+        BOOST_CHECK_EQUAL(it->GetSizeWithDescendants(), nTxSize * (3 - i));
+        BOOST_CHECK_EQUAL(it->GetModFeesWithDescendants(), 6000LL - 1000LL * i * (i + 1) / 2);
+    }
+
+    // Chain limits are enforced when calculating ancestors of a new entry
+    CMutableTransaction txNext;
+    txNext.vin.resize(1);
+    txNext.vin[0].scriptSig = CScript() << OP_11;
+    txNext.vin[0].prevout = COutPoint(txChain[2].GetHash(), 0);
+    txNext.vout.resize(1);
+    txNext.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txNext.vout[0].nValue = 11000LL;
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(CTxMemPoolEntry(txNext, 0, 0, 0.0, 1), setAncestors, 4, 1000000, 4, 1000000, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 3);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(CTxMemPoolEntry(txNext, 0, 0, 0.0, 1), setAncestors, 3, 1000000, 4, 1000000, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(CTxMemPoolEntry(txNext, 0, 0, 0.0, 1), setAncestors, 4, 1000000, 3, 1000000, errString));
+
+    // Prioritisation is reflected in the package state of relatives
+    pool.PrioritiseTransaction(txChain[1].GetHash(), txChain[1].GetHash().ToString(), 0.0, 500LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txChain[0].GetHash())->GetModFeesWithDescendants(), 6500LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txChain[2].GetHash())->GetModFeesWithAncestors(), 6500LL);
+    pool.PrioritiseTransaction(txChain[1].GetHash(), txChain[1].GetHash().ToString(), 0.0, -500LL);
+    pool.ClearPrioritisation(txChain[1].GetHash());
+
+    // Removing the parent alone (as when it is mined) leaves the rest of
+    // the chain with updated state
+    pool.remove(txChain[0], removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    removed.clear();
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txChain[1].GetHash())->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txChain[2].GetHash())->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txChain[2].GetHash())->GetModFeesWithAncestors(), 5000LL);
+
+    // Re-adding it (as after a reorg) links the in-mempool descendants again
+    pool.addUnchecked(txChain[0].GetHash(), CTxMemPoolEntry(txChain[0], 1000LL, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txChain[0].GetHash())->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txChain[2].GetHash())->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txChain[2].GetHash())->GetModFeesWithAncestors(), 6000LL);
+
+    pool.remove(txChain[0], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 3);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    SetMockTime(1000000);
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 0, 10.0, 1));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000LL, 0, 10.0, 1));
+
+    // High fee child of the low fee tx2
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_2;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 20000LL, 0, 10.0, 1));
+
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vin.resize(1);
+    tx4.vin[0].scriptSig = CScript() << OP_4;
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    tx4.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx4.GetHash(), CTxMemPoolEntry(tx4, 7000LL, 0, 10.0, 1));
+
+    // A pool at its limit is left alone, and no minimum fee is set
+    size_t nUsage = pool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > 0);
+    pool.TrimToSize(nUsage);
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(nUsage).GetFeePerK(), 0);
+
+    // The lowest descendant score goes first: tx2 is kept by its high fee child
+    pool.TrimToSize(nUsage - 1);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK(pool.exists(tx3.GetHash()));
+    BOOST_CHECK(!pool.exists(tx4.GetHash()));
+    BOOST_CHECK(pool.DynamicMemoryUsage() < nUsage);
+
+    // The minimum fee is bumped to the evicted fee rate plus the relay fee
+    CAmount nMinFeePerK = CFeeRate(7000LL, ::GetSerializeSize(tx4, SER_NETWORK, PROTOCOL_VERSION)).GetFeePerK() + 1000;
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeePerK);
+
+    // Prioritisation changes the eviction order
+    pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0.0, -9000LL);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    // ... and a lower eviction rate does not lower the minimum fee
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeePerK);
+
+    // The minimum fee only starts to decay after a block, halving every half-life
+    SetMockTime(1000000 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeePerK);
+    std::vector<CTransaction> vtxBlock;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtxBlock, 2, conflicts);
+    SetMockTime(1000000 + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeePerK / 2);
+
+    // ... until it drops below half the relay fee
+    SetMockTime(1000000 + 12 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    // A parent is evicted together with its descendants
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+    BOOST_CHECK(!pool.exists(tx3.GetHash()));
+
+    // Removing everything releases all accounted memory
+    pool.ClearPrioritisation(tx1.GetHash());
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
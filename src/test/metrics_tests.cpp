@@ -0,0 +1,65 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include <boost/test/unit_test.hpp>
+
+static const int64_t testBuckets[] = { 10, 100, 1000 };
+
+static CMetricCounter testCounter("test_metrics_counter_total", "A test counter");
+static CMetricGauge testGauge("test_metrics_gauge", "A test gauge");
+static CMetricHistogram testHistogram("test_metrics_histogram_seconds", "A test histogram", testBuckets, 3, 0.001);
+
+BOOST_AUTO_TEST_SUITE(metrics_tests)
+
+BOOST_AUTO_TEST_CASE(metrics_counter_gauge)
+{
+    uint64_t nCount = testCounter.Get();
+    testCounter.Inc();
+    testCounter.Inc(41);
+    BOOST_CHECK_EQUAL(testCounter.Get(), nCount + 42);
+
+    testGauge.Set(7);
+    testGauge.Add(-10);
+    BOOST_CHECK_EQUAL(testGauge.Get(), -3);
+}
+
+BOOST_AUTO_TEST_CASE(metrics_histogram)
+{
+    BOOST_CHECK_EQUAL(testHistogram.GetCount(), 0U);
+    testHistogram.Observe(5);
+    testHistogram.Observe(10);      // bounds are inclusive
+    testHistogram.Observe(11);
+    testHistogram.Observe(1000);
+    testHistogram.Observe(5000);    // +Inf
+    BOOST_CHECK_EQUAL(testHistogram.GetCount(0), 2U);
+    BOOST_CHECK_EQUAL(testHistogram.GetCount(1), 3U);
+    BOOST_CHECK_EQUAL(testHistogram.GetCount(2), 4U);
+    BOOST_CHECK_EQUAL(testHistogram.GetCount(), 5U);
+    BOOST_CHECK_EQUAL(testHistogram.GetSum(), 6026);
+}
+
+BOOST_AUTO_TEST_CASE(metrics_render)
+{
+    std::string strText = GetMetricsText();
+
+    // Every metric is rendered, including the node's own
+    BOOST_CHECK(strText.find("# TYPE briliantcoin_blocks_connected_total counter\n") != std::string::npos);
+    BOOST_CHECK(strText.find("# TYPE briliantcoin_block_connect_seconds histogram\n") != std::string::npos);
+
+    BOOST_CHECK(strText.find("# HELP test_metrics_gauge A test gauge\n# TYPE test_metrics_gauge gauge\ntest_metrics_gauge -3\n") != std::string::npos);
+    BOOST_CHECK(strText.find("\ntest_metrics_counter_total ") != std::string::npos);
+
+    // Histogram buckets are cumulative and scaled
+    BOOST_CHECK(strText.find(
+        "test_metrics_histogram_seconds_bucket{le=\"0.01\"} 2\n"
+        "test_metrics_histogram_seconds_bucket{le=\"0.1\"} 3\n"
+        "test_metrics_histogram_seconds_bucket{le=\"1\"} 4\n"
+        "test_metrics_histogram_seconds_bucket{le=\"+Inf\"} 5\n"
+        "test_metrics_histogram_seconds_sum 6.026000\n"
+        "test_metrics_histogram_seconds_count 5\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
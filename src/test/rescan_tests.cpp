@@ -0,0 +1,192 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet.h"
+
+#include "bloom.h"
+#include "chainparams.h"
+#include "key.h"
+#include "main.h"
+#include "txdb.h"
+
+#include <list>
+#include <set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(rescan_tests)
+
+static const CScript scriptOther = CScript() << OP_TRUE;
+
+/**
+ * A chain of blocks written to their own block files, with their filters,
+ * that temporarily replaces the active chain. The blocks are not validated;
+ * rescans only read them.
+ */
+struct RescanChain
+{
+    std::list<uint256> listHashes; //! Stable storage for phashBlock
+    std::vector<CBlockIndex*> vIndex;
+    CBlockIndex* pindexTipSaved;
+
+    RescanChain() : pindexTipSaved(NULL) {}
+
+    ~RescanChain()
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(pindexTipSaved);
+        BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+            delete pindex;
+    }
+
+    void Add(const std::vector<CMutableTransaction>& vtx)
+    {
+        CBlock block;
+        block.nVersion = 1;
+        block.hashPrevBlock = vIndex.empty() ? uint256(0) : vIndex.back()->GetBlockHash();
+        block.nTime = GetTime();
+        block.nNonce = vIndex.size();
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << (int64_t)vIndex.size();
+        coinbase.vout.resize(1);
+        coinbase.vout[0].nValue = 50 * COIN;
+        coinbase.vout[0].scriptPubKey = scriptOther;
+        block.vtx.push_back(coinbase);
+        BOOST_FOREACH(const CMutableTransaction& tx, vtx)
+            block.vtx.push_back(tx);
+        block.hashMerkleRoot = block.BuildMerkleTree();
+
+        CDiskBlockPos pos;
+        pos.nFile = 10000 + vIndex.size();
+        pos.nPos = 0;
+        BOOST_CHECK(WriteBlockToDisk(block, pos));
+        BOOST_CHECK(pblocktree->WriteBlockFilter(block.GetHash(), BuildBlockFilter(block)));
+
+        CBlockIndex* pindex = new CBlockIndex(block);
+        listHashes.push_back(block.GetHash());
+        pindex->phashBlock = &listHashes.back();
+        pindex->pprev = vIndex.empty() ? NULL : vIndex.back();
+        pindex->nHeight = vIndex.size();
+        pindex->nFile = pos.nFile;
+        pindex->nDataPos = pos.nPos;
+        pindex->nStatus |= BLOCK_HAVE_DATA;
+        pindex->BuildSkip();
+        vIndex.push_back(pindex);
+    }
+
+    void Activate()
+    {
+        LOCK(cs_main);
+        pindexTipSaved = chainActive.Tip();
+        chainActive.SetTip(vIndex.back());
+    }
+};
+
+static std::set<uint256> GetWalletTxids(const CWallet& wallet)
+{
+    LOCK(wallet.cs_wallet);
+    std::set<uint256> setTxids;
+    for (std::map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+        setTxids.insert(it->first);
+    return setTxids;
+}
+
+static void LoadWalletWithKey(CWallet& wallet, const CKey& key)
+{
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+    LOCK(wallet.cs_wallet);
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+}
+
+BOOST_AUTO_TEST_CASE(rescan_pipelined_matches_serial)
+{
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // Enough blocks for the readers to run ahead of the scan. Every fifth
+    // block pays us, the next one spends that output elsewhere and the
+    // others have nothing of ours.
+    RescanChain chain;
+    chain.Add(std::vector<CMutableTransaction>());
+    CMutableTransaction txPay;
+    unsigned int nMine = 0;
+    for (unsigned int i = 1; i < 3 * RESCAN_READ_AHEAD; i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = COIN;
+        if (i % 5 == 0)
+        {
+            tx.vin[0].prevout = COutPoint(uint256(i), 0);
+            tx.vout[0].scriptPubKey = scriptMine;
+            txPay = tx;
+            nMine++;
+        }
+        else if (i % 5 == 1 && i > 1)
+        {
+            tx.vin[0].prevout = COutPoint(txPay.GetHash(), 0);
+            tx.vout[0].scriptPubKey = scriptOther;
+            nMine++;
+        }
+        else
+        {
+            tx.vin[0].prevout = COutPoint(uint256(i), 0);
+            tx.vout[0].scriptPubKey = scriptOther;
+        }
+        chain.Add(std::vector<CMutableTransaction>(1, tx));
+    }
+    chain.Activate();
+
+    // Serial: every block in chain order, as the scan did before read-ahead
+    CWallet walletSerial("wallet_rescan_serial.dat");
+    LoadWalletWithKey(walletSerial, key);
+    {
+        LOCK2(cs_main, walletSerial.cs_wallet);
+        BOOST_FOREACH(CBlockIndex* pindex, chain.vIndex)
+        {
+            CBlock block;
+            BOOST_CHECK(ReadBlockFromDisk(block, pindex));
+            BOOST_FOREACH(const CTransaction& tx, block.vtx)
+                walletSerial.AddToWalletIfInvolvingMe(tx, &block, false);
+        }
+    }
+    std::set<uint256> setExpected = GetWalletTxids(walletSerial);
+    BOOST_CHECK_EQUAL(setExpected.size(), nMine);
+
+    // Pipelined, reading every block
+    CWallet walletRead("wallet_rescan_read.dat");
+    LoadWalletWithKey(walletRead, key);
+    BOOST_CHECK_EQUAL(walletRead.ScanForWalletTransactions(chain.vIndex.front()), (int)setExpected.size());
+    BOOST_CHECK(GetWalletTxids(walletRead) == setExpected);
+
+    // Pipelined with block filters. The spending blocks are skipped by the
+    // readers, which only know our keys, and read again once the scan has
+    // found the output they spend. Blocks with nothing of ours are never
+    // read: the scan succeeds even with one of their files gone.
+    boost::filesystem::remove(GetBlockPosFilename(chain.vIndex[2]->GetBlockPos(), "blk"));
+    fBlockFilterIndex = true;
+    CWallet walletFiltered("wallet_rescan_filtered.dat");
+    LoadWalletWithKey(walletFiltered, key);
+    BOOST_CHECK_EQUAL(walletFiltered.ScanForWalletTransactions(chain.vIndex.front()), (int)setExpected.size());
+    BOOST_CHECK(GetWalletTxids(walletFiltered) == setExpected);
+    fBlockFilterIndex = false;
+
+    // Without filters that block must be read, and the rescan is aborted
+    CWallet walletAborted("wallet_rescan_aborted.dat");
+    LoadWalletWithKey(walletAborted, key);
+    BOOST_CHECK_EQUAL(walletAborted.ScanForWalletTransactions(chain.vIndex.front()), -1);
+
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 
 #include "base58.h"
 #include "netbase.h"
+#include "univalue/univalue.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/test/unit_test.hpp>
@@ -172,4 +173,110 @@ BOOST_AUTO_TEST_CASE(rpc_boostasiotocnetaddr)
     BOOST_CHECK_EQUAL(BoostAsioToCNetAddr(boost::asio::ip::address::from_string("::ffff:127.0.0.1")).ToString(), "127.0.0.1");
 }
 
+BOOST_AUTO_TEST_CASE(rpc_http_request_parser)
+{
+    HTTPRequestParser parser(100);
+    int nProto = 0;
+    std::string strMethod, strURI, strBody;
+    std::map<std::string, std::string> mapHeaders;
+
+    // Two pipelined requests, the first one split across reads
+    std::string strReq1 = "POST / HTTP/1.1\r\nContent-Length: 5\r\nAuthorization: x\r\n\r\nhello";
+    std::string strReq2 = "GET /rest/tx/00.json HTTP/1.0\r\n\r\n";
+    parser.Feed(strReq1.data(), 20);
+    BOOST_CHECK(parser.Next(nProto, strMethod, strURI, mapHeaders, strBody) == HTTPRequestParser::NEED_MORE);
+    parser.Feed(strReq1.data() + 20, strReq1.size() - 22);
+    BOOST_CHECK(parser.Next(nProto, strMethod, strURI, mapHeaders, strBody) == HTTPRequestParser::NEED_MORE);
+    std::string strRest = strReq1.substr(strReq1.size() - 2) + strReq2;
+    parser.Feed(strRest.data(), strRest.size());
+
+    BOOST_CHECK(parser.Next(nProto, strMethod, strURI, mapHeaders, strBody) == HTTPRequestParser::COMPLETE);
+    BOOST_CHECK_EQUAL(strMethod, "POST");
+    BOOST_CHECK_EQUAL(strURI, "/");
+    BOOST_CHECK_EQUAL(nProto, 1);
+    BOOST_CHECK_EQUAL(strBody, "hello");
+    BOOST_CHECK_EQUAL(mapHeaders["authorization"], "x");
+    BOOST_CHECK_EQUAL(mapHeaders["connection"], "keep-alive");
+
+    BOOST_CHECK(parser.Next(nProto, strMethod, strURI, mapHeaders, strBody) == HTTPRequestParser::COMPLETE);
+    BOOST_CHECK_EQUAL(strMethod, "GET");
+    BOOST_CHECK_EQUAL(strURI, "/rest/tx/00.json");
+    BOOST_CHECK_EQUAL(strBody, "");
+    BOOST_CHECK_EQUAL(mapHeaders.count("authorization"), 0U);
+    BOOST_CHECK_EQUAL(mapHeaders["connection"], "close");
+    BOOST_CHECK_EQUAL(parser.BufferedSize(), 0U);
+    BOOST_CHECK(parser.Next(nProto, strMethod, strURI, mapHeaders, strBody) == HTTPRequestParser::NEED_MORE);
+
+    // Body larger than allowed
+    std::string strBig = "POST / HTTP/1.1\r\nContent-Length: 101\r\n\r\n";
+    parser.Feed(strBig.data(), strBig.size());
+    BOOST_CHECK(parser.Next(nProto, strMethod, strURI, mapHeaders, strBody) == HTTPRequestParser::INVALID);
+
+    // Unsupported method
+    HTTPRequestParser parser2(100);
+    std::string strPut = "PUT / HTTP/1.1\r\n\r\n";
+    parser2.Feed(strPut.data(), strPut.size());
+    BOOST_CHECK(parser2.Next(nProto, strMethod, strURI, mapHeaders, strBody) == HTTPRequestParser::INVALID);
+
+    // Headers that never end
+    HTTPRequestParser parser3(100);
+    std::string strHeader = "X-Filler: " + std::string(100, 'a') + "\r\n";
+    parser3.Feed("POST / HTTP/1.1\r\n", 17);
+    while (parser3.BufferedSize() <= MAX_HTTP_HEADERS_SIZE)
+        parser3.Feed(strHeader.data(), strHeader.size());
+    BOOST_CHECK(parser3.Next(nProto, strMethod, strURI, mapHeaders, strBody) == HTTPRequestParser::INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream_writer)
+{
+    std::ostringstream ss;
+    JSONStreamWriter writer(ss);
+    writer.BeginObject();
+    writer.Write("a", 1);
+    writer.Key("list");
+    writer.BeginArray();
+    writer.Write("x\"y");
+    writer.BeginObject();
+    writer.EndObject();
+    writer.BeginArray();
+    writer.Write(UniValue());
+    writer.EndArray();
+    writer.EndArray();
+    writer.Write("b", UniValue(UniValue::VNUM, "0.50000000"));
+    writer.EndObject();
+    BOOST_CHECK_EQUAL(ss.str(), "{\"a\":1,\"list\":[\"x\\\"y\",{},[null]],\"b\":0.50000000}");
+
+    // Same text as json_spirit produces for the equivalent tree
+    Value value;
+    BOOST_CHECK(read_string(ss.str(), value));
+    BOOST_CHECK_EQUAL(write_string(value, false), ss.str());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_http_chunked_reply)
+{
+    std::string strBody;
+    for (int i = 0; strBody.size() < HTTP_CHUNK_SIZE * 2 + 100; i++)
+        strBody += (char)('a' + i % 26);
+
+    std::stringstream ss;
+    {
+        HTTPChunkedStreamBuf buf(ss, HTTPReplyHeaderChunked(HTTP_OK, true));
+        std::ostream stream(&buf);
+        stream << "x";
+        BOOST_CHECK(!buf.Started());
+        BOOST_CHECK(ss.str().empty());
+        stream << strBody.substr(1);
+        BOOST_CHECK(buf.Started());
+        buf.Finish();
+    }
+
+    int nProto = 0;
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(ss, nProto), HTTP_OK);
+    std::map<std::string, std::string> mapHeaders;
+    std::string strMessage;
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ss, mapHeaders, strMessage, nProto, strBody.size()), HTTP_OK);
+    BOOST_CHECK_EQUAL(mapHeaders["transfer-encoding"], "chunked");
+    BOOST_CHECK(strMessage == "x" + strBody.substr(1));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
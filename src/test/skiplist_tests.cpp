@@ -99,4 +99,49 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(chain_getancestor_test)
+{
+    // Build a main chain 10000 blocks long.
+    std::vector<CBlockIndex> vBlocksMain(10000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].nTime = 1000 + 150 * i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].BuildSkip();
+    }
+
+    // Build a branch that splits off at block 4999, 6000 blocks long.
+    std::vector<CBlockIndex> vBlocksSide(6000);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vBlocksSide[i].nHeight = i + 5000;
+        vBlocksSide[i].nTime = 7;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[4999];
+        vBlocksSide[i].BuildSkip();
+    }
+
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+
+    for (int n=0; n<1000; n++) {
+        int from = insecure_rand() % 10000;
+        int to = insecure_rand() % (from + 1);
+        BOOST_CHECK(chain.GetAncestor(&vBlocksMain[from], to) == &vBlocksMain[to]);
+        BOOST_CHECK_EQUAL(chain.GetBlockTime(to), vBlocksMain[to].GetBlockTime());
+
+        // Blocks off the chain go through the skiplist.
+        int fromSide = insecure_rand() % 6000;
+        int toSide = insecure_rand() % (fromSide + 5001);
+        CBlockIndex* pexpected = toSide < 5000 ? &vBlocksMain[toSide] : &vBlocksSide[toSide - 5000];
+        BOOST_CHECK(chain.GetAncestor(&vBlocksSide[fromSide], toSide) == pexpected);
+    }
+    BOOST_CHECK(chain.GetAncestor(&vBlocksMain[10], 11) == NULL);
+
+    // Reorganizing to the branch rewrites the arrays above the fork.
+    chain.SetTip(&vBlocksSide.back());
+    BOOST_CHECK(chain.GetAncestor(&vBlocksSide.back(), 7000) == &vBlocksSide[2000]);
+    BOOST_CHECK(chain.GetAncestor(&vBlocksMain[9000], 7000) == &vBlocksMain[7000]);
+    BOOST_CHECK_EQUAL(chain.GetBlockTime(5000), 7);
+    BOOST_CHECK_EQUAL(chain.GetBlockTime(4999), vBlocksMain[4999].GetBlockTime());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,86 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sync.h"
+
+#include "utiltime.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(sync_tests)
+
+static CCriticalSection csLockStatsTest;
+static CSemaphore semLockStatsTest(0);
+
+static void LockStatsContender()
+{
+    {
+        TRY_LOCK(csLockStatsTest, lockTry);
+        BOOST_CHECK(!lockTry);
+    }
+    semLockStatsTest.post();
+    LOCK(csLockStatsTest);
+}
+
+static const CLockSiteStats* FindLockSite(const std::vector<CLockSiteStats>& vStats, int nLine)
+{
+    for (unsigned int i = 0; i < vStats.size(); i++)
+        if (vStats[i].nLine == nLine && std::string(vStats[i].pszName) == "csLockStatsTest")
+            return &vStats[i];
+    return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(lockstats)
+{
+    fLockStats = true;
+    ResetLockStats();
+
+    int nLineHolder;
+    boost::thread_group threadGroup;
+    {
+        LOCK(csLockStatsTest); nLineHolder = __LINE__;
+        threadGroup.create_thread(&LockStatsContender);
+        // Hold on until the contender failed its TRY_LOCK and is waiting on its LOCK
+        semLockStatsTest.wait();
+        MilliSleep(50);
+    }
+    // The contender exits, retiring its statistics
+    threadGroup.join_all();
+    fLockStats = false;
+
+    std::vector<CLockSiteStats> vStats = GetLockStats();
+    const CLockSiteStats* pHolder = FindLockSite(vStats, nLineHolder);
+    BOOST_REQUIRE(pHolder != NULL);
+    BOOST_CHECK_EQUAL(pHolder->nCount, 1U);
+    BOOST_CHECK_EQUAL(pHolder->nContended, 0U);
+    BOOST_CHECK(pHolder->nHoldMax >= 40 * 1000 * 1000);
+
+    uint64_t nTryFailed = 0, nContended = 0;
+    for (unsigned int i = 0; i < vStats.size(); i++) {
+        if (std::string(vStats[i].pszName) != "csLockStatsTest")
+            continue;
+        nTryFailed += vStats[i].nTryFailed;
+        nContended += vStats[i].nContended;
+        uint64_t nWaits = 0, nHolds = 0;
+        for (int j = 0; j < LOCKSTATS_HISTOGRAM_BUCKETS; j++) {
+            nWaits += vStats[i].nWaitHistogram[j];
+            nHolds += vStats[i].nHoldHistogram[j];
+        }
+        BOOST_CHECK_EQUAL(nWaits, vStats[i].nCount);
+        BOOST_CHECK_EQUAL(nHolds, vStats[i].nCount);
+    }
+    BOOST_CHECK_EQUAL(nTryFailed, 1U);
+    BOOST_CHECK_EQUAL(nContended, 1U);
+    // Sorted by total wait, the contended LOCK first
+    BOOST_CHECK(vStats[0].nContended == 1 && vStats[0].nWaitMax > 0);
+
+    ResetLockStats();
+    BOOST_CHECK(FindLockSite(GetLockStats(), nLineHolder) == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
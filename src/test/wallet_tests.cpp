@@ -4,6 +4,9 @@
 
 #include "wallet.h"
 
+#include "main.h"
+#include "txmempool.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -21,6 +24,8 @@
 
 using namespace std;
 
+extern CWallet* pwalletMain;
+
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_AUTO_TEST_SUITE(wallet_tests)
@@ -305,4 +310,88 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_exact_match)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+    for (int i = 0; i < 2000; i++)
+        add_coin(2 * CENT + i);
+    add_coin(17 * CENT);
+    add_coin(23 * CENT);
+
+    // 17 + 23 + 2 + (2 cents and 1 satoshi) is the only way to hit this exactly
+    BOOST_CHECK(wallet.SelectCoinsMinConf(44 * CENT + 1, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 44 * CENT + 1);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 4U);
+
+    // Without an exact match we still get a usable selection
+    BOOST_CHECK(wallet.SelectCoinsMinConf(1 * COIN, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_GE(nValueRet, 1 * COIN);
+    empty_wallet();
+}
+
+static int count_available(const uint256& hash)
+{
+    vector<COutput> vAvailable;
+    pwalletMain->AvailableCoins(vAvailable, false);
+    int n = 0;
+    BOOST_FOREACH(const COutput& out, vAvailable)
+        if (out.tx->GetHash() == hash)
+            n++;
+    return n;
+}
+
+BOOST_AUTO_TEST_CASE(unspent_tx_tracking)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    CAmount nUnconfirmed = pwalletMain->GetUnconfirmedBalance();
+
+    // Unconfirmed payment to us
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFund.vout.resize(1);
+    txFund.vout[0].nValue = COIN;
+    txFund.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    CTransaction tx1(txFund);
+    mempool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 0, 0, 0.0, 1));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, tx1)));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed + COIN);
+    BOOST_CHECK_EQUAL(count_available(tx1.GetHash()), 1);
+
+    // Spending it removes it from the balance and from AvailableCoins
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = COIN;
+    txSpend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CTransaction tx2(txSpend);
+    mempool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 0, 0, 0.0, 1));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, tx2)));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed);
+    BOOST_CHECK_EQUAL(count_available(tx1.GetHash()), 0);
+
+    // Same answer after a full rebuild
+    pwalletMain->MarkDirty();
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed);
+    BOOST_CHECK_EQUAL(count_available(tx1.GetHash()), 0);
+
+    // Conflicted spend (no longer in the mempool) makes the coin available again
+    list<CTransaction> removed;
+    mempool.remove(tx2, removed, false);
+    BOOST_CHECK_EQUAL(count_available(tx1.GetHash()), 1);
+
+    mempool.remove(tx1, removed, true);
+    pwalletMain->EraseFromWallet(tx2.GetHash());
+    pwalletMain->EraseFromWallet(tx1.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
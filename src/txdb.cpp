@@ -5,6 +5,7 @@
 
 #include "txdb.h"
 
+#include "bloom.h"
 #include "pow.h"
 #include "uint256.h"
 
@@ -163,6 +164,117 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+static void BatchAddressUnspentIndex(CLevelDBBatch& batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >&vect) {
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('u', it->first));
+        else
+            batch.Write(make_pair('u', it->first), it->second);
+    }
+}
+
+bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> >&vect,
+                                     const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >&vectUnspent) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair('a', it->first), it->second);
+    BatchAddressUnspentIndex(batch, vectUnspent);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> >&vect,
+                                     const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >&vectUnspent) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Erase(make_pair('a', it->first));
+    BatchAddressUnspentIndex(batch, vectUnspent);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(unsigned char type, const uint160 &hashBytes,
+                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &vect,
+                                    int nStart, int nEnd) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('a', CAddressIndexIteratorKey(type, hashBytes, nStart));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'a')
+                break;
+            CAddressIndexKey indexKey;
+            ssKey >> indexKey;
+            if (indexKey.type != type || indexKey.hashBytes != hashBytes)
+                break;
+            if (nEnd > 0 && indexKey.blockHeight > nEnd)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAmount nValue;
+            ssValue >> nValue;
+            vect.push_back(make_pair(indexKey, nValue));
+            pcursor->Next();
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(unsigned char type, const uint160 &hashBytes,
+                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('u', CAddressUnspentIteratorKey(type, hashBytes));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'u')
+                break;
+            CAddressUnspentKey indexKey;
+            ssKey >> indexKey;
+            if (indexKey.type != type || indexKey.hashBytes != hashBytes)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressUnspentValue nValue;
+            ssValue >> nValue;
+            vect.push_back(make_pair(indexKey, nValue));
+            pcursor->Next();
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    return true;
+}
+
+bool CBlockTreeDB::ReadBlockFilter(const uint256 &hash, CBloomFilter &filter) {
+    if (!Read(make_pair('g', hash), filter))
+        return false;
+    filter.UpdateEmptyFull();
+    return true;
+}
+
+bool CBlockTreeDB::WriteBlockFilter(const uint256 &hash, const CBloomFilter &filter) {
+    return Write(make_pair('g', hash), filter);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
 }
@@ -175,6 +287,18 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteBlockIndexSnapshot(const uint256 &id) {
+    return Write('S', id, true);
+}
+
+bool CBlockTreeDB::ReadBlockIndexSnapshot(uint256 &id) {
+    return Read('S', id);
+}
+
+bool CBlockTreeDB::EraseBlockIndexSnapshot() {
+    return Erase('S', true);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "addressindex.h"
 #include "leveldbwrapper.h"
 #include "main.h"
 
@@ -14,6 +15,7 @@
 #include <utility>
 #include <vector>
 
+class CBloomFilter;
 class CCoins;
 class uint256;
 
@@ -57,8 +59,28 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    /**
+     * Write (or erase, when disconnecting) the address index entries of a
+     * block, together with its unspent output changes (null values erase),
+     * in one atomic batch
+     */
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect,
+                           const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vectUnspent);
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect,
+                           const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vectUnspent);
+    /** Read the entries of an address between heights nStart and nEnd (0 for no upper bound) */
+    bool ReadAddressIndex(unsigned char type, const uint160 &hashBytes,
+                          std::vector<std::pair<CAddressIndexKey, CAmount> > &vect,
+                          int nStart = 0, int nEnd = 0);
+    bool ReadAddressUnspentIndex(unsigned char type, const uint160 &hashBytes,
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    bool ReadBlockFilter(const uint256 &hash, CBloomFilter &filter);
+    bool WriteBlockFilter(const uint256 &hash, const CBloomFilter &filter);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WriteBlockIndexSnapshot(const uint256 &id);
+    bool ReadBlockIndexSnapshot(uint256 &id);
+    bool EraseBlockIndexSnapshot();
     bool LoadBlockIndexGuts();
 };
 
@@ -0,0 +1,240 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2014 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txorphanpool.h"
+
+#include "primitives/block.h"
+#include "util.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <boost/foreach.hpp>
+#include <boost/tuple/tuple.hpp>
+
+using namespace std;
+
+COrphanTx::COrphanTx(const CTransaction& _tx, NodeId _fromPeer, int64_t _nTimeExpire):
+    tx(_tx), fromPeer(_fromPeer), nTimeExpire(_nTimeExpire)
+{
+    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+}
+
+CTxOrphanPool::CTxOrphanPool() :
+    nTotalBytes(0), nNextSweep(0)
+{
+}
+
+bool CTxOrphanPool::AddTx(const CTransaction& tx, NodeId peer)
+{
+    LOCK(cs);
+    const uint256& hash = tx.GetHash();
+    if (mapOrphans.count(hash))
+        return false;
+
+    // Ignore big transactions, to avoid a
+    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
+    // large transaction with a missing parent then we assume
+    // it will rebroadcast it later, after the parent transaction(s)
+    // have been mined or received.
+    COrphanTx orphan(tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME);
+    if (orphan.nTxSize > MAX_ORPHAN_TX_SIZE)
+    {
+        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", orphan.nTxSize, hash.ToString());
+        return false;
+    }
+
+    mapOrphans.insert(orphan);
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        mapOrphansByPrev[txin.prevout.hash].insert(hash);
+    mapPeerBytes[peer] += orphan.nTxSize;
+    nTotalBytes += orphan.nTxSize;
+
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u bytes %u)\n", hash.ToString(),
+             mapOrphans.size(), mapOrphansByPrev.size(), nTotalBytes);
+    return true;
+}
+
+bool CTxOrphanPool::HaveTx(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapOrphans.count(hash);
+}
+
+void CTxOrphanPool::removeUnchecked(orphaniter it)
+{
+    const uint256& hash = it->tx.GetHash();
+    BOOST_FOREACH(const CTxIn& txin, it->tx.vin)
+    {
+        map<uint256, set<uint256> >::iterator itPrev = mapOrphansByPrev.find(txin.prevout.hash);
+        if (itPrev == mapOrphansByPrev.end())
+            continue;
+        itPrev->second.erase(hash);
+        if (itPrev->second.empty())
+            mapOrphansByPrev.erase(itPrev);
+    }
+
+    map<NodeId, size_t>::iterator itPeer = mapPeerBytes.find(it->fromPeer);
+    if (itPeer != mapPeerBytes.end()) {
+        itPeer->second -= it->nTxSize;
+        if (itPeer->second == 0)
+            mapPeerBytes.erase(itPeer);
+    }
+    // A queued entry for this orphan is simply skipped once popped
+    nTotalBytes -= it->nTxSize;
+    mapOrphans.erase(it);
+}
+
+int CTxOrphanPool::EraseTx(const uint256& hash)
+{
+    LOCK(cs);
+    orphaniter it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return 0;
+    removeUnchecked(it);
+    return 1;
+}
+
+int CTxOrphanPool::EraseForPeer(NodeId peer)
+{
+    LOCK(cs);
+    int nErased = 0;
+    indexed_orphan_set::index<orphan_peer>::type::iterator it = mapOrphans.get<orphan_peer>().lower_bound(boost::make_tuple(peer));
+    while (it != mapOrphans.get<orphan_peer>().end() && it->fromPeer == peer)
+    {
+        // step past the orphan before it is erased
+        orphaniter itErase = mapOrphans.project<0>(it++);
+        removeUnchecked(itErase);
+        ++nErased;
+    }
+    mapWorkSet.erase(peer);
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+    return nErased;
+}
+
+int CTxOrphanPool::EraseForBlock(const CBlock& block)
+{
+    LOCK(cs);
+    set<uint256> setErase;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        if (mapOrphans.count(tx.GetHash()))
+            setErase.insert(tx.GetHash());
+        // Orphans spending any of the same outputs can never be accepted
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            map<uint256, set<uint256> >::const_iterator itPrev = mapOrphansByPrev.find(txin.prevout.hash);
+            if (itPrev == mapOrphansByPrev.end())
+                continue;
+            BOOST_FOREACH(const uint256& orphanHash, itPrev->second)
+            {
+                const CTransaction& orphanTx = mapOrphans.find(orphanHash)->tx;
+                BOOST_FOREACH(const CTxIn& orphanIn, orphanTx.vin)
+                {
+                    if (orphanIn.prevout == txin.prevout) {
+                        setErase.insert(orphanHash);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    BOOST_FOREACH(const uint256& hash, setErase)
+        removeUnchecked(mapOrphans.find(hash));
+    if (!setErase.empty()) LogPrint("mempool", "Erased %d orphan tx included or conflicted by block\n", setErase.size());
+    return setErase.size();
+}
+
+unsigned int CTxOrphanPool::LimitOrphans(unsigned int nMaxOrphans, size_t nMaxBytes)
+{
+    LOCK(cs);
+
+    int64_t nNow = GetTime();
+    if (nNextSweep <= nNow) {
+        // Sweep out expired orphan pool entries:
+        int nErased = 0;
+        indexed_orphan_set::index<orphan_expiry>::type::iterator it = mapOrphans.get<orphan_expiry>().begin();
+        while (it != mapOrphans.get<orphan_expiry>().end() && it->nTimeExpire <= nNow)
+        {
+            orphaniter itErase = mapOrphans.project<0>(it++);
+            removeUnchecked(itErase);
+            ++nErased;
+        }
+        nNextSweep = nNow + ORPHAN_TX_EXPIRE_INTERVAL;
+        if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
+    }
+
+    unsigned int nEvicted = 0;
+    while (mapOrphans.size() > nMaxOrphans || nTotalBytes > nMaxBytes)
+    {
+        // Evict the oldest orphan of the peer using the most space:
+        map<NodeId, size_t>::const_iterator itHeaviest = mapPeerBytes.begin();
+        for (map<NodeId, size_t>::const_iterator itPeer = mapPeerBytes.begin(); itPeer != mapPeerBytes.end(); ++itPeer)
+            if (itPeer->second > itHeaviest->second)
+                itHeaviest = itPeer;
+        indexed_orphan_set::index<orphan_peer>::type::iterator it = mapOrphans.get<orphan_peer>().lower_bound(boost::make_tuple(itHeaviest->first));
+        removeUnchecked(mapOrphans.project<0>(it));
+        ++nEvicted;
+    }
+    return nEvicted;
+}
+
+void CTxOrphanPool::AddChildrenToWorkSet(const CTransaction& tx)
+{
+    LOCK(cs);
+    map<uint256, set<uint256> >::const_iterator itByPrev = mapOrphansByPrev.find(tx.GetHash());
+    if (itByPrev == mapOrphansByPrev.end())
+        return;
+    BOOST_FOREACH(const uint256& orphanHash, itByPrev->second)
+    {
+        orphaniter it = mapOrphans.find(orphanHash);
+        mapWorkSet[it->fromPeer].insert(orphanHash);
+    }
+}
+
+bool CTxOrphanPool::HaveTxToReconsider(NodeId peer) const
+{
+    LOCK(cs);
+    return mapWorkSet.count(peer);
+}
+
+bool CTxOrphanPool::GetTxToReconsider(NodeId peer, CTransaction& tx)
+{
+    LOCK(cs);
+    map<NodeId, set<uint256> >::iterator itWork = mapWorkSet.find(peer);
+    while (itWork != mapWorkSet.end())
+    {
+        uint256 hash = *itWork->second.begin();
+        itWork->second.erase(itWork->second.begin());
+        if (itWork->second.empty()) {
+            mapWorkSet.erase(itWork);
+            itWork = mapWorkSet.end();
+        }
+        orphaniter it = mapOrphans.find(hash);
+        if (it != mapOrphans.end()) {
+            tx = it->tx;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CTxOrphanPool::clear()
+{
+    LOCK(cs);
+    mapOrphans.clear();
+    mapOrphansByPrev.clear();
+    mapPeerBytes.clear();
+    mapWorkSet.clear();
+    nTotalBytes = 0;
+    nNextSweep = 0;
+}
+
+size_t CTxOrphanPool::PeerBytes(NodeId peer) const
+{
+    LOCK(cs);
+    map<NodeId, size_t>::const_iterator it = mapPeerBytes.find(peer);
+    return it == mapPeerBytes.end() ? 0 : it->second;
+}
@@ -0,0 +1,162 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2014 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXORPHANPOOL_H
+#define BITCOIN_TXORPHANPOOL_H
+
+#include <map>
+#include <set>
+
+#include "net.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+class CBlock;
+
+/** Orphan transactions larger than this (in bytes) are not stored */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Time (in seconds) an orphan transaction is kept waiting for its parents */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Minimum time (in seconds) between two sweeps for expired orphans */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
+/** Maximum number of orphans reconsidered for a peer per message handler pass */
+static const unsigned int ORPHAN_WORK_BATCH_SIZE = 10;
+
+/**
+ * A transaction we received but could not validate because some of its
+ * inputs are unknown, along with the peer that sent it to us.
+ */
+class COrphanTx
+{
+public:
+    CTransaction tx;
+    NodeId fromPeer;
+    int64_t nTimeExpire; //! Time after which the orphan is dropped
+    unsigned int nTxSize; //! Serialized size, accounted against the byte limits
+
+    COrphanTx(const CTransaction& _tx, NodeId _fromPeer, int64_t _nTimeExpire);
+};
+
+// extracts a COrphanTx's transaction hash
+struct orphantx_txid
+{
+    typedef uint256 result_type;
+    result_type operator() (const COrphanTx &orphan) const
+    {
+        return orphan.tx.GetHash();
+    }
+};
+
+// Multi_index tags
+struct orphan_peer {};
+struct orphan_expiry {};
+
+/**
+ * Pool of orphan transactions.
+ *
+ * Orphans are indexed by txid, by announcing peer (oldest first) and by
+ * expiry time, so that dropping a peer, expiring old orphans and evicting
+ * the oldest orphan of the peer using the most space never scan the whole
+ * pool. mapOrphansByPrev links the txid of every missing parent to the
+ * orphans spending it.
+ *
+ * When a parent is accepted its orphaned children are not validated right
+ * away. They are queued on the work set of the peer that sent them and are
+ * reconsidered in small batches from that peer's message handler pass (see
+ * GetTxToReconsider), so a long chain of orphans never holds cs_main for a
+ * single long stretch.
+ *
+ * The pool is guarded by its own lock and may be used with or without
+ * cs_main held.
+ */
+class CTxOrphanPool
+{
+public:
+    typedef boost::multi_index_container<
+        COrphanTx,
+        boost::multi_index::indexed_by<
+            // sorted by txid
+            boost::multi_index::ordered_unique<orphantx_txid>,
+            // sorted by announcing peer, then by age
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<orphan_peer>,
+                boost::multi_index::composite_key<
+                    COrphanTx,
+                    boost::multi_index::member<COrphanTx, NodeId, &COrphanTx::fromPeer>,
+                    boost::multi_index::member<COrphanTx, int64_t, &COrphanTx::nTimeExpire>
+                >
+            >,
+            // sorted by expiry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<orphan_expiry>,
+                boost::multi_index::member<COrphanTx, int64_t, &COrphanTx::nTimeExpire>
+            >
+        >
+    > indexed_orphan_set;
+
+private:
+    typedef indexed_orphan_set::nth_index<0>::type::iterator orphaniter;
+
+    mutable CCriticalSection cs;
+    indexed_orphan_set mapOrphans;
+    std::map<uint256, std::set<uint256> > mapOrphansByPrev;
+    std::map<NodeId, size_t> mapPeerBytes; //! Bytes of orphans held per announcing peer
+    std::map<NodeId, std::set<uint256> > mapWorkSet; //! Orphans to reconsider, per announcing peer
+    size_t nTotalBytes;
+    int64_t nNextSweep;
+
+    void removeUnchecked(orphaniter it);
+
+public:
+    CTxOrphanPool();
+
+    /** Store a transaction with missing inputs; false if it is already known or too large */
+    bool AddTx(const CTransaction& tx, NodeId peer);
+    bool HaveTx(const uint256& hash) const;
+    /** Remove a single orphan, returning the number removed (0 or 1) */
+    int EraseTx(const uint256& hash);
+    /** Remove every orphan sent by a peer, along with its work set */
+    int EraseForPeer(NodeId peer);
+    /** Remove orphans included in a block or conflicting with it */
+    int EraseForBlock(const CBlock& block);
+    /**
+     * Expire old orphans (at most once every ORPHAN_TX_EXPIRE_INTERVAL), then
+     * evict until at most nMaxOrphans orphans using at most nMaxBytes remain.
+     * Each eviction drops the oldest orphan of the peer using the most bytes,
+     * so a flooding peer only ever pushes out its own transactions.
+     * Returns the number of evicted (not expired) orphans.
+     */
+    unsigned int LimitOrphans(unsigned int nMaxOrphans, size_t nMaxBytes);
+
+    /** Queue the orphans spending outputs of tx for reconsideration */
+    void AddChildrenToWorkSet(const CTransaction& tx);
+    bool HaveTxToReconsider(NodeId peer) const;
+    /**
+     * Pop the next orphan sent by peer that is waiting to be reconsidered.
+     * The orphan stays in the pool; the caller erases it once it is accepted
+     * or found invalid.
+     */
+    bool GetTxToReconsider(NodeId peer, CTransaction& tx);
+
+    void clear();
+    unsigned long size() const
+    {
+        LOCK(cs);
+        return mapOrphans.size();
+    }
+    size_t TotalBytes() const
+    {
+        LOCK(cs);
+        return nTotalBytes;
+    }
+    size_t PeerBytes(NodeId peer) const;
+};
+
+#endif // BITCOIN_TXORPHANPOOL_H
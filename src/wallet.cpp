@@ -6,6 +6,7 @@
 #include "wallet.h"
 
 #include "base58.h"
+#include "bloom.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
 #include "net.h"
@@ -18,6 +19,7 @@
 #include <assert.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -157,6 +159,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    fUnspentTxsDirty = true;
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -182,6 +185,7 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    fUnspentTxsDirty = true;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -194,6 +198,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    fUnspentTxsDirty = true;
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -398,6 +403,84 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+/**
+ * Outpoint is spent by a wallet transaction that is confirmed in the main
+ * chain. Unlike IsSpent this can only change when that spender is
+ * (dis)connected, so it is safe to cache on.
+ */
+bool CWallet::IsSpentInMainChain(const uint256& hash, unsigned int n) const
+{
+    const COutPoint outpoint(hash, n);
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+    range = mapTxSpends.equal_range(outpoint);
+
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+    {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.IsInMainChain())
+            return true;
+    }
+    return false;
+}
+
+bool CWallet::MayHaveUnspentOutputs(const CWalletTx& wtx) const
+{
+    const uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        if (IsMine(wtx.vout[i]) != ISMINE_NO && !IsSpentInMainChain(hash, i))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Re-evaluate setUnspentTxs membership of wtx and of the wallet
+ * transactions it spends from, after wtx was added or changed state.
+ */
+void CWallet::UpdateUnspentTxs(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (fUnspentTxsDirty)
+        return; // Will be rebuilt on next use
+
+    if (MayHaveUnspentOutputs(wtx))
+        setUnspentTxs.insert(wtx.GetHash());
+    else
+        setUnspentTxs.erase(wtx.GetHash());
+
+    if (wtx.IsCoinBase())
+        return;
+    BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+    {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(txin.prevout.hash);
+        if (mit == mapWallet.end())
+            continue;
+        if (MayHaveUnspentOutputs(mit->second))
+            setUnspentTxs.insert(mit->first);
+        else
+            setUnspentTxs.erase(mit->first);
+    }
+}
+
+const std::set<uint256>& CWallet::GetUnspentTxs() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (fUnspentTxsDirty)
+    {
+        int64_t nStart = GetTimeMillis();
+        setUnspentTxs.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            if (MayHaveUnspentOutputs(it->second))
+                setUnspentTxs.insert(setUnspentTxs.end(), it->first);
+        fUnspentTxsDirty = false;
+        LogPrint("db", "%s: %u of %u wallet transactions have unspent outputs, %dms\n", __func__,
+                 setUnspentTxs.size(), mapWallet.size(), GetTimeMillis() - nStart);
+    }
+    return setUnspentTxs;
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -555,6 +638,8 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        // Keys or scripts may have been imported, so IsMine may have changed
+        fUnspentTxsDirty = true;
     }
 }
 
@@ -567,6 +652,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         AddToSpends(hash);
+        fUnspentTxsDirty = true;
     }
     else
     {
@@ -661,6 +747,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        UpdateUnspentTxs(wtx);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -724,7 +811,10 @@ void CWallet::EraseFromWallet(const uint256 &hash)
     {
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
+        {
             CWalletDB(strWalletFile).EraseTx(hash);
+            fUnspentTxsDirty = true;
+        }
     }
     return;
 }
@@ -924,51 +1014,347 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+namespace {
+
+/**
+ * A block read by a rescan worker, with the transactions that pay to us
+ * marked. If its -blockfilterindex filter showed nothing of ours, it is not
+ * read at all and only the filter is passed on.
+ */
+struct CRescanBlock
+{
+    CBlock block;
+    std::vector<char> vfMine;
+    bool fSkipped;
+    bool fReadFailed;
+    CBloomFilter filter;
+
+    CRescanBlock() : fSkipped(false), fReadFailed(false) {}
+};
+
+void MarkWalletOutputs(const CWallet& wallet, CRescanBlock& rblock)
+{
+    rblock.vfMine.assign(rblock.block.vtx.size(), false);
+    for (unsigned int i = 0; i < rblock.block.vtx.size(); i++)
+    {
+        BOOST_FOREACH(const CTxOut& txout, rblock.block.vtx[i].vout)
+        {
+            if (wallet.IsMine(txout) != ISMINE_NO)
+            {
+                rblock.vfMine[i] = true;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Read a block of a rescan from its position copied under cs_main, as
+ * pruning may reset the index's position meanwhile.
+ */
+bool ReadRescanBlock(CBlock& block, const CBlockIndex* pindex, const CDiskBlockPos& pos)
+{
+    if (pos.IsNull() || !ReadBlockFromDisk(block, pos))
+        return false;
+    return block.GetHash() == pindex->GetBlockHash();
+}
+
+/**
+ * Reads the blocks of a rescan ahead of the scanning thread on a few worker
+ * threads, and checks their outputs against the wallet's keys and scripts.
+ * IsMine only needs the keystore lock, so this runs without cs_main or
+ * cs_wallet held. Blocks are handed out by Next() in chain order.
+ */
+class CRescanReader
+{
+private:
+    const CWallet& wallet;
+    const std::vector<CBlockIndex*>& vBlocks;
+    const std::vector<CDiskBlockPos>& vBlockPos;
+    //! What to look up in block filters, or NULL to read every block
+    const std::vector<std::vector<unsigned char> >* pvFilterElements;
+    const std::vector<COutPoint>* pvFilterOutpoints;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::map<size_t, CRescanBlock*> mapReady;
+    size_t nNextRead;
+    size_t nNextConsume;
+    bool fStop;
+    boost::thread_group threads;
+
+    void ThreadRead()
+    {
+        while (true)
+        {
+            size_t nPos;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNextRead < vBlocks.size() && nNextRead >= nNextConsume + RESCAN_READ_AHEAD)
+                    cond.wait(lock);
+                if (fStop || nNextRead >= vBlocks.size())
+                    return;
+                nPos = nNextRead++;
+            }
+
+            CRescanBlock* pblock = new CRescanBlock();
+            if (pvFilterElements && ReadBlockFilter(vBlocks[nPos], pblock->filter) && !FilterMatches(pblock->filter))
+                pblock->fSkipped = true;
+            else if (!ReadRescanBlock(pblock->block, vBlocks[nPos], vBlockPos[nPos]))
+                pblock->fReadFailed = true;
+            else
+                MarkWalletOutputs(wallet, *pblock);
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                mapReady[nPos] = pblock;
+            }
+            cond.notify_all();
+        }
+    }
+
+    bool FilterMatches(const CBloomFilter& filter) const
+    {
+        BOOST_FOREACH(const std::vector<unsigned char>& vElement, *pvFilterElements)
+            if (filter.contains(vElement))
+                return true;
+        BOOST_FOREACH(const COutPoint& outpoint, *pvFilterOutpoints)
+            if (filter.contains(outpoint))
+                return true;
+        return false;
+    }
+
+public:
+    CRescanReader(const CWallet& walletIn, const std::vector<CBlockIndex*>& vBlocksIn,
+                  const std::vector<CDiskBlockPos>& vBlockPosIn,
+                  const std::vector<std::vector<unsigned char> >* pvFilterElementsIn,
+                  const std::vector<COutPoint>* pvFilterOutpointsIn) :
+        wallet(walletIn), vBlocks(vBlocksIn), vBlockPos(vBlockPosIn), pvFilterElements(pvFilterElementsIn), pvFilterOutpoints(pvFilterOutpointsIn),
+        nNextRead(0), nNextConsume(0), fStop(false)
+    {
+        int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_RESCAN_THREADS));
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CRescanReader::ThreadRead, this));
+    }
+
+    ~CRescanReader()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+        threads.join_all();
+        for (std::map<size_t, CRescanBlock*>::iterator it = mapReady.begin(); it != mapReady.end(); ++it)
+            delete it->second;
+    }
+
+    /** Wait for the next block in chain order. The caller owns the result. */
+    CRescanBlock* Next()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nNextConsume >= vBlocks.size())
+            return NULL;
+        std::map<size_t, CRescanBlock*>::iterator it;
+        while ((it = mapReady.find(nNextConsume)) == mapReady.end())
+            cond.wait(lock);
+        CRescanBlock* pblock = it->second;
+        mapReady.erase(it);
+        nNextConsume++;
+        cond.notify_all();
+        return pblock;
+    }
+};
+
+} // anon namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read and matched against our keys by CRescanReader; this
+ * thread only takes cs_main and cs_wallet to add the candidate transactions
+ * of a block, so the node keeps running during long rescans. With
+ * -blockfilterindex, blocks whose filter shows nothing of ours are not read.
+ * Blocks connected in the meantime are scanned at the end, with both locks
+ * held. Returns the number of transactions added or updated, or -1 if a
+ * block could not be read, in which case the rescan is aborted.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
     int64_t nNow = GetTime();
 
-    CBlockIndex* pindex = pindexStart;
+    std::vector<CBlockIndex*> vBlocks;
+    std::vector<CDiskBlockPos> vBlockPos;
+    const CBlockIndex* pindexSnapshotTip = NULL;
+    // Transactions spending from any of these may be ours too
+    std::set<uint256> setWalletTxids;
     {
         LOCK2(cs_main, cs_wallet);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
+        CBlockIndex* pindex = pindexStart;
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
+        for (; pindex; pindex = chainActive.Next(pindex))
+        {
+            vBlocks.push_back(pindex);
+            vBlockPos.push_back(pindex->GetBlockPos());
+        }
+        pindexSnapshotTip = chainActive.Tip();
+
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            setWalletTxids.insert(setWalletTxids.end(), it->first);
+    }
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        while (pindex)
+    // Filter lookups cost time proportional to the size of the wallet, so
+    // only use the filter index when that is cheaper than reading blocks
+    std::vector<std::vector<unsigned char> > vFilterElements;
+    std::vector<COutPoint> vFilterOutpoints, vNewOutpoints;
+    bool fUseFilters = false;
+    if (fBlockFilterIndex)
+    {
+        GetBlockFilterElements(vFilterElements, vFilterOutpoints);
+        fUseFilters = vFilterElements.size() + vFilterOutpoints.size() <= MAX_RESCAN_FILTER_ELEMENTS;
+    }
+    int nSkipped = 0;
+
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+    double dProgressStart = Checkpoints::GuessVerificationProgress(vBlocks.empty() ? NULL : vBlocks.front(), false);
+    double dProgressTip = Checkpoints::GuessVerificationProgress(vBlocks.empty() ? NULL : vBlocks.back(), false);
+    {
+        CRescanReader reader(*this, vBlocks, vBlockPos, fUseFilters ? &vFilterElements : NULL, fUseFilters ? &vFilterOutpoints : NULL);
+        for (size_t i = 0; i < vBlocks.size(); i++)
         {
+            CBlockIndex* pindex = vBlocks[i];
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            boost::scoped_ptr<CRescanBlock> pblock(reader.Next());
+            if (pblock->fSkipped)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                // The reader only knew the outputs we had when the scan
+                // started; check those found since before skipping
+                bool fMatch = false;
+                for (unsigned int j = 0; j < vNewOutpoints.size() && !fMatch; j++)
+                    fMatch = pblock->filter.contains(vNewOutpoints[j]);
+                if (fMatch)
+                {
+                    if (!ReadRescanBlock(pblock->block, pindex, vBlockPos[i]))
+                        pblock->fReadFailed = true;
+                    else
+                        MarkWalletOutputs(*this, *pblock);
+                }
+                else
+                    nSkipped++;
             }
-            pindex = chainActive.Next(pindex);
+            if (pblock->fReadFailed)
+            {
+                LogPrintf("%s : failed to read block %s, aborting rescan\n", __func__, pindex->GetBlockHash().ToString());
+                ShowProgress(_("Rescanning..."), 100);
+                return -1;
+            }
+            const CBlock& block = pblock->block;
+
+            std::vector<const CTransaction*> vCandidates;
+            for (unsigned int j = 0; j < block.vtx.size(); j++)
+            {
+                const CTransaction& tx = block.vtx[j];
+                bool fCandidate = pblock->vfMine[j] || setWalletTxids.count(tx.GetHash());
+                for (unsigned int k = 0; k < tx.vin.size() && !fCandidate; k++)
+                    fCandidate = setWalletTxids.count(tx.vin[k].prevout.hash) != 0;
+                if (fCandidate)
+                    vCandidates.push_back(&tx);
+            }
+
+            if (!vCandidates.empty())
+            {
+                LOCK2(cs_main, cs_wallet);
+                // A block disconnected while we were reading reaches the
+                // wallet through SyncTransaction instead
+                if (chainActive.Contains(pindex))
+                {
+                    BOOST_FOREACH(const CTransaction* ptx, vCandidates)
+                    {
+                        if (AddToWalletIfInvolvingMe(*ptx, &block, fUpdate))
+                            ret++;
+                        if (mapWallet.count(ptx->GetHash()) && setWalletTxids.insert(ptx->GetHash()).second && fUseFilters)
+                        {
+                            for (unsigned int k = 0; k < ptx->vout.size(); k++)
+                                if (IsMine(ptx->vout[k]) != ISMINE_NO)
+                                    vNewOutpoints.push_back(COutPoint(ptx->GetHash(), k));
+                        }
+                    }
+                }
+            }
+
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+
+    // Blocks connected during the scan only reached us through
+    // SyncTransaction, maybe before we knew the outputs they spend. Holding
+    // both locks, scan everything past the snapshot's tip (or past the fork
+    // point, after a reorg); nothing can be connected meanwhile.
+    {
+        LOCK2(cs_main, cs_wallet);
+        const CBlockIndex* pindexFork = pindexSnapshotTip ? chainActive.FindFork(pindexSnapshotTip) : NULL;
+        for (CBlockIndex* pindex = pindexFork ? chainActive.Next(pindexFork) : chainActive.Genesis(); pindex; pindex = chainActive.Next(pindex))
+        {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex))
+            {
+                LogPrintf("%s : failed to read block %s, aborting rescan\n", __func__, pindex->GetBlockHash().ToString());
+                ShowProgress(_("Rescanning..."), 100);
+                return -1;
+            }
+            BOOST_FOREACH(const CTransaction& tx, block.vtx)
+                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                    ret++;
+        }
+    }
+
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+    if (fUseFilters)
+        LogPrintf("%s : block filter index let us skip %d of %u blocks\n", __func__, nSkipped, vBlocks.size());
     return ret;
 }
 
+/**
+ * What to look up in -blockfilterindex filters to find the blocks that may
+ * hold our transactions: our key ids and public keys, the hashes of our
+ * scripts, our watch-only scripts and our outputs, to find their spends.
+ */
+void CWallet::GetBlockFilterElements(std::vector<std::vector<unsigned char> >& vElements, std::vector<COutPoint>& vOutpoints) const
+{
+    LOCK2(cs_wallet, cs_KeyStore);
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    BOOST_FOREACH(const CKeyID& keyid, setKeys)
+    {
+        vElements.push_back(std::vector<unsigned char>(keyid.begin(), keyid.end()));
+        CPubKey pubkey;
+        if (GetPubKey(keyid, pubkey))
+            vElements.push_back(std::vector<unsigned char>(pubkey.begin(), pubkey.end()));
+    }
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+        vElements.push_back(std::vector<unsigned char>(it->first.begin(), it->first.end()));
+    BOOST_FOREACH(const CScript& script, setWatchOnly)
+        vElements.push_back(std::vector<unsigned char>(script.begin(), script.end()));
+
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        for (unsigned int i = 0; i < it->second.vout.size(); i++)
+            if (IsMine(it->second.vout[i]) != ISMINE_NO)
+                vOutpoints.push_back(COutPoint(it->first, i));
+    }
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     LOCK2(cs_main, cs_wallet);
@@ -1066,9 +1452,9 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const uint256& hash, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1082,9 +1468,9 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const uint256& hash, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1097,9 +1483,9 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const uint256& hash, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1111,9 +1497,9 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const uint256& hash, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1127,9 +1513,9 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const uint256& hash, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1142,9 +1528,9 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const uint256& hash, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -1160,10 +1546,9 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const uint256& wtxid, GetUnspentTxs())
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(wtxid)->second;
 
             if (!IsFinalTx(*pcoin))
                 continue;
@@ -1181,15 +1566,91 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue >= nMinimumInputThreshold &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
+                    !IsLockedCoin(wtxid, i) && pcoin->vout[i].nValue >= nMinimumInputThreshold &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(wtxid, i)))
                         vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
             }
         }
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+/**
+ * Depth-first branch and bound search for a subset of vValue (sorted by
+ * descending value) that adds up to exactly nTargetValue, so no change output
+ * is needed. Branches that overshoot the target or cannot reach it with the
+ * remaining coins are pruned, coins larger than the amount still missing are
+ * skipped, and of several equal-valued coins only the first is tried for
+ * exclusion. Gives up after nMaxTries steps.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTargetValue,
+                           vector<char>& vfBest, unsigned int nMaxTries = COINSELECT_BNB_MAX_TRIES)
+{
+    const size_t nCoins = vValue.size();
+
+    // vRemaining[i] is the sum of all coins from position i onwards
+    vector<CAmount> vRemaining(nCoins + 1, 0);
+    for (size_t i = nCoins; i > 0; i--)
+        vRemaining[i - 1] = vRemaining[i] + vValue[i - 1].first;
+    if (vRemaining[0] < nTargetValue)
+        return false;
+
+    vector<char> vfIncluded(nCoins, false);
+    CAmount nTotal = 0;
+    size_t nDepth = 0;
+    for (unsigned int nTries = 0; nTries < nMaxTries; nTries++)
+    {
+        if (nTotal == nTargetValue)
+        {
+            vfBest.assign(nCoins, false);
+            copy(vfIncluded.begin(), vfIncluded.begin() + nDepth, vfBest.begin());
+            return true;
+        }
+
+        if (nTotal > nTargetValue || nTotal + vRemaining[nDepth] < nTargetValue)
+        {
+            // Backtrack to the last included coin and try without it
+            while (nDepth > 0 && !vfIncluded[nDepth - 1])
+                nDepth--;
+            if (nDepth == 0)
+                return false; // Search space exhausted
+            vfIncluded[nDepth - 1] = false;
+            nTotal -= vValue[nDepth - 1].first;
+            continue;
+        }
+
+        // Coins bigger than what is still missing can't be part of this
+        // branch; skip past all of them at once
+        const CAmount nMissing = nTargetValue - nTotal;
+        if (vValue[nDepth].first > nMissing)
+        {
+            size_t nLow = nDepth, nHigh = nCoins;
+            while (nLow < nHigh)
+            {
+                size_t nMid = (nLow + nHigh) / 2;
+                if (vValue[nMid].first > nMissing)
+                    nLow = nMid + 1;
+                else
+                    nHigh = nMid;
+            }
+            fill(vfIncluded.begin() + nDepth, vfIncluded.begin() + nLow, false);
+            nDepth = nLow;
+            continue;
+        }
+
+        // Excluding a coin and then including an equal one just repeats the same branch
+        if (nDepth > 0 && !vfIncluded[nDepth - 1] && vValue[nDepth].first == vValue[nDepth - 1].first)
+            vfIncluded[nDepth] = false;
+        else
+        {
+            vfIncluded[nDepth] = true;
+            nTotal += vValue[nDepth].first;
+        }
+        nDepth++;
+    }
+    return false;
+}
+
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -1235,7 +1696,7 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
@@ -1248,10 +1709,15 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
+    // Visit the coins in random order so that ties are broken randomly
+    vector<unsigned int> vOrder(vCoins.size());
+    for (unsigned int i = 0; i < vOrder.size(); i++)
+        vOrder[i] = i;
+    random_shuffle(vOrder.begin(), vOrder.end(), GetRandInt);
 
-    BOOST_FOREACH(const COutput &output, vCoins)
+    BOOST_FOREACH(unsigned int nPos, vOrder)
     {
+        const COutput &output = vCoins[nPos];
         if (!output.fSpendable)
             continue;
 
@@ -1301,14 +1767,32 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
     sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+    // Look for an exact match first; an exact subset always beats the next bigger coin
+    if (SelectCoinsBnB(vValue, nTargetValue, vfBest))
+    {
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+            {
+                setCoinsRet.insert(vValue[i].second);
+                nValueRet += vValue[i].first;
+            }
+        LogPrint("selectcoins", "SelectCoins() exact match with %u coins\n", setCoinsRet.size());
+        return true;
+    }
+
+    // Solve subset sum by stochastic approximation, visiting a bounded
+    // number of coins in total so large wallets stay fast
+    int nIterations = 1000;
+    if (vValue.size() * nIterations > COINSELECT_KNAPSACK_MAX_VISITS)
+        nIterations = std::max((size_t)10, COINSELECT_KNAPSACK_MAX_VISITS / vValue.size());
+
+    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nIterations);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, nIterations);
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -1336,11 +1820,8 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     return true;
 }
 
-bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(const vector<COutput>& vCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
 {
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, coinControl);
-
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected())
     {
@@ -1388,6 +1869,13 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, CAmount> >& vecSend,
     {
         LOCK2(cs_main, cs_wallet);
         {
+            // The candidate coins don't change while we hold the locks, so
+            // only collect them once rather than on every fee iteration
+            vector<COutput> vAvailableCoins;
+            AvailableCoins(vAvailableCoins, true, coinControl);
+
+            set<pair<const CWalletTx*,unsigned int> > setCoins;
+            CAmount nValueIn = 0;
             nFeeRet = 0;
             while (true)
             {
@@ -1414,13 +1902,18 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, CAmount> >& vecSend,
                     txNew.vout.push_back(txout);
                 }
 
-                // Choose coins to use
-                set<pair<const CWalletTx*,unsigned int> > setCoins;
-                CAmount nValueIn = 0;
-                if (!SelectCoins(nTotalValue, setCoins, nValueIn, coinControl))
+                // Choose coins to use. If the coins picked on the previous
+                // pass still cover the higher fee, keep them and just take
+                // the difference out of the change.
+                if (setCoins.empty() || nValueIn < nTotalValue)
                 {
-                    strFailReason = _("Insufficient funds");
-                    return false;
+                    setCoins.clear();
+                    nValueIn = 0;
+                    if (!SelectCoins(vAvailableCoins, nTotalValue, setCoins, nValueIn, coinControl))
+                    {
+                        strFailReason = _("Insufficient funds");
+                        return false;
+                    }
                 }
                 BOOST_FOREACH(PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setCoins)
                 {
@@ -38,6 +38,16 @@ extern bool fPayAtLeastCustomFee;
 
 extern CAmount nMinimumInputThreshold;
 
+//! Maximum number of branches explored when searching for an exact-match coin selection
+static const unsigned int COINSELECT_BNB_MAX_TRIES = 100000;
+//! Upper bound on coins visited by the stochastic subset approximation in one coin selection pass
+static const unsigned int COINSELECT_KNAPSACK_MAX_VISITS = 2000000;
+//! Maximum number of threads reading blocks during a wallet rescan
+static const int MAX_RESCAN_THREADS = 4;
+//! Number of blocks rescan threads may read ahead of the scanning thread
+static const size_t RESCAN_READ_AHEAD = 32;
+//! Largest number of keys, scripts and outputs a rescan looks up in block filters before it just reads every block
+static const size_t MAX_RESCAN_FILTER_ELEMENTS = 10000;
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
 //! -paytxfee will warn if called with a higher fee than this amount (in satoshis) per KB
@@ -112,7 +122,7 @@ public:
 class CWallet : public CCryptoKeyStore, public CValidationInterface
 {
 private:
-    bool SelectCoins(const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
 
     CWalletDB *pwalletdbEncryption;
 
@@ -137,6 +147,22 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Wallet transactions that may still have unspent outputs of ours: those
+     * with an output that IsMine and is not spent by a wallet transaction
+     * confirmed in the main chain. Balance queries and AvailableCoins walk
+     * this set instead of all of mapWallet; the exact IsSpent check is still
+     * applied to its members. Membership only changes when a spending
+     * transaction is added or gets (un)confirmed, which AddToWallet sees.
+     * Rebuilt from scratch after loading or when IsMine may have changed.
+     */
+    mutable std::set<uint256> setUnspentTxs;
+    mutable bool fUnspentTxsDirty;
+    bool IsSpentInMainChain(const uint256& hash, unsigned int n) const;
+    bool MayHaveUnspentOutputs(const CWalletTx& wtx) const;
+    void UpdateUnspentTxs(const CWalletTx& wtx);
+    const std::set<uint256>& GetUnspentTxs() const;
+
 public:
     /*
      * Main wallet lock.
@@ -187,6 +213,7 @@ public:
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
+        fUnspentTxsDirty = true;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -208,7 +235,7 @@ public:
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
 
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL) const;
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -281,7 +308,9 @@ public:
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256 &hash);
+    /** Returns the number of transactions added or updated, or -1 if the rescan had to be aborted */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    void GetBlockFilterElements(std::vector<std::vector<unsigned char> >& vElements, std::vector<COutPoint>& vOutpoints) const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
     CAmount GetBalance() const;